@@ -0,0 +1,164 @@
+/*
+ * Startup memory arena and memory budget
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+struct arena_owner {
+    const char* name;
+    size_t bytes;
+};
+
+// Linker-defined bounds of the initialised and zeroed data (.data/.bss)
+extern "C" char __data_start[];
+extern "C" char _end[];
+
+static char* base = NULL;
+static size_t capacity = 0;
+static size_t used = 0;
+static size_t arena_charged = 0;    // Owner bytes carved from the arena
+static bool locked = false;
+static size_t heap_baseline = 0;
+
+static struct arena_owner owners[ARENA_MAX_OWNERS];
+static int num_owners = 0;
+
+static void charge(const char* owner, size_t size) {
+    for (int i = 0; i < num_owners; i++) {
+        if (strcmp(owners[i].name, owner) == 0) {
+            owners[i].bytes += size;
+            return;
+        }
+    }
+    if (num_owners < ARENA_MAX_OWNERS) {
+        owners[num_owners].name = owner;
+        owners[num_owners].bytes = size;
+        num_owners++;
+    }
+}
+
+// Bytes currently allocated from the heap
+static size_t heap_in_use(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+int arena_init(size_t size) {
+    size = (size + 4095) & ~(size_t)4095;
+
+    // Prefaulted, so arena pages never fault in on the RX path
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping memory arena");
+        return -1;
+    }
+    base = (char*)map;
+    capacity = size;
+    used = 0;
+    return 0;
+}
+
+bool arena_fixed(void) {
+    return base != NULL;
+}
+
+void* arena_alloc(size_t size, size_t align, const char* owner) {
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+
+    if (base == NULL) {
+        void* mem = NULL;
+        if (posix_memalign(&mem, align, size) != 0) {
+            return NULL;
+        }
+        memset(mem, 0, size);
+        charge(owner, size);
+        return mem;
+    }
+
+    size_t offset = (used + align - 1) & ~(align - 1);
+    if (offset + size > capacity) {
+        fprintf(stderr, "Memory arena exhausted: %s needs %zu bytes, %zu of %zu KiB left\n",
+                owner, size, (capacity - used) >> 10, capacity >> 10);
+        return NULL;
+    }
+    used = offset + size;
+    arena_charged += size;
+    charge(owner, size);
+
+    // Fresh anonymous pages are already zero
+    return base + offset;
+}
+
+void arena_free(void* ptr) {
+    if (base != NULL && (char*)ptr >= base && (char*)ptr < base + capacity) {
+        return;
+    }
+    free(ptr);
+}
+
+void arena_charge(const char* owner, size_t size) {
+    charge(owner, size);
+}
+
+void arena_thread_attr(pthread_attr_t* attr) {
+    pthread_attr_init(attr);
+    if (base != NULL) {
+        pthread_attr_setstacksize(attr, (size_t)ARENA_THREAD_STACK_KB << 10);
+        charge("thread stacks", (size_t)ARENA_THREAD_STACK_KB << 10);
+    }
+}
+
+int arena_lock(void) {
+    if (base == NULL) {
+        return 0;
+    }
+
+    // Freed heap memory stays mapped (and locked) instead of going back to
+    // the kernel, and no allocation gets its own mapping
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        perror("Error locking memory");
+        return -1;
+    }
+    locked = true;
+    heap_baseline = heap_in_use();
+    return 0;
+}
+
+void arena_report(FILE* out) {
+    size_t static_size = _end - __data_start;
+    size_t total = static_size;
+
+    fprintf(out, "Memory budget%s:\n", locked ? " (locked)" : "");
+    fprintf(out, "  %-16s %10.1f KiB\n", "static data", static_size / 1024.0);
+    for (int i = 0; i < num_owners; i++) {
+        fprintf(out, "  %-16s %10.1f KiB\n", owners[i].name, owners[i].bytes / 1024.0);
+        total += owners[i].bytes;
+    }
+    if (base != NULL) {
+        fprintf(out, "  %-16s %10.1f KiB reserved, %.1f KiB used\n", "arena",
+                capacity / 1024.0, used / 1024.0);
+        // The whole arena is resident, including what is not carved out yet
+        total += capacity - arena_charged;
+    }
+    fprintf(out, "  %-16s %10.1f KiB\n", "total", total / 1024.0);
+
+    if (locked) {
+        size_t heap = heap_in_use();
+        fprintf(out, "  Heap growth after startup: %zu bytes\n",
+                heap > heap_baseline ? heap - heap_baseline : 0);
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * Startup memory arena and memory budget
+ *
+ * Queues and rings that are sized at startup are allocated with
+ * arena_alloc(). Normally that is an aligned heap allocation. In the
+ * fixed-memory profile (-m, the default when built with FIXED_MEMORY=1)
+ * arena_init() maps one prefaulted region and every allocation is carved
+ * from it. Once startup is complete arena_lock() locks all pages with
+ * mlockall() and stops the heap from trimming, so the resident set stays
+ * fixed and the RX path never takes a page fault.
+ *
+ * Allocations are charged to an owner; arena_report() prints the totals
+ * as the memory budget.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Arena size used by -m without a size
+#define ARENA_DEFAULT_KB 1024
+
+// Stack size of the bridge's threads in the fixed-memory profile (the
+// default 8 MiB would all be locked)
+#define ARENA_THREAD_STACK_KB 256
+
+// Owners reported in the budget
+#define ARENA_MAX_OWNERS 16
+
+// Enter the fixed-memory profile with an arena of size bytes. Must be
+// called before anything is allocated. Returns 0 or -1.
+int arena_init(size_t size);
+
+bool arena_fixed(void);
+
+// Zeroed, aligned allocation charged to owner. Returns NULL when the arena
+// (or the heap) is exhausted.
+void* arena_alloc(size_t size, size_t align, const char* owner);
+
+// Release an allocation (arena memory is only reclaimed at exit)
+void arena_free(void* ptr);
+
+// Charge memory that is not allocated here (mappings, thread stacks)
+void arena_charge(const char* owner, size_t size);
+
+// Thread attributes of the bridge's threads (smaller stacks in the
+// fixed-memory profile). Call pthread_attr_destroy() after use.
+void arena_thread_attr(pthread_attr_t* attr);
+
+// Lock all current and future pages (fixed-memory profile only).
+// Returns 0 or -1.
+int arena_lock(void);
+
+// Print the memory budget, and in the fixed-memory profile how much the
+// heap grew after arena_lock()
+void arena_report(FILE* out);
+
+#endif // ARENA_H
@@ -0,0 +1,266 @@
+/*
+ * Decoder and dispatch microbenchmarks
+ *
+ * Measures decodeKeypadButtons(), decodeTSC1() and PGN dispatch over a
+ * fixed set of pseudo-random payloads and prints ns per call. A second
+ * dispatch run replays mostly repeated payloads, like a real keypad stream,
+ * to show what the signal store saves. The batch decoders are measured per
+ * frame, including gathering the payloads into a dbc_batch. The routing
+ * run forwards the mix through the routes of topology/rcu4.h to sink
+ * destinations, flushed once per TX batch. The rewrite run applies a dozen
+ * rules to each frame of the mix, as forward_frame() does for a
+ * destination with rules (copy into the ring slot, then rewrite).
+ *
+ * In a fixed topology build (make TOPOLOGY=rcu4 bench) dispatch and routing
+ * use the compiled-in topology instead of the tables; make bench-topology
+ * runs both builds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock_util.h"
+#include "decoders.h"
+#include "dispatch.h"
+#include "event_loop.h"
+#include "forward.h"
+#include "rewrite.h"
+#include "topology.h"
+
+// The runtime build routes the same topology with the routing table
+#ifndef CAN_BRIDGE_TOPOLOGY
+#include "topology/rcu4.h"
+#endif
+
+#define NUM_PAYLOADS 1024
+#define DEFAULT_ITERATIONS 10000000
+
+// Extra PGNs registered to size the dispatch table like a full J1939 setup
+#define EXTRA_DECODERS 60
+
+static unsigned char payloads[NUM_PAYLOADS][8];
+static struct canfd_frame frames[NUM_PAYLOADS];
+static struct canfd_frame repeat_frames[NUM_PAYLOADS];
+static volatile unsigned long sink;
+
+#ifndef CAN_BRIDGE_TOPOLOGY
+static void count_decoder(const struct j1939_msg* msg) {
+    sink += msg->data[0];
+}
+#endif
+
+// Simple xorshift PRNG so runs are reproducible
+static uint32_t rng_state = 2463534242u;
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void report(const char* name, long iterations, uint64_t elapsed_ns) {
+    double ns_per_op = (double)elapsed_ns / iterations;
+    printf("  %-24s %8.2f ns/op  %8.2f Mops/s\n", name, ns_per_op, 1000.0 / ns_per_op);
+}
+
+static void bench_keypad(long iterations) {
+    struct keypad_state state;
+    uint64_t start = monotonic_ns();
+    for (long i = 0; i < iterations; i++) {
+        decodeKeypadButtons(payloads[i & (NUM_PAYLOADS - 1)], payloads[(i - 1) & (NUM_PAYLOADS - 1)], &state);
+        sink += state.changed;
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    report("decodeKeypadButtons", iterations, elapsed);
+}
+
+static void bench_tsc1(long iterations) {
+    struct tsc1_request req;
+    uint64_t start = monotonic_ns();
+    for (long i = 0; i < iterations; i++) {
+        decodeTSC1(payloads[i & (NUM_PAYLOADS - 1)], &req);
+        sink += req.ctrl_mode;
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    report("decodeTSC1", iterations, elapsed);
+}
+
+// Gather DBC_BATCH_MAX payloads per round; iterations counts frames
+static void bench_keypad_batch(long iterations) {
+    static struct dbc_batch batch;
+    uint8_t pressed[DBC_BATCH_MAX];
+    long rounds = iterations / DBC_BATCH_MAX;
+    uint64_t start = monotonic_ns();
+    for (long r = 0; r < rounds; r++) {
+        dbc_batch_clear(&batch);
+        for (int i = 0; i < DBC_BATCH_MAX; i++) {
+            dbc_batch_add(&batch, payloads[(r * DBC_BATCH_MAX + i) & (NUM_PAYLOADS - 1)]);
+        }
+        decodeKeypadBatch(&batch, pressed);
+        sink += pressed[r & (DBC_BATCH_MAX - 1)];
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    report("decodeKeypadBatch", rounds * DBC_BATCH_MAX, elapsed);
+}
+
+static void bench_tsc1_batch(long iterations) {
+    static struct dbc_batch batch;
+    static struct tsc1_batch out;
+    long rounds = iterations / DBC_BATCH_MAX;
+    uint64_t start = monotonic_ns();
+    for (long r = 0; r < rounds; r++) {
+        dbc_batch_clear(&batch);
+        for (int i = 0; i < DBC_BATCH_MAX; i++) {
+            dbc_batch_add(&batch, payloads[(r * DBC_BATCH_MAX + i) & (NUM_PAYLOADS - 1)]);
+        }
+        decodeTSC1Batch(&batch, &out);
+        sink += out.speed_q3[r & (DBC_BATCH_MAX - 1)];
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    report("decodeTSC1Batch", rounds * DBC_BATCH_MAX, elapsed);
+}
+
+static void bench_dispatch(const char* label, const struct canfd_frame* set, int iface, long iterations) {
+    long hits = 0;
+    uint64_t start = monotonic_ns();
+    for (long i = 0; i < iterations; i++) {
+        hits += dispatch_frame(&set[i & (NUM_PAYLOADS - 1)], iface, 0);
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    char name[64];
+    snprintf(name, sizeof(name), "dispatch %s", label);
+    report(name, iterations, elapsed);
+    printf("  %-24s %8.1f %%\n", "decoder run rate", 100.0 * hits / iterations);
+}
+
+// Frames of the mix come in on the interfaces in turn
+static void bench_route(long iterations) {
+    static struct event_loop loop;
+    struct fwd_route routes[TOPOLOGY_NUM_ROUTES];
+
+    if (event_loop_init(&loop) < 0 || forward_init(&loop) < 0) {
+        return;
+    }
+    for (int i = 0; i < TOPOLOGY_NUM_IFACES; i++) {
+        forward_set_sink(i, topology_ifaces[i].name);
+    }
+    for (int i = 0; i < TOPOLOGY_NUM_ROUTES; i++) {
+        routes[i] = topology_routes[i];
+    }
+    if (forward_set_routes(routes, TOPOLOGY_NUM_ROUTES) < 0) {
+        return;
+    }
+
+    uint64_t start = monotonic_ns();
+    for (long i = 0; i < iterations; i++) {
+        forward_frame(i % TOPOLOGY_NUM_IFACES, &frames[i & (NUM_PAYLOADS - 1)], 0, 0);
+        if ((i & (FWD_TX_BATCH - 1)) == FWD_TX_BATCH - 1) {
+            forward_flush();
+        }
+    }
+    forward_flush();
+    uint64_t elapsed = monotonic_ns() - start;
+    char name[64];
+    snprintf(name, sizeof(name), "route (%d routes)", TOPOLOGY_NUM_ROUTES);
+    report(name, iterations, elapsed);
+    forward_close();
+}
+
+// Rules on destination 0: some match TSC1 or the keypad, the rest other PGNs
+static const char* const bench_rules[] = {
+    "0C000003/FFFF00 clamp:TSC1.RequestedSpeed=0..2000",
+    "0C000003/FFFF00 clamp:TSC1.RequestedTorque=-50..50",
+    "0C000003/FFFF00 if:TSC1.OverridePriority=3 set:TSC1.OverridePriority=2",
+    "0C000003 sa=27",
+    "18FF0280 if:KEYPAD.BTN0=1 byte:7=80/80",
+    "18FF0280 set:KEYPAD.BTN7=0",
+    "18FF0280/FFFFFF00 da=00",
+    "18FEF100/FFFF00 drop",
+    "18FEF200/FFFF00 prio=3",
+    "18FE0000/FFFF00 byte:0=00",
+    "18F00400/FFFF00 id=18F00490",
+    "0CF00300/FFFF00 byte:1=FF",
+};
+
+static void bench_rewrite(long iterations) {
+    struct canfd_frame scratch;
+    int num_rules = sizeof(bench_rules) / sizeof(bench_rules[0]);
+
+    rewrite_begin();
+    for (int i = 0; i < num_rules; i++) {
+        if (rewrite_add(0, bench_rules[i]) < 0) {
+            return;
+        }
+    }
+    rewrite_commit();
+
+    uint64_t start = monotonic_ns();
+    for (long i = 0; i < iterations; i++) {
+        const struct canfd_frame* f = &frames[i & (NUM_PAYLOADS - 1)];
+        memcpy(&scratch, f, CAN_MTU);
+        sink += rewrite_frame(0, &scratch) + scratch.data[0];
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    char name[64];
+    snprintf(name, sizeof(name), "rewrite (%d rules)", num_rules);
+    report(name, iterations, elapsed);
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+
+    for (int i = 0; i < NUM_PAYLOADS; i++) {
+        for (int b = 0; b < 8; b++) {
+            payloads[i][b] = next_random() & 0xFF;
+        }
+    }
+
+    if (register_decoders() < 0) {
+        return 1;
+    }
+
+    // Frame mix: keypad, TSC1, registered PGNs and unknown PGNs
+    for (int i = 0; i < NUM_PAYLOADS; i++) {
+        struct canfd_frame* f = &frames[i];
+        uint32_t r = next_random();
+        switch (r % 4) {
+        case 0: f->can_id = 0x18FF0280; break;
+        case 1: f->can_id = 0x0C000003; break;
+        case 2: f->can_id = 0x18000000 | ((0xFE00 + (r >> 8) % EXTRA_DECODERS) << 8) | (r & 0xFF); break;
+        default: f->can_id = 0x18000000 | ((0xF000 + (r >> 8) % 0x100) << 8) | (r & 0xFF); break;
+        }
+        f->can_id |= CAN_EFF_FLAG;
+        f->len = 8;
+        memcpy(f->data, payloads[i], 8);
+    }
+
+    // Keypad stream where one message in 16 changes the payload
+    for (int i = 0; i < NUM_PAYLOADS; i++) {
+        struct canfd_frame* f = &repeat_frames[i];
+        f->can_id = CAN_ID_KEYPAD | CAN_EFF_FLAG;
+        f->len = 8;
+        memcpy(f->data, payloads[i & ~15], 8);
+    }
+
+    printf("Decoder microbenchmarks (%ld iterations)\n", iterations);
+    bench_keypad(iterations);
+    bench_tsc1(iterations);
+    bench_keypad_batch(iterations);
+    bench_tsc1_batch(iterations);
+    char label[32];
+    snprintf(label, sizeof(label), "(%d decoders)", dispatch_count());
+    bench_dispatch(label, frames, 0, iterations);
+#ifndef CAN_BRIDGE_TOPOLOGY
+    // Compiled-in dispatch only knows the topology's decoders
+    for (int i = 0; i < EXTRA_DECODERS; i++) {
+        dispatch_register(0xFE00 + i, J1939_ANY_ADDR, J1939_ANY_ADDR, 0, count_decoder, NULL, "bench");
+    }
+    snprintf(label, sizeof(label), "(%d decoders)", dispatch_count());
+    bench_dispatch(label, frames, 0, iterations);
+#endif
+    bench_dispatch("(keypad repeats)", repeat_frames, 1, iterations);
+    bench_route(iterations);
+    bench_rewrite(iterations);
+    return 0;
+}
@@ -0,0 +1,287 @@
+/*
+ * End-to-end replay benchmark
+ *
+ * Sends the frames of a candump log on one interface (typically a vcan bus
+ * the bridge reads from) at a fixed rate and receives them on another (the
+ * bus the bridge forwards to). Received frames are matched in order against
+ * the sent ones; frames that never arrive count as drops. Reports
+ * throughput, latency percentiles from send to kernel RX timestamp, and the
+ * drop count.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "candump.h"
+#include "clock_util.h"
+#include "latency.h"
+
+// Sent frames a received frame is matched against before giving up
+#define MATCH_WINDOW 1024
+
+// Time to wait for the last frames after sending finished
+#define DRAIN_TIMEOUT_NS 500000000ull
+
+struct sent_frame {
+    struct can_frame frame;
+    uint64_t tx_ns;
+};
+
+static struct can_frame* log_frames;
+static long num_log_frames;
+
+static struct sent_frame* sent;
+static long num_to_send;
+static long num_sent = 0;           // Published by the TX thread
+static volatile bool tx_done = false;
+
+static int open_socket(const char* ifname, bool timestamps) {
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+
+    int sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", ifname);
+    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
+        perror(ifname);
+        close(sock);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+
+    if (timestamps) {
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+    }
+    return sock;
+}
+
+static int load_log(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    long capacity = 4096;
+    log_frames = (struct can_frame*)malloc(capacity * sizeof(struct can_frame));
+    char line[256];
+    struct candump_entry entry;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        // Classic frames only, the output is matched as can_frame
+        if (candump_parse_line(line, &entry) < 0 || can_frame_is_fd(&entry.frame)) {
+            continue;
+        }
+        if (num_log_frames == capacity) {
+            capacity *= 2;
+            log_frames = (struct can_frame*)realloc(log_frames, capacity * sizeof(struct can_frame));
+        }
+        struct can_frame* frame = &log_frames[num_log_frames++];
+        memset(frame, 0, sizeof(*frame));
+        frame->can_id = entry.frame.can_id;
+        frame->can_dlc = entry.frame.len;
+        memcpy(frame->data, entry.frame.data, CAN_MAX_DLEN);
+    }
+    fclose(f);
+
+    if (num_log_frames == 0) {
+        fprintf(stderr, "%s: no frames\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+struct tx_args {
+    int sock;
+    double rate;        // Frames per second, 0 = as fast as possible
+};
+
+static void* tx_main(void* arg) {
+    struct tx_args* args = (struct tx_args*)arg;
+    uint64_t start = monotonic_ns();
+
+    for (long i = 0; i < num_to_send; i++) {
+        if (args->rate > 0) {
+            uint64_t due = start + (uint64_t)(i * 1e9 / args->rate);
+            struct timespec ts = { (time_t)(due / 1000000000ull), (long)(due % 1000000000ull) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+
+        struct sent_frame* s = &sent[i];
+        s->frame = log_frames[i % num_log_frames];
+        s->tx_ns = realtime_ns();
+        while (write(args->sock, &s->frame, sizeof(s->frame)) < 0) {
+            if (errno != ENOBUFS && errno != EINTR) {
+                perror("write");
+                tx_done = true;
+                return NULL;
+            }
+            usleep(100);
+            s->tx_ns = realtime_ns();
+        }
+        __atomic_store_n(&num_sent, i + 1, __ATOMIC_RELEASE);
+    }
+
+    tx_done = true;
+    return NULL;
+}
+
+static bool same_frame(const struct can_frame* a, const struct can_frame* b) {
+    return a->can_id == b->can_id && a->can_dlc == b->can_dlc &&
+           memcmp(a->data, b->data, a->can_dlc) == 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s -l log -t tx_if -o rx_if [-r rate] [-n frames]\n"
+            "  -l    candump log to replay (repeated as needed)\n"
+            "  -t    Interface to send on (bridge input)\n"
+            "  -o    Interface to receive on (bridge output)\n"
+            "  -r    Frames per second (default 0 = as fast as possible)\n"
+            "  -n    Number of frames to send (default: one pass over the log)\n",
+            prog);
+}
+
+int main(int argc, char* argv[]) {
+    const char* log_path = NULL;
+    const char* tx_if = NULL;
+    const char* rx_if = NULL;
+    struct tx_args args = { -1, 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:t:o:r:n:")) != -1) {
+        switch (opt) {
+        case 'l': log_path = optarg; break;
+        case 't': tx_if = optarg; break;
+        case 'o': rx_if = optarg; break;
+        case 'r': args.rate = atof(optarg); break;
+        case 'n': num_to_send = atol(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (log_path == NULL || tx_if == NULL || rx_if == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (load_log(log_path) < 0) {
+        return 1;
+    }
+    if (num_to_send <= 0) {
+        num_to_send = num_log_frames;
+    }
+    sent = (struct sent_frame*)calloc(num_to_send, sizeof(struct sent_frame));
+
+    int rx_sock = open_socket(rx_if, true);
+    args.sock = open_socket(tx_if, false);
+    if (rx_sock < 0 || args.sock < 0 || sent == NULL) {
+        return 1;
+    }
+
+    struct timeval tv = { 0, 100000 };
+    setsockopt(rx_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    printf("Replaying %ld frames from %s: %s -> %s at %s\n", num_to_send, log_path, tx_if, rx_if,
+           args.rate > 0 ? "fixed rate" : "full speed");
+
+    pthread_t tx_thread;
+    uint64_t start = monotonic_ns();
+    pthread_create(&tx_thread, NULL, tx_main, &args);
+
+    static struct latency_hist hist;
+    long next = 0;          // Oldest sent frame not yet matched or dropped
+    long received = 0;
+    long unmatched = 0;
+    uint64_t last_rx = start;
+
+    while (next < num_to_send) {
+        struct can_frame frame;
+        char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+        struct iovec iov = { &frame, sizeof(frame) };
+        struct msghdr msg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(rx_sock, &msg, 0);
+        if (n < (ssize_t)sizeof(frame)) {
+            if (tx_done && monotonic_ns() - last_rx > DRAIN_TIMEOUT_NS) {
+                break;
+            }
+            continue;
+        }
+        last_rx = monotonic_ns();
+
+        uint64_t rx_ns = realtime_ns();
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_TIMESTAMPING) {
+                rx_ns = timespec_ns(&((struct scm_timestamping*)CMSG_DATA(c))->ts[0]);
+            }
+        }
+
+        // Match against the oldest sent frames; skipped ones were dropped
+        long limit = __atomic_load_n(&num_sent, __ATOMIC_ACQUIRE);
+        if (limit > next + MATCH_WINDOW) {
+            limit = next + MATCH_WINDOW;
+        }
+        long match = -1;
+        for (long i = next; i < limit; i++) {
+            if (same_frame(&sent[i].frame, &frame)) {
+                match = i;
+                break;
+            }
+        }
+        if (match < 0) {
+            unmatched++;
+            continue;
+        }
+
+        latency_record_span(&hist, sent[match].tx_ns, rx_ns);
+        received++;
+        next = match + 1;
+    }
+
+    pthread_join(tx_thread, NULL);
+    uint64_t elapsed = last_rx - start;
+
+    printf("  sent        %ld\n", num_to_send);
+    printf("  received    %ld\n", received);
+    printf("  dropped     %ld\n", num_to_send - received);
+    printf("  unmatched   %ld\n", unmatched);
+    printf("  throughput  %.0f frames/s\n", elapsed > 0 ? received * 1e9 / elapsed : 0.0);
+    printf("  latency     p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+           latency_quantile(&hist, 0.50) / 1000.0, latency_quantile(&hist, 0.99) / 1000.0,
+           latency_quantile(&hist, 0.999) / 1000.0, hist.max / 1000.0);
+
+    close(rx_sock);
+    close(args.sock);
+    return 0;
+}
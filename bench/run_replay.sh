@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Run the end-to-end replay benchmark on two vcan buses:
+#   bench_replay -> vcan0 -> can_bridge -> vcan1 -> bench_replay
+#
+# Usage: sudo bench/run_replay.sh log.candump [rate] [frames]
+#
+
+set -e
+
+LOG=${1:?usage: $0 log.candump [rate] [frames]}
+RATE=${2:-0}
+FRAMES=${3:-0}
+DIR=$(dirname "$0")
+
+modprobe vcan
+for bus in vcan0 vcan1; do
+    ip link show $bus >/dev/null 2>&1 || ip link add dev $bus type vcan
+    ip link set $bus up
+done
+
+"$DIR/../can_bridge" -i vcan0,vcan1 -r vcan0:vcan1 -a >/dev/null &
+BRIDGE=$!
+trap 'kill $BRIDGE 2>/dev/null' EXIT
+sleep 0.5
+
+"$DIR/bench_replay" -l "$LOG" -t vcan0 -o vcan1 -r "$RATE" -n "$FRAMES"
@@ -4,7 +4,11 @@
  * Simple CAN message router that reads from multiple CAN interfaces
  * and forwards messages between them.
  * 
- * Interfaces: canfd1, canfd2, canfd3 (using standard CAN, not CAN-FD)
+ * Interfaces: canfd1, canfd2, canfd3, classic CAN or CAN-FD per interface.
+ * A data bitrate (-i name:bitrate:dbitrate) configures an interface for
+ * CAN-FD; sockets on interfaces with the CAN-FD MTU take both classic and
+ * FD frames. FD frames routed to a classic interface are dropped and
+ * counted as TX errors.
  */
 
 #include <stdio.h>
@@ -13,275 +17,1004 @@
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
 
 #include <sys/socket.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <net/if.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <stdint.h>
 
-// CAN ID for keypad messages
-#define CAN_ID_KEYPAD 0x18FF0280
+#include "can_rx.h"
+#include "can_iface.h"
+#include "event_loop.h"
+#include "forward.h"
+#include "dispatch.h"
+#include "j1939_tp.h"
+#include "decoders.h"
+#include "log_ring.h"
+#include "capture.h"
+#include "replay.h"
+#include "can_filter.h"
+#include "latency.h"
+#include "can_netlink.h"
+#include "pipeline.h"
+#include "rx_threads.h"
+#include "arena.h"
+#include "shm_bus.h"
+#include "stats.h"
+#include "rewrite.h"
+#include "can_recovery.h"
+#include "health.h"
+#include "tx_sched.h"
+#include "uplink.h"
+#include "candump.h"
+#include "config.h"
+#include "topology.h"
 
-// CAN ID for J1939 TSC1 (Torque/Speed Control)
-#define CAN_ID_TSC1 0x0C000003
+// Receive buffers shared by all interfaces (frames are processed before the
+// next socket is read)
+static struct rx_batch rx_batch;
 
-// Button state tracking (for 8 buttons)
-static bool buttonStates[8] = {false};
-static bool buttonChanged[8] = {false};
+// Interfaces handled by the bridge (name, bitrate, data bitrate); replaced by -i
+static struct can_iface ifaces[MAX_CAN_IFACES] = {
+    { "canfd1", 250000, 0, 0, -1, { -1, NULL, NULL }, false },
+    { "canfd2", 500000, 0, 1, -1, { -1, NULL, NULL }, false },
+    { "canfd3", 500000, 0, 2, -1, { -1, NULL, NULL }, false },
+};
+static int num_ifaces = 3;
 
-// Global flag for clean shutdown
-volatile sig_atomic_t running = 1;
+// Storage for interface names given with -i
+static char iface_name_buf[MAX_CAN_IFACES][IFNAMSIZ];
 
-void signal_handler(int signum) {
-    running = 0;
+// Interface names in table order, for the logger thread and stats dumps
+static const char* iface_names[MAX_CAN_IFACES];
+
+// RX thread settings (-t); threaded mode is off by default
+static bool threaded = false;
+static struct rx_thread_cfg rx_cfg[MAX_CAN_IFACES];
+
+// Kernel filter settings (-a, -e)
+static bool accept_all = false;
+static can_err_mask_t err_mask = 0;
+
+static struct event_loop loop;
+static struct event_source signal_ev;
+
+// Routes given with -r, kept for configuration reloads
+static struct fwd_route cli_routes[FWD_MAX_ROUTES];
+static int num_cli_routes = 0;
+
+// Without any route each interface forwards everything to the next one
+static bool default_ring = false;
+
+// Configuration file (-f) and the configuration the bridge started with
+static const char* config_path = NULL;
+static struct bridge_config config;
+
+static void reload_config(void);
+
+// (Re)install kernel filters on all open sockets from the current decoder
+// and routing tables. Safe to call at runtime.
+static int apply_can_filters(void) {
+    for (int i = 0; i < num_ifaces; i++) {
+        if (ifaces[i].sock < 0) {
+            continue;
+        }
+        int count = can_filter_apply(ifaces[i].sock, ifaces[i].index, accept_all,
+                                     err_mask | CAN_RECOVERY_ERR_MASK);
+        if (count < 0) {
+            return -1;
+        }
+        printf("  %s: %d kernel filter(s)%s\n", ifaces[i].name, count,
+               accept_all ? " (accept all)" : "");
+    }
+    return 0;
 }
 
-// Decode keypad button data (J1939 format)
-void decodeKeypadButtons(unsigned char* data) {
-    // Combine first two bytes to get 16 bits for J1939 keypad format
-    uint16_t buttonData = (data[1] << 8) | data[0];
-    
-    printf("  Keypad Buttons: ");
+// epoll handler: a CAN socket became readable and/or writable
+static void on_can_event(struct event_source* src, uint32_t events) {
+    struct can_iface* iface = (struct can_iface*)src->ctx;
+    
+    if (events & EPOLLERR) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(iface->sock, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (!can_recovery_socket_error(iface->index, err)) {
+            fprintf(stderr, "Socket error on %s: %s\n", iface->name, strerror(err));
+        }
+    }
+    if (events & EPOLLIN) {
+        read_and_process_frames(iface, &rx_batch);
+    }
+    if (events & EPOLLOUT) {
+        forward_on_writable(iface->index);
+    }
+}
+
+// epoll handler: SIGINT/SIGTERM/SIGUSR1/SIGHUP delivered through the signalfd
+static void on_signal_event(struct event_source* src, uint32_t events) {
+    struct signalfd_siginfo info;
+    (void)events;
+    
+    while (read(src->fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+        if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM) {
+            event_loop_stop(&loop);
+        }
+        else if (info.ssi_signo == SIGUSR1) {
+            stats_publish();
+            stats_dump(stderr);
+            latency_dump(stderr, iface_names, num_ifaces);
+        }
+        else if (info.ssi_signo == SIGHUP) {
+            reload_config();
+        }
+    }
+}
+
+// Route shutdown and stats signals to a signalfd so the event loop can block
+// indefinitely instead of polling a flag
+static int setup_signal_fd(void) {
+    sigset_t mask;
+    
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGHUP);
+    
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        perror("Error blocking signals");
+        return -1;
+    }
     
-    // Check each button (2 bits each, starting from LSB)
-    for (int i = 0; i < 8; i++) {
-        uint8_t buttonBits = (buttonData >> (i * 2)) & 0x03;
-        bool previousState = buttonStates[i];
-        buttonStates[i] = (buttonBits == 0x01);
-        buttonChanged[i] = (buttonStates[i] != previousState);
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        perror("Error creating signalfd");
+        return -1;
+    }
+    return fd;
+}
+
+// Look up an interface index by name
+static int find_iface(const char* name) {
+    for (int i = 0; i < num_ifaces; i++) {
+        if (strcmp(ifaces[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void set_iface(int i, const char* name, int bitrate, int dbitrate) {
+    snprintf(iface_name_buf[i], IFNAMSIZ, "%s", name);
+    memset(&ifaces[i], 0, sizeof(ifaces[i]));
+    ifaces[i].name = iface_name_buf[i];
+    ifaces[i].bitrate = bitrate;
+    ifaces[i].dbitrate = dbitrate;
+    ifaces[i].index = i;
+    ifaces[i].sock = -1;
+    ifaces[i].ev.fd = -1;
+}
+
+// Parse an interface list given as name[:bitrate[:dbitrate]],... (bitrate 0
+// or omitted leaves the bitrate alone, e.g. for vcan; a data bitrate enables
+// CAN-FD)
+static int parse_ifaces(const char* spec) {
+    char buf[256];
+    int count = 0;
+    
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char* tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (count >= MAX_CAN_IFACES) {
+            fprintf(stderr, "Too many interfaces (max %d)\n", MAX_CAN_IFACES);
+            return -1;
+        }
         
-        // Print button state
-        if (buttonStates[i]) {
-            printf("[BTN%d:PRESSED]", i);
-            if (buttonChanged[i]) {
-                printf("*");  // Asterisk indicates state change
+        char* colon = strchr(tok, ':');
+        int bitrate = 0;
+        int dbitrate = 0;
+        if (colon != NULL) {
+            *colon = '\0';
+            bitrate = atoi(colon + 1);
+            char* dcolon = strchr(colon + 1, ':');
+            if (dcolon != NULL) {
+                dbitrate = atoi(dcolon + 1);
             }
-            printf(" ");
         }
+        if (strlen(tok) == 0 || strlen(tok) >= IFNAMSIZ) {
+            fprintf(stderr, "Invalid interface name '%s'\n", tok);
+            return -1;
+        }
+        
+        set_iface(count, tok, bitrate, dbitrate);
+        count++;
     }
-    printf("\n");
+    
+    if (count == 0) {
+        fprintf(stderr, "Empty interface list\n");
+        return -1;
+    }
+    num_ifaces = count;
+    return 0;
 }
 
-// Decode J1939 TSC1 message (Torque/Speed Control)
-void decodeTSC1(unsigned char* data) {
-    // Byte 0: Override control modes
-    uint8_t overrideCtrl = data[0];
-    
-    // Bytes 1-2: Requested speed/speed limit (little-endian, 0.125 rpm/bit)
-    uint16_t rawSpeed = (data[2] << 8) | data[1];
-    float requestedSpeed = rawSpeed * 0.125;  // RPM
-    
-    // Byte 3: Requested torque/torque limit (1% per bit, offset -125%)
-    uint8_t rawTorque = data[3];
-    int16_t requestedTorque = rawTorque - 125;  // Percent
+// Parse RX thread settings given as cpu[:prio],... in interface order
+// (cpu -1 leaves the thread unpinned, prio 0 keeps SCHED_OTHER)
+static int parse_rx_threads(const char* spec) {
+    char buf[256];
+    int count = 0;
+    
+    for (int i = 0; i < MAX_CAN_IFACES; i++) {
+        rx_cfg[i].cpu = -1;
+        rx_cfg[i].priority = 0;
+    }
     
-    // Byte 4: Override control mode priority
-    uint8_t priority = data[4] & 0x03;
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char* tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (count >= MAX_CAN_IFACES) {
+            fprintf(stderr, "Too many RX thread settings\n");
+            return -1;
+        }
+        char* end;
+        rx_cfg[count].cpu = strtol(tok, &end, 10);
+        if (*end == ':') {
+            rx_cfg[count].priority = strtol(end + 1, &end, 10);
+        }
+        if (*end != '\0' || rx_cfg[count].priority < 0 || rx_cfg[count].priority > 99) {
+            fprintf(stderr, "Invalid RX thread setting '%s' (expected cpu[:prio])\n", tok);
+            return -1;
+        }
+        count++;
+    }
     
-    printf("  TSC1: Speed=%.1f RPM, Torque=%d%%, Priority=%d, CtrlMode=0x%02X\n", 
-           requestedSpeed, requestedTorque, priority, overrideCtrl);
+    threaded = true;
+    return 0;
 }
 
-// Restart and configure a CAN interface
-int restart_can_interface(const char* interface_name, int bitrate) {
-    char command[256];
-    int ret;
-    
-    printf("Configuring %s...\n", interface_name);
+// Parse a route given as src:dst[:id[/mask]] (id and mask in hex)
+static int parse_route(const char* spec) {
+    char buf[128];
+    char* fields[5] = { NULL, NULL, NULL, NULL, NULL };
+    int nfields = 0;
+    
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char* tok = strtok(buf, ":"); tok != NULL && nfields < 5; tok = strtok(NULL, ":")) {
+        fields[nfields++] = tok;
+    }
+    if (nfields < 2) {
+        fprintf(stderr, "Invalid route '%s' (expected src:dst[:id[/mask]][:limit...])\n", spec);
+        return -1;
+    }
     
-    // Bring interface down
-    snprintf(command, sizeof(command), "ip link set %s down 2>/dev/null", interface_name);
-    system(command);
+    int src = find_iface(fields[0]);
+    int dst = find_iface(fields[1]);
+    if (src < 0 || dst < 0 || src == dst) {
+        fprintf(stderr, "Invalid route '%s': unknown or identical interfaces\n", spec);
+        return -1;
+    }
     
-    // Configure bitrate
-    snprintf(command, sizeof(command), "ip link set %s type can bitrate %d", interface_name, bitrate);
-    ret = system(command);
-    if (ret != 0) {
-        fprintf(stderr, "Warning: Failed to configure %s bitrate\n", interface_name);
+    canid_t id = 0;
+    canid_t mask = 0;
+    struct fwd_limit limit;
+    memset(&limit, 0, sizeof(limit));
+    for (int i = 2; i < nfields; i++) {
+        int ret = config_parse_limit(fields[i], &limit);
+        if (ret < 0 || (ret > 0 && (i > 2 || config_parse_id(fields[i], &id, &mask) < 0))) {
+            fprintf(stderr, "Invalid CAN ID/mask or limit in route '%s'\n", spec);
+            return -1;
+        }
     }
     
-    // Bring interface up
-    snprintf(command, sizeof(command), "ip link set %s up", interface_name);
-    ret = system(command);
-    if (ret != 0) {
-        fprintf(stderr, "Error: Failed to bring up %s\n", interface_name);
+    struct fwd_route* route = &cli_routes[num_cli_routes++];
+    route->src = src;
+    route->id = id & mask;
+    route->mask = mask;
+    route->dst = dst;
+    route->limit = limit;
+    return 0;
+}
+
+// A fixed topology build (topology.h) has its interfaces, routes and
+// decoders compiled in; a configuration may not set them
+static int check_topology(const struct bridge_config* cfg) {
+#ifdef CAN_BRIDGE_TOPOLOGY
+    if (cfg->num_ifaces > 0 || cfg->num_routes > 0 || cfg->num_decoders > 0) {
+        fprintf(stderr, "%s: interfaces, routes and decoders are fixed by %s in this build\n",
+                config_path, CAN_BRIDGE_TOPOLOGY);
         return -1;
     }
-    
-    printf("  %s configured at %d bps\n", interface_name, bitrate);
+#else
+    (void)cfg;
+#endif
     return 0;
 }
 
-// Create and bind a CAN socket to the specified interface
-int setup_can_socket(const char* interface_name) {
-    int sock;
-    struct sockaddr_can addr;
-    struct ifreq ifr;
+// Routing table from -r routes and the configuration file's routes.
+// Returns the number of routes written to out, or -1.
+static int build_routes(const struct bridge_config* cfg, struct fwd_route* out) {
+    int count = 0;
+    
+#ifdef CAN_BRIDGE_TOPOLOGY
+    (void)cfg;
+    for (int i = 0; i < TOPOLOGY_NUM_ROUTES; i++) {
+        out[count++] = topology_routes[i];
+    }
+    return count;
+#endif
+    for (int i = 0; i < num_cli_routes; i++) {
+        out[count++] = cli_routes[i];
+    }
+    for (int i = 0; i < cfg->num_routes; i++) {
+        const struct config_route* cr = &cfg->routes[i];
+        int src = find_iface(cr->src);
+        int dst = find_iface(cr->dst);
+        if (src < 0 || dst < 0 || src == dst) {
+            fprintf(stderr, "Invalid route %s -> %s: unknown or identical interfaces\n",
+                    cr->src, cr->dst);
+            return -1;
+        }
+        if (count >= FWD_MAX_ROUTES) {
+            fprintf(stderr, "Too many routes\n");
+            return -1;
+        }
+        out[count].src = src;
+        out[count].id = cr->id & cr->mask;
+        out[count].mask = cr->mask;
+        out[count].dst = dst;
+        out[count].limit = cr->limit;
+        count++;
+    }
     
-    // Create socket
-    sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    if (sock < 0) {
-        perror("Error creating socket");
+    // Default routing: each interface forwards everything to the next one
+    // (canfd1 -> canfd2 -> canfd3 -> canfd1)
+    if (default_ring && count == 0 && num_ifaces > 1) {
+        for (int i = 0; i < num_ifaces; i++) {
+            out[count].src = i;
+            out[count].id = 0;
+            out[count].mask = 0;
+            out[count].dst = (i + 1) % num_ifaces;
+            memset(&out[count].limit, 0, sizeof(out[count].limit));
+            count++;
+        }
+    }
+    return count;
+}
+
+// Install the routes and extra kernel filter rules of a configuration.
+// Filters on open sockets are updated by the next apply_can_filters().
+static int install_config(const struct bridge_config* cfg) {
+    struct fwd_route routes[FWD_MAX_ROUTES];
+    struct can_filter_rule rules[CAN_FILTER_MAX_RULES];
+    
+    int num_routes = build_routes(cfg, routes);
+    if (num_routes < 0) {
         return -1;
     }
-    
-    // Get interface index
-    strcpy(ifr.ifr_name, interface_name);
-    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
-        perror("Error getting interface index");
-        close(sock);
+    for (int i = 0; i < cfg->num_filters; i++) {
+        rules[i].iface = find_iface(cfg->filters[i].iface);
+        rules[i].id = cfg->filters[i].id & cfg->filters[i].mask;
+        rules[i].mask = cfg->filters[i].mask;
+        if (rules[i].iface < 0) {
+            fprintf(stderr, "Invalid filter: unknown interface %s\n", cfg->filters[i].iface);
+            return -1;
+        }
+    }
+    rewrite_begin();
+    for (int i = 0; i < cfg->num_rewrites; i++) {
+        int dst = find_iface(cfg->rewrites[i].dst);
+        if (dst < 0) {
+            fprintf(stderr, "Invalid rewrite rule: unknown interface %s\n", cfg->rewrites[i].dst);
+            return -1;
+        }
+        if (rewrite_add(dst, cfg->rewrites[i].rule) < 0) {
+            return -1;
+        }
+    }
+    if (forward_set_routes(routes, num_routes) < 0 ||
+        can_filter_set_rules(rules, cfg->num_filters) < 0) {
         return -1;
     }
-    
-    // Bind socket to CAN interface
-    memset(&addr, 0, sizeof(addr));
-    addr.can_family = AF_CAN;
-    addr.can_ifindex = ifr.ifr_ifindex;
-    
-    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("Error binding socket");
-        close(sock);
+    rewrite_commit();
+    return 0;
+}
+
+// SIGHUP: re-read the configuration file and swap in its routes and
+// filters; the interfaces keep running
+static void reload_config(void) {
+    static struct bridge_config next;
+    
+    if (config_path == NULL) {
+        fprintf(stderr, "SIGHUP ignored: no configuration file (-f)\n");
+        return;
+    }
+    printf("Reloading %s\n", config_path);
+    if (config_load(config_path, &next) < 0 || check_topology(&next) < 0 || install_config(&next) < 0) {
+        fprintf(stderr, "Configuration not reloaded, keeping the previous one\n");
+        return;
+    }
+    if (config_needs_restart(&config, &next)) {
+        fprintf(stderr, "Interface and decoder changes in %s take effect after a restart\n",
+                config_path);
+    }
+    apply_can_filters();
+    printf("Forwarding with %d routes\n", forward_route_count());
+}
+
+// Parse a cyclic message given as if:period_ms:frame (frame in candump
+// syntax, e.g. canfd2:10:0C000003#FFFFFFFFFFFFFFFF)
+static int parse_cyclic(const char* spec) {
+    char buf[192];
+    
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char* period = strchr(buf, ':');
+    char* frame_text = period != NULL ? strchr(period + 1, ':') : NULL;
+    if (frame_text == NULL) {
+        fprintf(stderr, "Invalid cyclic message '%s' (expected if:period_ms:frame)\n", spec);
         return -1;
     }
+    *period++ = '\0';
+    *frame_text++ = '\0';
     
-    printf("Initialized CAN interface: %s\n", interface_name);
-    return sock;
+    int iface = find_iface(buf);
+    struct canfd_frame frame;
+    if (iface < 0 || candump_parse_frame(frame_text, &frame) < 0) {
+        fprintf(stderr, "Invalid cyclic message '%s': unknown interface or bad frame\n", spec);
+        return -1;
+    }
+    return tx_sched_add(iface, &frame, strtoul(period, NULL, 10));
 }
 
-// Read and print CAN frame from socket
-int read_and_print_frame(int src_sock, const char* src_name) {
-    struct can_frame frame;
-    int nbytes;
-    
-    // Read frame from source
-    nbytes = read(src_sock, &frame, sizeof(struct can_frame));
-    if (nbytes < 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            perror("Error reading from CAN");
+// Parse "dir[:files[:mb]]" for -w
+static int parse_capture(char* spec, const char** dir, int* files, size_t* file_size) {
+    char* files_str = strchr(spec, ':');
+    long mb = CAPTURE_DEFAULT_FILE_MB;
+
+    *files = CAPTURE_DEFAULT_FILES;
+    if (files_str != NULL) {
+        *files_str++ = '\0';
+        char* mb_str = strchr(files_str, ':');
+        if (mb_str != NULL) {
+            *mb_str++ = '\0';
+            mb = strtol(mb_str, NULL, 10);
         }
+        *files = atoi(files_str);
+    }
+    if (spec[0] == '\0' || mb <= 0) {
+        fprintf(stderr, "Invalid capture spec, expected dir[:files[:mb]]\n");
         return -1;
     }
-    
-    if (nbytes < (int)sizeof(struct can_frame)) {
-        fprintf(stderr, "Incomplete CAN frame received\n");
+    *dir = spec;
+    *file_size = (size_t)mb << 20;
+    return 0;
+}
+
+// -U udp|tcp:host:port[:ms]
+static int open_uplink(char* spec) {
+    char* host = strchr(spec, ':');
+    char* port = host != NULL ? strchr(host + 1, ':') : NULL;
+    int flush_ms = UPLINK_DEFAULT_FLUSH_MS;
+
+    if (port == NULL || (strncmp(spec, "udp:", 4) != 0 && strncmp(spec, "tcp:", 4) != 0)) {
+        fprintf(stderr, "Invalid uplink spec, expected udp|tcp:host:port[:ms]\n");
         return -1;
     }
-    
-    // Print received CAN message
-    printf("[RX %s] ID=0x%08X DLC=%d Data: ", src_name, frame.can_id & CAN_EFF_MASK, frame.can_dlc);
-    for (int i = 0; i < frame.can_dlc; i++) {
-        printf("%02X ", frame.data[i]);
+    *host++ = '\0';
+    *port++ = '\0';
+    char* ms_str = strchr(port, ':');
+    if (ms_str != NULL) {
+        *ms_str++ = '\0';
+        flush_ms = atoi(ms_str);
     }
-    printf("\n");
-    
-    // Decode specific messages
-    if ((frame.can_id & CAN_EFF_MASK) == CAN_ID_KEYPAD && frame.can_dlc >= 2) {
-        decodeKeypadButtons(frame.data);
+    if (uplink_open(strcmp(spec, "tcp") == 0, host, port, flush_ms, &loop) < 0) {
+        return -1;
+    }
+    printf("Uplink to %s %s:%s (packets of at most %d ms)\n", spec, host, port, flush_ms);
+    return 0;
+}
+
+// -b name[:frames]; the size is checked by shm_bus_open()
+static int parse_bus(char* spec, const char** name, uint32_t* frames) {
+    char* frames_str = strchr(spec, ':');
+
+    if (frames_str != NULL) {
+        *frames_str++ = '\0';
+        *frames = strtoul(frames_str, NULL, 10);
     }
-    else if ((frame.can_id & CAN_EFF_MASK) == CAN_ID_TSC1 && frame.can_dlc >= 4) {
-        decodeTSC1(frame.data);
+    if (spec[0] == '\0') {
+        fprintf(stderr, "Invalid frame bus spec, expected name[:frames]\n");
+        return -1;
     }
-    
-    fflush(stdout);  // Ensure immediate output
-    
+    *name = spec;
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    int sock_canfd1, sock_canfd2, sock_canfd3;
-    fd_set read_fds;
-    int max_fd;
-    struct timeval timeout;
-    //int bitrate = 250000;  // Default 250kbps, change as needed
+// Bring the links up, open the sockets and register them with the loop
+static int open_interfaces(bool forwarding) {
+    // Restart and configure CAN interfaces (returns once each link is up)
+    if (can_nl_open() < 0) {
+        return -1;
+    }
+    for (int i = 0; i < num_ifaces; i++) {
+        if (restart_can_interface(ifaces[i].name, ifaces[i].bitrate, ifaces[i].dbitrate,
+                                  CAN_RECOVERY_RESTART_MS) < 0) {
+            fprintf(stderr, "Failed to configure CAN interfaces\n");
+            return -1;
+        }
+        // Bitrates the links actually run at, for the bus load
+        struct can_link_info info;
+        if (can_nl_get_link(ifaces[i].name, &info) == 0 && info.bitrate > 0) {
+            ifaces[i].bitrate = info.bitrate;
+            ifaces[i].dbitrate = info.fd ? info.dbitrate : 0;
+        }
+    }
     
-    printf("CAN Bridge for RCU4 starting...\n");
+    printf("\nInitializing CAN sockets...\n");
     
-    // Setup signal handler for clean shutdown
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    // Initialize CAN sockets and register them with the event loop once
+    for (int i = 0; i < num_ifaces; i++) {
+        struct can_iface* iface = &ifaces[i];
+        
+        iface->sock = setup_can_socket(iface->name, &iface->fd);
+        if (iface->sock < 0) {
+            fprintf(stderr, "Failed to initialize CAN interfaces\n");
+            return -1;
+        }
+        
+        iface->ev.fd = iface->sock;
+        iface->ev.handler = on_can_event;
+        iface->ev.ctx = iface;
+        // With RX threads the loop only services TX readiness
+        if (event_loop_add(&loop, &iface->ev, threaded ? EPOLLOUT : EPOLLIN | EPOLLOUT) < 0) {
+            return -1;
+        }
+        if (forwarding) {
+            forward_set_dest(iface->index, iface->sock, iface->name, iface->fd);
+        }
+    }
     
-    // Restart and configure CAN interfaces
-    //printf("\nConfiguring CAN interfaces at %d bps...\n", bitrate);
-    if (restart_can_interface("canfd1", 250000) < 0 ||
-        restart_can_interface("canfd2", 500000) < 0 ||
-        restart_can_interface("canfd3", 500000) < 0) {
-        fprintf(stderr, "Failed to configure CAN interfaces\n");
+    // Only frames used by a decoder or a route are copied to userspace
+    if (apply_can_filters() < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-i if[:bitrate[:dbitrate]],...] [-v] [-a] [-e] [-n] [-t cpu[:prio],...]\n"
+            "          [-w dir[:files[:mb]]] [-R path [-S speed]] [-m kb] [-s name] [-b name[:frames]]\n"
+            "          [-c if:period_ms:frame]... [-u] [-U udp|tcp:host:port[:ms]]\n"
+            "          [-r src:dst[:id[/mask]][:limit]...]... [-f file]\n"
+            "  -f    Read interfaces, routes, filters and decoders from file (see\n"
+            "        config.h); SIGHUP reloads its routes and filters\n"
+            "  -i    Interfaces to use (default canfd1:250000,canfd2:500000,canfd3:500000);\n"
+            "        bitrate 0 or omitted keeps the current setting (e.g. vcan),\n"
+            "        a data bitrate enables CAN-FD\n"
+            "  -v    Print every received frame (formatted by a logger thread)\n"
+            "  -a    Accept all frames (no kernel filters from decoders/routes)\n"
+            "  -e    Also receive bus error frames (bus-off and controller state\n"
+            "        error frames are always received and counted)\n"
+            "  -n    Monitor only, do not forward\n"
+            "  -w    Capture frames to a ring of preallocated binary files in dir\n"
+            "        (default 8 files of 4 MiB)\n"
+            "  -R    Replay a capture directory, capture file or candump log through\n"
+            "        the pipeline instead of reading CAN sockets (frames are matched\n"
+            "        to -i interfaces by name, forwarded frames are only counted)\n"
+            "  -S    Replay speed: 1 = recorded timing (default), 10 = ten times\n"
+            "        faster, 0 = as fast as possible\n"
+            "  -m    Fixed-memory profile: allocate queues from one arena of kb KiB,\n"
+            "        lock all memory and print the memory budget (0 = off)\n"
+            "  -s    Publish live counters in the shared memory object name\n"
+            "        (/dev/shm/name, read with tools/can_stats)\n"
+            "  -b    Publish received frames and decoded state in the shared memory\n"
+            "        ring name (frames records, power of two, default 4096; read\n"
+            "        with tools/can_busdump)\n"
+            "  -c    Send a cyclic message, e.g. canfd2:10:0C000003#F0FFFF7D00FFFFFF\n"
+            "        (frame in candump syntax)\n"
+            "  -u    Send cyclic messages from the bridge's timer wheel instead of\n"
+            "        the kernel broadcast manager (CAN_BCM)\n"
+            "  -U    Send all received frames to a collector, batched into\n"
+            "        compact packets of at most ms milliseconds (default 100)\n"
+            "  -t    One RX thread per interface, given as cpu[:prio],... in interface\n"
+            "        order (cpu -1 = unpinned, prio = SCHED_FIFO priority, 0 = normal)\n"
+            "  -r    Add a route (replaces the default ring where each interface\n"
+            "        forwards to the next); id and mask are hex, mask defaults to\n"
+            "        0x1FFFFFFF. Limits: rate=n[/burst] forwards at most n frames/s\n"
+            "        (token bucket), change[=ms] a stream only when its payload\n"
+            "        changed or ms after it was last forwarded\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    bool forwarding = true;
+    bool verbose = false;
+    const char* capture_dir = NULL;
+    int capture_files = 0;
+    size_t capture_size = 0;
+    const char* replay_path = NULL;
+    const char* stats_name = NULL;
+    const char* bus_name = NULL;
+    uint32_t bus_frames = SHM_BUS_DEFAULT_FRAMES;
+    double replay_speed = 1.0;
+#ifdef CAN_BRIDGE_FIXED_MEMORY
+    int arena_kb = ARENA_DEFAULT_KB;
+#else
+    int arena_kb = 0;
+#endif
+    const char* route_specs[FWD_MAX_ROUTES];
+    int num_route_specs = 0;
+    const char* cyclic_specs[TX_SCHED_MAX_MSGS];
+    int num_cyclic_specs = 0;
+    bool use_bcm = true;
+    char* uplink_spec = NULL;
+    bool ifaces_given = false;
+    int opt;
+    
+    // The routing table must exist before -r options are parsed
+    if (event_loop_init(&loop) < 0 || forward_init(&loop) < 0) {
         return 1;
     }
+#ifdef CAN_BRIDGE_TOPOLOGY
+    for (int i = 0; i < TOPOLOGY_NUM_IFACES; i++) {
+        set_iface(i, topology_ifaces[i].name, topology_ifaces[i].bitrate, topology_ifaces[i].dbitrate);
+    }
+    num_ifaces = TOPOLOGY_NUM_IFACES;
+#endif
+    
+    while ((opt = getopt(argc, argv, "i:vaent:w:R:S:r:m:s:b:c:uU:f:h")) != -1) {
+        switch (opt) {
+        case 'i':
+#ifdef CAN_BRIDGE_TOPOLOGY
+            fprintf(stderr, "Interfaces are fixed by %s in this build\n", CAN_BRIDGE_TOPOLOGY);
+            return 1;
+#endif
+            if (parse_ifaces(optarg) < 0) {
+                return 1;
+            }
+            ifaces_given = true;
+            break;
+        case 'f':
+            config_path = optarg;
+            break;
+        case 'a':
+            accept_all = true;
+            break;
+        case 'e':
+            err_mask = CAN_FILTER_ERR_MASK;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'n':
+            forwarding = false;
+            break;
+        case 't':
+            if (parse_rx_threads(optarg) < 0) {
+                return 1;
+            }
+            break;
+        case 'w':
+            if (parse_capture(optarg, &capture_dir, &capture_files, &capture_size) < 0) {
+                return 1;
+            }
+            break;
+        case 'R':
+            replay_path = optarg;
+            break;
+        case 'S': {
+            char* end;
+            replay_speed = strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || !(replay_speed >= 0)) {
+                fprintf(stderr, "Invalid replay speed '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 'm':
+            arena_kb = atoi(optarg);
+            break;
+        case 's':
+            stats_name = optarg;
+            break;
+        case 'b':
+            if (parse_bus(optarg, &bus_name, &bus_frames) < 0) {
+                return 1;
+            }
+            break;
+        case 'c':
+            if (num_cyclic_specs >= TX_SCHED_MAX_MSGS) {
+                fprintf(stderr, "Too many cyclic messages\n");
+                return 1;
+            }
+            cyclic_specs[num_cyclic_specs++] = optarg;
+            break;
+        case 'u':
+            use_bcm = false;
+            break;
+        case 'U':
+            uplink_spec = optarg;
+            break;
+        case 'r':
+#ifdef CAN_BRIDGE_TOPOLOGY
+            fprintf(stderr, "Routes are fixed by %s in this build\n", CAN_BRIDGE_TOPOLOGY);
+            return 1;
+#endif
+            // Resolved after all options, once the interface list is final
+            if (num_route_specs >= FWD_MAX_ROUTES) {
+                fprintf(stderr, "Too many routes\n");
+                return 1;
+            }
+            route_specs[num_route_specs++] = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
     
-    // Small delay to let interfaces stabilize
-    usleep(100000);  // 100ms
-    
-    printf("\nInitializing CAN sockets...\n");
-    
-    // Initialize CAN sockets
-    sock_canfd1 = setup_can_socket("canfd1");
-    sock_canfd2 = setup_can_socket("canfd2");
-    sock_canfd3 = setup_can_socket("canfd3");
+    // Fixed-memory profile: queues and rings below come from one arena
+    if (arena_kb > 0 && arena_init((size_t)arena_kb << 10) < 0) {
+        return 1;
+    }
+    // -i takes precedence over the file's interfaces
+    if (config_path != NULL) {
+        if (config_load(config_path, &config) < 0 || check_topology(&config) < 0) {
+            return 1;
+        }
+        if (!ifaces_given && config.num_ifaces > 0) {
+            for (int i = 0; i < config.num_ifaces; i++) {
+                set_iface(i, config.ifaces[i].name, config.ifaces[i].bitrate,
+                          config.ifaces[i].dbitrate);
+            }
+            num_ifaces = config.num_ifaces;
+        }
+    }
+    for (int i = 0; i < config.num_decoders; i++) {
+        if (register_decoder(config.decoders[i]) < 0) {
+            return 1;
+        }
+    }
+#ifdef CAN_BRIDGE_TOPOLOGY
+    for (int i = 0; i < TOPOLOGY_NUM_DECODERS; i++) {
+        if (register_decoder_id(topology_decoders[i]) < 0) {
+            return 1;
+        }
+    }
+#else
+    if (config.num_decoders == 0 && register_decoders() < 0) {
+        return 1;
+    }
+#endif
+    if (replay_path != NULL && threaded) {
+        fprintf(stderr, "RX threads (-t) cannot be used with replay (-R)\n");
+        return 1;
+    }
     
-    if (sock_canfd1 < 0 || sock_canfd2 < 0 || sock_canfd3 < 0) {
-        fprintf(stderr, "Failed to initialize CAN interfaces\n");
+    for (int i = 0; i < num_route_specs; i++) {
+        if (parse_route(route_specs[i]) < 0) {
+            return 1;
+        }
+    }
+    // Before the sockets are opened: their filters let the loopback through
+    for (int i = 0; i < num_cyclic_specs; i++) {
+        if (parse_cyclic(cyclic_specs[i]) < 0) {
+            return 1;
+        }
+    }
+    default_ring = forwarding;
+    if (install_config(&config) < 0) {
         return 1;
     }
     
-    printf("All CAN interfaces initialized successfully\n");
-    printf("Monitoring CAN messages (no forwarding)...\n");
+    printf("CAN Bridge for RCU4 starting...\n");
+#ifdef CAN_BRIDGE_TOPOLOGY
+    printf("Fixed topology %s: %d interfaces, %d routes, %d decoders\n", CAN_BRIDGE_TOPOLOGY,
+           TOPOLOGY_NUM_IFACES, TOPOLOGY_NUM_ROUTES, TOPOLOGY_NUM_DECODERS);
+#endif
+    
+    // Setup signal handling for clean shutdown
+    signal_ev.fd = setup_signal_fd();
+    signal_ev.handler = on_signal_event;
+    signal_ev.ctx = NULL;
+    if (signal_ev.fd < 0 || event_loop_add(&loop, &signal_ev, EPOLLIN) < 0) {
+        return 1;
+    }
     
-    // Main loop - similar to Arduino loop()
-    while (running) {
-        // Prepare file descriptor set for select()
-        FD_ZERO(&read_fds);
-        FD_SET(sock_canfd1, &read_fds);
-        FD_SET(sock_canfd2, &read_fds);
-        FD_SET(sock_canfd3, &read_fds);
-        
-        // Find max file descriptor for select()
-        max_fd = sock_canfd1;
-        if (sock_canfd2 > max_fd) max_fd = sock_canfd2;
-        if (sock_canfd3 > max_fd) max_fd = sock_canfd3;
-        
-        // Set timeout for select (allows periodic checking of running flag)
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        
-        // Wait for activity on any socket
-        int ret = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
-        
-        if (ret < 0) {
-            if (errno == EINTR) {
-                continue;  // Interrupted by signal, check running flag
+    if (replay_path != NULL) {
+        // Offline replay: no links or sockets, routed frames are only counted
+        for (int i = 0; i < num_ifaces; i++) {
+            ifaces[i].fd = true;
+            if (forwarding) {
+                forward_set_sink(ifaces[i].index, ifaces[i].name);
             }
-            perror("select error");
-            break;
         }
-        
-        if (ret == 0) {
-            // Timeout - no activity
-            continue;
+    }
+    else {
+        if (open_interfaces(forwarding) < 0) {
+            return 1;
         }
-        
-        // Check which socket has data and print received messages
-        
-        if (FD_ISSET(sock_canfd1, &read_fds)) {
-            read_and_print_frame(sock_canfd1, "canfd1");
+        rx_batch_init(&rx_batch);
+        printf("All CAN interfaces initialized successfully\n");
+    }
+    
+    bool capture_fd = false;
+    for (int i = 0; i < num_ifaces; i++) {
+        iface_names[i] = ifaces[i].name;
+        capture_fd = capture_fd || ifaces[i].fd;
+    }
+    // Counters must be in place before the first frame is received
+    if (stats_open(stats_name, ifaces, num_ifaces, &loop) < 0) {
+        return 1;
+    }
+    if (stats_name != NULL) {
+        printf("Publishing statistics in /dev/shm%s\n", stats_name);
+    }
+    // Link and error frame state go into the stats segment
+    if (replay_path == NULL && can_recovery_init(&loop, ifaces, num_ifaces) < 0) {
+        return 1;
+    }
+    if (bus_name != NULL) {
+        if (shm_bus_open(bus_name, bus_frames, iface_names, num_ifaces) < 0) {
+            return 1;
         }
-        
-        if (FD_ISSET(sock_canfd2, &read_fds)) {
-            read_and_print_frame(sock_canfd2, "canfd2");
+        printf("Publishing frames in /dev/shm%s (%u records)\n", bus_name, bus_frames);
+    }
+    if (verbose) {
+        if (log_init(iface_names, num_ifaces, LOG_RING_SIZE) < 0 || log_start() < 0) {
+            return 1;
         }
-        
-        if (FD_ISSET(sock_canfd3, &read_fds)) {
-            read_and_print_frame(sock_canfd3, "canfd3");
+    }
+    if (capture_dir != NULL) {
+        if (capture_open(capture_dir, capture_files, capture_size, iface_names, num_ifaces,
+                         capture_fd) < 0) {
+            return 1;
+        }
+        printf("Capturing to %s (%d x %zu MiB)\n", capture_dir, capture_files, capture_size >> 20);
+    }
+    if (uplink_spec != NULL && open_uplink(uplink_spec) < 0) {
+        return 1;
+    }
+    if (forwarding) {
+        printf("Forwarding CAN messages (%d routes)...\n", forward_route_count());
+    }
+    else {
+        printf("Monitoring CAN messages (no forwarding)...\n");
+    }
+    
+    if (tx_sched_start(ifaces, num_ifaces, use_bcm, &loop) < 0) {
+        return 1;
+    }
+    if (tx_sched_count() > 0) {
+        printf(replay_path == NULL ? "Sending %d cyclic message(s)\n"
+                                   : "%d cyclic message(s) not sent during replay\n", tx_sched_count());
+    }
+    if (threaded && rx_threads_start(ifaces, num_ifaces, rx_cfg, &loop) < 0) {
+        return 1;
+    }
+    if (health_init(&loop) < 0) {
+        return 1;
+    }
+    if (replay_path != NULL) {
+        if (replay_open(replay_path, replay_speed, ifaces, num_ifaces, &loop) < 0) {
+            return 1;
+        }
+        printf("Replaying %s...\n", replay_path);
+    }
+    
+    // Everything is allocated now: lock it and show what it costs
+    if (arena_fixed()) {
+        if (arena_lock() < 0) {
+            return 1;
+        }
+        arena_report(stdout);
+    }
+    
+    // Main loop - runs until SIGINT/SIGTERM (or the end of a replay)
+    health_ready();
+    event_loop_run(&loop);
+    health_close();
+    
+    tx_sched_stop();
+    if (threaded) {
+        rx_threads_stop();
+    }
+    if (replay_path != NULL) {
+        const struct replay_stats* rs = replay_stats();
+        double secs = rs->elapsed_ns / 1e9;
+        printf("Replayed %llu frames (%llu from unknown interfaces skipped) covering %.3f s in %.3f s",
+               (unsigned long long)rs->frames, (unsigned long long)rs->skipped,
+               rs->log_span_ns / 1e9, secs);
+        if (secs > 0) {
+            printf(", %.0f frames/s", rs->frames / secs);
         }
+        printf("\n");
+        replay_close();
     }
     
     // Cleanup
+    if (verbose) {
+        log_stop();
+    }
+    capture_close();
+    uplink_close();
+    can_recovery_close();
+    can_nl_close();
     printf("\nShutting down...\n");
-    close(sock_canfd1);
-    close(sock_canfd2);
-    close(sock_canfd3);
+    for (int i = 0; i < num_ifaces; i++) {
+        if (ifaces[i].sock >= 0) {
+            close(ifaces[i].sock);
+        }
+    }
+    for (int i = 0; i < num_ifaces; i++) {
+        const struct fwd_dest_stats* st = forward_dest_stats(i);
+        if (forwarding && st != NULL) {
+            printf("  %s: forwarded %llu, dropped %llu, errors %llu\n", ifaces[i].name,
+                   (unsigned long long)st->tx_frames, (unsigned long long)st->dropped,
+                   (unsigned long long)st->tx_errors);
+            // Queues that built up: the destination bus could not keep up
+            bool backlog = st->dropped > 0;
+            for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+                backlog = backlog || st->depth_max[level] > FWD_TX_BATCH;
+            }
+            if (backlog) {
+                printf("  %s: TX queue high-water by priority level", ifaces[i].name);
+                for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+                    printf(" %u", st->depth_max[level]);
+                }
+                printf(", drops");
+                for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+                    printf(" %llu", (unsigned long long)st->level_dropped[level]);
+                }
+                printf("\n");
+            }
+            if (st->rate_limited + st->unchanged > 0) {
+                printf("  %s: %llu frames over a route rate, %llu unchanged repeats not forwarded\n",
+                       ifaces[i].name, (unsigned long long)st->rate_limited,
+                       (unsigned long long)st->unchanged);
+            }
+            if (st->stale > 0) {
+                printf("  %s: %llu frames discarded after waiting for the link\n", ifaces[i].name,
+                       (unsigned long long)st->stale);
+            }
+            if (st->rule_drops > 0) {
+                printf("  %s: %llu frames dropped by rewrite rules\n", ifaces[i].name,
+                       (unsigned long long)st->rule_drops);
+            }
+        }
+        const struct j1939_tp_stats* tp = j1939_tp_stats(i);
+        if (tp->completed + tp->aborted + tp->timeouts + tp->no_buffer > 0) {
+            printf("  %s: J1939 TP reassembled %llu, aborted %llu, timed out %llu, no buffer %llu\n",
+                   ifaces[i].name, (unsigned long long)tp->completed, (unsigned long long)tp->aborted,
+                   (unsigned long long)tp->timeouts, (unsigned long long)tp->no_buffer);
+        }
+        if (threaded && rx_thread_queue_drops(i) > 0) {
+            printf("  %s: %llu frames dropped between RX thread and forwarder\n", ifaces[i].name,
+                   (unsigned long long)rx_thread_queue_drops(i));
+        }
+    }
+    if (uplink_spec != NULL) {
+        const struct uplink_stats* us = uplink_stats();
+        printf("  uplink: %llu frames in %llu packets, %llu bytes (%.1f per frame, %llu before "
+               "compression), sampled %llu, dropped %llu, errors %llu\n",
+               (unsigned long long)us->frames, (unsigned long long)us->packets,
+               (unsigned long long)us->bytes, us->frames > 0 ? (double)us->bytes / us->frames : 0.0,
+               (unsigned long long)us->raw_bytes, (unsigned long long)us->sampled,
+               (unsigned long long)us->dropped, (unsigned long long)us->send_errors);
+    }
+    stats_publish();
+    stats_dump(stdout);
+    stats_close();
+    shm_bus_close();
+    latency_dump(stdout, iface_names, num_ifaces);
+    if (arena_fixed()) {
+        arena_report(stdout);
+    }
+    close(signal_ev.fd);
+    forward_close();
+    event_loop_close(&loop);
     printf("CAN Bridge stopped\n");
     
     return 0;
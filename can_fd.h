@@ -0,0 +1,32 @@
+/*
+ * Classic CAN and CAN-FD frames in one representation
+ *
+ * Every frame in the bridge is held in a struct canfd_frame. The kernel
+ * fills only the first CAN_MTU bytes of it for a classic frame (the two
+ * layouts match, can_dlc is len), so one receive buffer serves both frame
+ * types without copying. FD frames carry CANFD_FDF in flags, which is set
+ * by can_rx for kernels that do not provide it themselves.
+ */
+
+#ifndef CAN_FD_H
+#define CAN_FD_H
+
+#include <stddef.h>
+#include <linux/can.h>
+
+static inline bool can_frame_is_fd(const struct canfd_frame* frame) {
+    return (frame->flags & CANFD_FDF) != 0;
+}
+
+// Bytes to write to a socket for this frame
+static inline size_t can_frame_mtu(const struct canfd_frame* frame) {
+    return can_frame_is_fd(frame) ? CANFD_MTU : CAN_MTU;
+}
+
+// Payload length, bounded by the frame type's maximum
+static inline unsigned int can_frame_len(const struct canfd_frame* frame) {
+    unsigned int max = can_frame_is_fd(frame) ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+    return frame->len < max ? frame->len : max;
+}
+
+#endif // CAN_FD_H
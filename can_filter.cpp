@@ -0,0 +1,153 @@
+/*
+ * Kernel-side CAN_RAW_FILTER generation
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+
+#include "can_filter.h"
+#include "dispatch.h"
+#include "forward.h"
+#include "j1939_tp.h"
+#include "tx_sched.h"
+
+static struct can_filter_rule rules[CAN_FILTER_MAX_RULES];
+static int num_rules = 0;
+
+struct filter_list {
+    struct can_filter* items;
+    int count;
+    int max;
+    bool accept_all;        // A filter matched everything
+};
+
+static void add_filter(struct filter_list* list, canid_t id, canid_t mask) {
+    if (mask == 0) {
+        list->accept_all = true;
+        return;
+    }
+
+    for (int i = 0; i < list->count; i++) {
+        if (list->items[i].can_id == (id & mask) && list->items[i].can_mask == mask) {
+            return;
+        }
+    }
+
+    if (list->count >= list->max) {
+        // Too many filters for the kernel: fall back to receiving everything
+        list->accept_all = true;
+        return;
+    }
+    list->items[list->count].can_id = id & mask;
+    list->items[list->count].can_mask = mask;
+    list->count++;
+}
+
+// Decoder registration -> filter on the PGN bits (and SA/DA unless wildcard)
+static void add_decoder_filter(uint32_t pgn, uint8_t sa, uint8_t da, void* ctx) {
+    struct filter_list* list = (struct filter_list*)ctx;
+    canid_t id = CAN_EFF_FLAG | (pgn << 8) | sa;
+    canid_t mask = CAN_EFF_FLAG | CAN_RTR_FLAG;
+
+    // PDU1 PGNs carry the destination address in the PS byte
+    if (((pgn >> 8) & 0xFF) < 240) {
+        mask |= 0x03FF0000;
+        if (da != J1939_ANY_ADDR) {
+            id |= da << 8;
+            mask |= 0xFF00;
+        }
+    }
+    else {
+        mask |= 0x03FFFF00;
+    }
+    if (sa != J1939_ANY_ADDR) {
+        mask |= 0xFF;
+    }
+
+    add_filter(list, id, mask);
+}
+
+int can_filter_set_rules(const struct can_filter_rule* new_rules, int count) {
+    if (count > CAN_FILTER_MAX_RULES) {
+        fprintf(stderr, "Too many filter rules (max %d)\n", CAN_FILTER_MAX_RULES);
+        return -1;
+    }
+    memcpy(rules, new_rules, count * sizeof(rules[0]));
+    num_rules = count;
+    return 0;
+}
+
+int can_filter_build(int iface, struct can_filter* out, int max) {
+    struct filter_list list = { out, 0, max, false };
+    int num_routes;
+    const struct fwd_route* routes = forward_routes(&num_routes);
+
+    for (int i = 0; i < num_routes; i++) {
+        if (routes[i].src == iface) {
+            add_filter(&list, routes[i].id, routes[i].mask);
+        }
+    }
+
+    for (int i = 0; i < num_rules; i++) {
+        if (rules[i].iface == iface) {
+            add_filter(&list, rules[i].id, rules[i].mask);
+        }
+    }
+
+    dispatch_foreach(add_decoder_filter, &list);
+
+    // Multi-packet messages for the decoders arrive as transport frames
+    if (dispatch_count() > 0) {
+        add_decoder_filter(J1939_TP_CM_PGN, J1939_ANY_ADDR, J1939_ANY_ADDR, &list);
+        add_decoder_filter(J1939_TP_DT_PGN, J1939_ANY_ADDR, J1939_ANY_ADDR, &list);
+        add_decoder_filter(J1939_ETP_CM_PGN, J1939_ANY_ADDR, J1939_ANY_ADDR, &list);
+        add_decoder_filter(J1939_ETP_DT_PGN, J1939_ANY_ADDR, J1939_ANY_ADDR, &list);
+    }
+
+    // Cyclic messages come back as loopback frames: the TX jitter measurement
+    for (int i = 0; i < tx_sched_count(); i++) {
+        const struct tx_sched_msg* msg = tx_sched_msg(i);
+        if (msg->iface == iface) {
+            add_filter(&list, msg->frame.can_id, CAN_EFF_FLAG | CAN_RTR_FLAG |
+                       (msg->frame.can_id & CAN_EFF_FLAG ? CAN_EFF_MASK : CAN_SFF_MASK));
+        }
+    }
+
+    if (list.accept_all) {
+        out[0].can_id = 0;
+        out[0].can_mask = 0;
+        return 1;
+    }
+    return list.count;
+}
+
+int can_filter_apply(int sock, int iface, bool accept_all, can_err_mask_t err_mask) {
+    static struct can_filter filters[CAN_FILTER_MAX];
+    int count;
+
+    if (accept_all) {
+        filters[0].can_id = 0;
+        filters[0].can_mask = 0;
+        count = 1;
+    }
+    else {
+        count = can_filter_build(iface, filters, CAN_FILTER_MAX);
+    }
+
+    // An empty list is valid: the socket then receives no data frames
+    if (setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, count > 0 ? filters : NULL,
+                   count * sizeof(struct can_filter)) < 0) {
+        perror("Error setting CAN_RAW_FILTER");
+        return -1;
+    }
+
+    if (setsockopt(sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask)) < 0) {
+        perror("Error setting CAN_RAW_ERR_FILTER");
+        return -1;
+    }
+
+    return count;
+}
@@ -0,0 +1,46 @@
+/*
+ * Kernel-side CAN_RAW_FILTER generation
+ *
+ * Builds per-interface acceptance filters from the registered decoders and
+ * the routing table so the kernel only copies frames the bridge actually
+ * uses. Filters can be rebuilt and reinstalled at any time.
+ */
+
+#ifndef CAN_FILTER_H
+#define CAN_FILTER_H
+
+#include <linux/can.h>
+#include <linux/can/error.h>
+
+// Kernel limit for CAN_RAW_FILTER (CAN_RAW_FILTER_MAX)
+#define CAN_FILTER_MAX 512
+
+// Error classes received when error frames are enabled
+#define CAN_FILTER_ERR_MASK (CAN_ERR_TX_TIMEOUT | CAN_ERR_CRTL | CAN_ERR_PROT | \
+                             CAN_ERR_TRX | CAN_ERR_ACK | CAN_ERR_BUSOFF | \
+                             CAN_ERR_BUSERROR | CAN_ERR_RESTARTED)
+
+// Additional frames to receive on an interface (from the configuration
+// file), e.g. for capture or the uplink
+#define CAN_FILTER_MAX_RULES 64
+
+struct can_filter_rule {
+    int iface;
+    canid_t id;
+    canid_t mask;
+};
+
+// Replace the additional rules; they take effect with the next
+// can_filter_apply(). Returns 0, or -1 if there are too many.
+int can_filter_set_rules(const struct can_filter_rule* rules, int count);
+
+// Build the filter list for frames received on interface iface.
+// Returns the number of filters written to out.
+int can_filter_build(int iface, struct can_filter* out, int max);
+
+// Build and install filters on a socket. When accept_all is set the socket
+// receives every data frame. err_mask selects error frames (0 for none).
+// Returns the number of filters installed, -1 on error.
+int can_filter_apply(int sock, int iface, bool accept_all, can_err_mask_t err_mask);
+
+#endif // CAN_FILTER_H
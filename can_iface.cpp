@@ -0,0 +1,146 @@
+/*
+ * CAN interface table and socket setup
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+
+#include "can_iface.h"
+#include "can_netlink.h"
+
+// Restart and configure a CAN interface over rtnetlink. Interfaces that are
+// already up at the requested bitrates and restart delay are left alone.
+int restart_can_interface(const char* interface_name, int bitrate, int dbitrate, uint32_t restart_ms) {
+    struct can_link_info info;
+    
+    printf("Configuring %s...\n", interface_name);
+    
+    if (can_nl_get_link(interface_name, &info) < 0) {
+        fprintf(stderr, "Error: Interface %s not found\n", interface_name);
+        return -1;
+    }
+    
+    // vcan and other non-controller links have no restart delay
+    bool set_restart = info.restart_ms != CAN_NL_NO_RESTART_MS && info.restart_ms != restart_ms;
+    if (info.up && info.running && (bitrate <= 0 || info.bitrate == (uint32_t)bitrate) &&
+        (dbitrate <= 0 || (info.fd && info.dbitrate == (uint32_t)dbitrate)) && !set_restart) {
+        printf("  %s already up%s\n", interface_name, bitrate > 0 ? " at the requested bitrate" : "");
+        return 0;
+    }
+    
+    // Bring interface down (bitrate can only change while stopped)
+    if (info.up && can_nl_set_up(info.ifindex, false) < 0) {
+        fprintf(stderr, "Warning: Failed to bring down %s: %s\n", interface_name, strerror(errno));
+    }
+    
+    // Configure bitrate (0 keeps the current setting, e.g. for vcan)
+    if (bitrate > 0 && can_nl_set_bitrate(info.ifindex, bitrate, dbitrate) < 0) {
+        fprintf(stderr, "Warning: Failed to configure %s bitrate: %s\n", interface_name, strerror(errno));
+    }
+    
+    // Let the kernel restart the controller after bus-off
+    if (set_restart && can_nl_set_restart_ms(info.ifindex, restart_ms) < 0) {
+        fprintf(stderr, "Warning: Failed to set %s restart-ms: %s\n", interface_name, strerror(errno));
+    }
+    
+    // Bring interface up and wait for the kernel to report it running
+    if (can_nl_set_up(info.ifindex, true) < 0) {
+        fprintf(stderr, "Error: Failed to bring up %s: %s\n", interface_name, strerror(errno));
+        return -1;
+    }
+    if (can_nl_wait_up(info.ifindex, CAN_NL_LINK_UP_TIMEOUT_MS) < 0) {
+        fprintf(stderr, "Warning: %s did not report link up within %d ms\n",
+                interface_name, CAN_NL_LINK_UP_TIMEOUT_MS);
+    }
+    
+    if (bitrate > 0 && dbitrate > 0) {
+        printf("  %s configured at %d/%d bps (CAN-FD)\n", interface_name, bitrate, dbitrate);
+    }
+    else if (bitrate > 0) {
+        printf("  %s configured at %d bps\n", interface_name, bitrate);
+    }
+    else {
+        printf("  %s up\n", interface_name);
+    }
+    return 0;
+}
+
+// Request kernel software RX timestamps on a socket. Hardware stamps are
+// not used: they are in the controller's clock, not CLOCK_REALTIME, and
+// turning them on (SIOCSHWTSTAMP) changes the device for every other user.
+// Returns 0 on success, -1 if timestamping could not be enabled.
+static int enable_timestamping(int sock) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        perror("Warning: Failed to enable SO_TIMESTAMPING");
+        return -1;
+    }
+    return 0;
+}
+
+// Create and bind a CAN socket to the specified interface
+int setup_can_socket(const char* interface_name, bool* fd) {
+    int sock;
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+    
+    // Create socket
+    sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (sock < 0) {
+        perror("Error creating socket");
+        return -1;
+    }
+    
+    // Get interface index
+    strcpy(ifr.ifr_name, interface_name);
+    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
+        perror("Error getting interface index");
+        close(sock);
+        return -1;
+    }
+    
+    // Bind socket to CAN interface
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("Error binding socket");
+        close(sock);
+        return -1;
+    }
+    
+    // CAN-FD frames on FD capable interfaces (MTU of a canfd_frame)
+    *fd = false;
+    if (ioctl(sock, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu == CANFD_MTU) {
+        int enable = 1;
+        if (setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) == 0) {
+            *fd = true;
+        }
+        else {
+            perror("Warning: Failed to enable CAN-FD frames");
+        }
+    }
+    
+    // Socket receive queue overflows are reported with every later frame
+    int enable_ovfl = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &enable_ovfl, sizeof(enable_ovfl)) < 0) {
+        perror("Warning: Failed to enable SO_RXQ_OVFL");
+    }
+    
+    int ts = enable_timestamping(sock);
+    
+    printf("Initialized CAN interface: %s (%s, %s RX timestamps)\n", interface_name,
+           *fd ? "CAN-FD" : "classic CAN", ts == 0 ? "software" : "no");
+    return sock;
+}
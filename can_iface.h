@@ -0,0 +1,35 @@
+/*
+ * CAN interface table and socket setup
+ */
+
+#ifndef CAN_IFACE_H
+#define CAN_IFACE_H
+
+#include <stdint.h>
+
+#include "event_loop.h"
+
+// Upper bound on the number of interfaces handled by one bridge process
+#define MAX_CAN_IFACES 8
+
+// Descriptor for one CAN interface handled by the bridge
+struct can_iface {
+    const char* name;
+    int bitrate;
+    int dbitrate;               // CAN-FD data phase bitrate, 0 for classic CAN
+    int index;                  // Position in the interface table
+    int sock;                   // Raw CAN socket, -1 when not open
+    struct event_source ev;     // epoll registration (ctx points back here)
+    bool fd;                    // Socket sends and receives CAN-FD frames
+};
+
+// Restart and configure a CAN interface. A dbitrate > 0 enables CAN-FD
+// with that data phase bitrate. CAN controllers get restart_ms as their
+// automatic bus-off restart delay.
+int restart_can_interface(const char* interface_name, int bitrate, int dbitrate, uint32_t restart_ms);
+
+// Create and bind a CAN socket to the specified interface. CAN-FD frames are
+// enabled when the interface supports them; *fd reports the result.
+int setup_can_socket(const char* interface_name, bool* fd);
+
+#endif // CAN_IFACE_H
@@ -0,0 +1,335 @@
+/*
+ * rtnetlink access to CAN link configuration
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/can/netlink.h>
+
+#include "can_netlink.h"
+#include "clock_util.h"
+
+#define NL_BUF_SIZE 8192
+
+// Request with room for nested link attributes
+struct nl_request {
+    struct nlmsghdr nlh;
+    struct ifinfomsg ifi;
+    char attrs[256];
+};
+
+static int rq_sock = -1;    // Requests and their replies
+static int mon_sock = -1;   // RTMGRP_LINK notifications
+static uint32_t seq = 0;
+
+static int open_socket(uint32_t groups) {
+    struct sockaddr_nl addr;
+
+    int sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (sock < 0) {
+        perror("Error creating netlink socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = groups;
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Error binding netlink socket");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int can_nl_open(void) {
+    rq_sock = open_socket(0);
+    mon_sock = open_socket(RTMGRP_LINK);
+    if (rq_sock < 0 || mon_sock < 0) {
+        can_nl_close();
+        return -1;
+    }
+    return 0;
+}
+
+void can_nl_close(void) {
+    if (rq_sock >= 0) {
+        close(rq_sock);
+        rq_sock = -1;
+    }
+    if (mon_sock >= 0) {
+        close(mon_sock);
+        mon_sock = -1;
+    }
+}
+
+static void init_request(struct nl_request* req, uint16_t type, uint16_t flags, int ifindex) {
+    memset(req, 0, sizeof(*req));
+    req->nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req->nlh.nlmsg_type = type;
+    req->nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+    req->nlh.nlmsg_seq = ++seq;
+    req->ifi.ifi_family = AF_UNSPEC;
+    req->ifi.ifi_index = ifindex;
+}
+
+static struct rtattr* add_attr(struct nl_request* req, int type, const void* data, size_t len) {
+    size_t offset = NLMSG_ALIGN(req->nlh.nlmsg_len);
+    struct rtattr* rta = (struct rtattr*)((char*)req + offset);
+
+    if (offset + RTA_LENGTH(len) > sizeof(*req)) {
+        return NULL;
+    }
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    if (len > 0) {
+        memcpy(RTA_DATA(rta), data, len);
+    }
+    req->nlh.nlmsg_len = offset + RTA_ALIGN(rta->rta_len);
+    return rta;
+}
+
+// Close a nested attribute opened with add_attr(req, type, NULL, 0)
+static void end_nest(struct nl_request* req, struct rtattr* nest) {
+    nest->rta_len = (char*)&req->nlh + req->nlh.nlmsg_len - (char*)nest;
+}
+
+// Parse RTM_NEWLINK into info
+static void parse_link(struct nlmsghdr* nlh, struct can_link_info* info) {
+    struct ifinfomsg* ifi = (struct ifinfomsg*)NLMSG_DATA(nlh);
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+    info->ifindex = ifi->ifi_index;
+    info->up = (ifi->ifi_flags & IFF_UP) != 0;
+    info->running = (ifi->ifi_flags & IFF_RUNNING) != 0;
+    info->bitrate = 0;
+    info->dbitrate = 0;
+    info->fd = false;
+    info->state = CAN_STATE_MAX;
+    info->restart_ms = CAN_NL_NO_RESTART_MS;
+
+    for (struct rtattr* rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type != IFLA_LINKINFO) {
+            continue;
+        }
+        int li_len = RTA_PAYLOAD(rta);
+        for (struct rtattr* li = (struct rtattr*)RTA_DATA(rta); RTA_OK(li, li_len); li = RTA_NEXT(li, li_len)) {
+            if (li->rta_type != IFLA_INFO_DATA) {
+                continue;
+            }
+            int d_len = RTA_PAYLOAD(li);
+            for (struct rtattr* d = (struct rtattr*)RTA_DATA(li); RTA_OK(d, d_len); d = RTA_NEXT(d, d_len)) {
+                if (d->rta_type == IFLA_CAN_BITTIMING && RTA_PAYLOAD(d) >= sizeof(struct can_bittiming)) {
+                    info->bitrate = ((struct can_bittiming*)RTA_DATA(d))->bitrate;
+                }
+                else if (d->rta_type == IFLA_CAN_DATA_BITTIMING &&
+                         RTA_PAYLOAD(d) >= sizeof(struct can_bittiming)) {
+                    info->dbitrate = ((struct can_bittiming*)RTA_DATA(d))->bitrate;
+                }
+                else if (d->rta_type == IFLA_CAN_CTRLMODE && RTA_PAYLOAD(d) >= sizeof(struct can_ctrlmode)) {
+                    info->fd = (((struct can_ctrlmode*)RTA_DATA(d))->flags & CAN_CTRLMODE_FD) != 0;
+                }
+                else if (d->rta_type == IFLA_CAN_STATE && RTA_PAYLOAD(d) >= sizeof(uint32_t)) {
+                    info->state = *(uint32_t*)RTA_DATA(d);
+                }
+                else if (d->rta_type == IFLA_CAN_RESTART_MS && RTA_PAYLOAD(d) >= sizeof(uint32_t)) {
+                    info->restart_ms = *(uint32_t*)RTA_DATA(d);
+                }
+            }
+        }
+    }
+}
+
+// Send a request and process replies until the ACK/DONE for it arrives.
+// RTM_NEWLINK replies are parsed into info when it is not NULL.
+static int transact(struct nl_request* req, struct can_link_info* info) {
+    static char buf[NL_BUF_SIZE];
+
+    if (send(rq_sock, req, req->nlh.nlmsg_len, 0) < 0) {
+        perror("Error sending netlink request");
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t n = recv(rq_sock, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error reading netlink reply");
+            return -1;
+        }
+
+        int len = n;
+        for (struct nlmsghdr* nlh = (struct nlmsghdr*)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_seq != req->nlh.nlmsg_seq) {
+                continue;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr* err = (struct nlmsgerr*)NLMSG_DATA(nlh);
+                if (err->error != 0) {
+                    errno = -err->error;
+                    return -1;
+                }
+                return 0;
+            }
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                return 0;
+            }
+            if (nlh->nlmsg_type == RTM_NEWLINK && info != NULL) {
+                parse_link(nlh, info);
+                // A non-dump GETLINK reply is a single message without ACK
+                if (!(nlh->nlmsg_flags & NLM_F_MULTI)) {
+                    return 0;
+                }
+            }
+        }
+    }
+}
+
+static int get_link_by_index(int ifindex, struct can_link_info* info) {
+    struct nl_request req;
+
+    init_request(&req, RTM_GETLINK, 0, ifindex);
+    return transact(&req, info);
+}
+
+int can_nl_get_link(const char* ifname, struct can_link_info* info) {
+    int ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) {
+        return -1;
+    }
+    return get_link_by_index(ifindex, info);
+}
+
+int can_nl_set_bitrate(int ifindex, uint32_t bitrate, uint32_t dbitrate) {
+    struct nl_request req;
+    struct can_bittiming bt;
+    struct can_bittiming dbt;
+    struct can_ctrlmode cm;
+
+    init_request(&req, RTM_NEWLINK, NLM_F_ACK, ifindex);
+
+    // Only the bitrate is given; the kernel calculates the bit timing
+    memset(&bt, 0, sizeof(bt));
+    bt.bitrate = bitrate;
+    memset(&dbt, 0, sizeof(dbt));
+    dbt.bitrate = dbitrate;
+    cm.mask = CAN_CTRLMODE_FD;
+    cm.flags = dbitrate > 0 ? CAN_CTRLMODE_FD : 0;
+
+    struct rtattr* linkinfo = add_attr(&req, IFLA_LINKINFO, NULL, 0);
+    add_attr(&req, IFLA_INFO_KIND, "can", strlen("can"));
+    struct rtattr* data = add_attr(&req, IFLA_INFO_DATA, NULL, 0);
+    add_attr(&req, IFLA_CAN_BITTIMING, &bt, sizeof(bt));
+    if (dbitrate > 0) {
+        add_attr(&req, IFLA_CAN_DATA_BITTIMING, &dbt, sizeof(dbt));
+    }
+    add_attr(&req, IFLA_CAN_CTRLMODE, &cm, sizeof(cm));
+    end_nest(&req, data);
+    end_nest(&req, linkinfo);
+
+    return transact(&req, NULL);
+}
+
+// Set one u32 attribute of the CAN link data
+static int set_can_u32(int ifindex, int type, uint32_t value) {
+    struct nl_request req;
+
+    init_request(&req, RTM_NEWLINK, NLM_F_ACK, ifindex);
+    struct rtattr* linkinfo = add_attr(&req, IFLA_LINKINFO, NULL, 0);
+    add_attr(&req, IFLA_INFO_KIND, "can", strlen("can"));
+    struct rtattr* data = add_attr(&req, IFLA_INFO_DATA, NULL, 0);
+    add_attr(&req, type, &value, sizeof(value));
+    end_nest(&req, data);
+    end_nest(&req, linkinfo);
+
+    return transact(&req, NULL);
+}
+
+int can_nl_set_restart_ms(int ifindex, uint32_t restart_ms) {
+    return set_can_u32(ifindex, IFLA_CAN_RESTART_MS, restart_ms);
+}
+
+int can_nl_restart(int ifindex) {
+    return set_can_u32(ifindex, IFLA_CAN_RESTART, 1);
+}
+
+int can_nl_set_up(int ifindex, bool up) {
+    struct nl_request req;
+
+    init_request(&req, RTM_NEWLINK, NLM_F_ACK, ifindex);
+    req.ifi.ifi_change = IFF_UP;
+    req.ifi.ifi_flags = up ? IFF_UP : 0;
+    return transact(&req, NULL);
+}
+
+int can_nl_wait_up(int ifindex, int timeout_ms) {
+    static char buf[NL_BUF_SIZE];
+    uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ull;
+    struct can_link_info info;
+
+    for (;;) {
+        // Check the current state; notifications only tell us when to look again
+        if (get_link_by_index(ifindex, &info) == 0 && info.up && info.running) {
+            return 0;
+        }
+
+        uint64_t now = monotonic_ns();
+        if (now >= deadline) {
+            return -1;
+        }
+
+        struct pollfd pfd = { mon_sock, POLLIN, 0 };
+        int remaining = (int)((deadline - now + 999999) / 1000000);
+        int ret = poll(&pfd, 1, remaining);
+        if (ret < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ret > 0) {
+            // Drain queued notifications (ENOBUFS just means some were lost)
+            while (recv(mon_sock, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+            }
+        }
+    }
+}
+
+int can_nl_monitor_fd(void) {
+    return mon_sock;
+}
+
+int can_nl_read_events(can_nl_link_fn fn, void* ctx) {
+    static char buf[NL_BUF_SIZE];
+    struct can_link_info info;
+
+    for (;;) {
+        ssize_t n = recv(mon_sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == ENOBUFS ? 1 : 0;
+        }
+
+        int len = n;
+        for (struct nlmsghdr* nlh = (struct nlmsghdr*)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK) {
+                parse_link(nlh, &info);
+                if (nlh->nlmsg_type == RTM_DELLINK) {
+                    info.up = false;
+                    info.running = false;
+                }
+                fn(&info, ctx);
+            }
+        }
+    }
+}
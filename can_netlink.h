@@ -0,0 +1,72 @@
+/*
+ * rtnetlink access to CAN link configuration
+ *
+ * Reads and sets link state and bitrate directly over NETLINK_ROUTE instead
+ * of forking "ip link", and waits for the kernel's link-up notification
+ * instead of sleeping for a fixed time.
+ */
+
+#ifndef CAN_NETLINK_H
+#define CAN_NETLINK_H
+
+#include <stdint.h>
+
+// Time to wait for a link to report up after it was started
+#define CAN_NL_LINK_UP_TIMEOUT_MS 1000
+
+// Current state of a CAN link
+struct can_link_info {
+    int ifindex;
+    bool up;                // IFF_UP
+    bool running;           // IFF_RUNNING (controller started, carrier on)
+    uint32_t bitrate;       // 0 if unknown (e.g. vcan)
+    uint32_t dbitrate;      // CAN-FD data bitrate, 0 if unknown
+    bool fd;                // CAN_CTRLMODE_FD enabled
+    uint32_t state;         // enum can_state, CAN_STATE_MAX if unknown
+    uint32_t restart_ms;    // Automatic bus-off restart delay (0 = off),
+                            // CAN_NL_NO_RESTART_MS if not a CAN controller
+};
+
+#define CAN_NL_NO_RESTART_MS 0xFFFFFFFFu
+
+// Called for each link notification read by can_nl_read_events()
+typedef void (*can_nl_link_fn)(const struct can_link_info* info, void* ctx);
+
+// Open the request and link-notification sockets. Returns 0 or -1.
+int can_nl_open(void);
+
+void can_nl_close(void);
+
+// Query a link's state. Returns 0 on success, -1 on error.
+int can_nl_get_link(const char* ifname, struct can_link_info* info);
+
+// Set the bitrate (link must be down). A dbitrate > 0 also sets the data
+// bitrate and enables CAN-FD, 0 selects classic CAN. Returns 0 on success,
+// -1 on error.
+int can_nl_set_bitrate(int ifindex, uint32_t bitrate, uint32_t dbitrate);
+
+// Set the administrative link state. Returns 0 on success, -1 on error.
+int can_nl_set_up(int ifindex, bool up);
+
+// Set the automatic bus-off restart delay (link must be down; 0 disables
+// automatic restarts). Returns 0 on success, -1 on error.
+int can_nl_set_restart_ms(int ifindex, uint32_t restart_ms);
+
+// Restart a controller that is bus-off now. Only allowed by the kernel when
+// automatic restarts are off. Returns 0 on success, -1 on error.
+int can_nl_restart(int ifindex);
+
+// Link notification socket, for registering with an event loop after
+// startup (can_nl_wait_up() must not be used from then on)
+int can_nl_monitor_fd(void);
+
+// Read the queued link notifications without blocking and pass each link
+// to fn. Returns 1 if notifications were lost (socket overrun; query the
+// links again), 0 otherwise.
+int can_nl_read_events(can_nl_link_fn fn, void* ctx);
+
+// Block until the link reports IFF_UP and IFF_RUNNING or the timeout expires.
+// Returns 0 when the link is up, -1 on timeout or error.
+int can_nl_wait_up(int ifindex, int timeout_ms);
+
+#endif // CAN_NETLINK_H
@@ -0,0 +1,236 @@
+/*
+ * Per-interface bus-off recovery
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "can_recovery.h"
+#include "can_netlink.h"
+#include "clock_util.h"
+#include "forward.h"
+#include "stats.h"
+
+struct bus_link {
+    const char* name;
+    int ifindex;
+    bool up;                // IFF_UP and IFF_RUNNING: frames can be sent
+    bool admin_up;          // IFF_UP
+    uint32_t state;
+    uint32_t restart_ms;
+    uint64_t down_since;    // CLOCK_MONOTONIC ns of the outage start
+    uint64_t restart_at;    // Manual restart due (CLOCK_MONOTONIC ns), 0 if none
+};
+
+static struct bus_link links[MAX_CAN_IFACES];
+static int num_links = 0;
+
+static struct event_source nl_ev;
+static struct event_source timer_ev;
+
+static void arm_timer(void) {
+    struct itimerspec its;
+    uint64_t next = 0;
+
+    for (int i = 0; i < num_links; i++) {
+        if (links[i].restart_at != 0 && (next == 0 || links[i].restart_at < next)) {
+            next = links[i].restart_at;
+        }
+    }
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / 1000000000ull;
+    its.it_value.tv_nsec = next % 1000000000ull;
+    if (timerfd_settime(timer_ev.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("Error arming bus recovery timer");
+    }
+}
+
+// The kernel only restarts controllers that have a restart delay
+static void schedule_restart(struct bus_link* link) {
+    if (link->up || !link->admin_up || link->state != CAN_STATE_BUS_OFF || link->restart_ms != 0 ||
+        link->restart_at != 0) {
+        return;
+    }
+    link->restart_at = monotonic_ns() + CAN_RECOVERY_RESTART_MS * 1000000ull;
+    arm_timer();
+}
+
+static void update_link(int i, const struct can_link_info* info) {
+    struct bus_link* link = &links[i];
+    bool up = info->up && info->running;
+
+    link->admin_up = info->up;
+    link->state = info->state;
+    link->restart_ms = info->restart_ms;
+    __atomic_store_n(&stats->ifaces[i].can_state, info->state, __ATOMIC_RELAXED);
+
+    // Even without a transition here: sendmmsg() may have seen ENETDOWN
+    // and paused the destination while this link state stayed up
+    forward_set_link(i, up);
+    if (up != link->up) {
+        uint64_t now = monotonic_ns();
+
+        link->up = up;
+        if (!up) {
+            link->down_since = now;
+            printf("%s: %s, holding frames routed to it\n", link->name,
+                   info->state == CAN_STATE_BUS_OFF ? "bus-off" : info->up ? "no carrier" : "link down");
+        }
+        else {
+            uint64_t outage_ms = (now - link->down_since) / 1000000;
+            stats_add(&stats->ifaces[i].outage_ms, outage_ms);
+            link->restart_at = 0;
+            printf("%s: running again after %llu ms (%s)\n", link->name, (unsigned long long)outage_ms,
+                   can_state_name(info->state));
+        }
+    }
+    schedule_restart(link);
+}
+
+static void on_link(const struct can_link_info* info, void* ctx) {
+    (void)ctx;
+
+    for (int i = 0; i < num_links; i++) {
+        if (links[i].ifindex == info->ifindex) {
+            update_link(i, info);
+            return;
+        }
+    }
+}
+
+// Query a link directly (notifications lost, or a socket error)
+static void refresh_link(int i) {
+    struct can_link_info info;
+
+    if (can_nl_get_link(links[i].name, &info) == 0) {
+        update_link(i, &info);
+    }
+    else if (links[i].up) {
+        // Interface removed
+        memset(&info, 0, sizeof(info));
+        info.ifindex = links[i].ifindex;
+        info.state = CAN_STATE_MAX;
+        info.restart_ms = CAN_NL_NO_RESTART_MS;
+        update_link(i, &info);
+    }
+}
+
+static void on_netlink_event(struct event_source* src, uint32_t events) {
+    (void)src;
+    (void)events;
+
+    if (can_nl_read_events(on_link, NULL) > 0) {
+        for (int i = 0; i < num_links; i++) {
+            refresh_link(i);
+        }
+    }
+}
+
+static void on_restart_timer(struct event_source* src, uint32_t events) {
+    uint64_t expirations;
+    (void)events;
+
+    while (read(src->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {
+    }
+
+    uint64_t now = monotonic_ns();
+    for (int i = 0; i < num_links; i++) {
+        struct bus_link* link = &links[i];
+        if (link->restart_at == 0 || link->restart_at > now) {
+            continue;
+        }
+        link->restart_at = 0;
+        // EBUSY: no longer bus-off, the link notification follows
+        if (can_nl_restart(link->ifindex) < 0 && errno != EBUSY) {
+            fprintf(stderr, "Error restarting %s: %s\n", link->name, strerror(errno));
+        }
+        refresh_link(i);
+    }
+    arm_timer();
+}
+
+int can_recovery_init(struct event_loop* loop, const struct can_iface* ifaces, int count) {
+    num_links = 0;
+    for (int i = 0; i < count && i < MAX_CAN_IFACES; i++) {
+        struct bus_link* link = &links[num_links++];
+        memset(link, 0, sizeof(*link));
+        link->name = ifaces[i].name;
+        link->ifindex = if_nametoindex(ifaces[i].name);
+        link->up = true;    // The sockets were just opened on running links
+        link->state = CAN_STATE_MAX;
+    }
+
+    timer_ev.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_ev.fd < 0) {
+        perror("Error creating bus recovery timer");
+        return -1;
+    }
+    timer_ev.handler = on_restart_timer;
+    timer_ev.ctx = NULL;
+    nl_ev.fd = can_nl_monitor_fd();
+    nl_ev.handler = on_netlink_event;
+    nl_ev.ctx = NULL;
+    if (nl_ev.fd < 0 || event_loop_add(loop, &timer_ev, EPOLLIN) < 0 ||
+        event_loop_add(loop, &nl_ev, EPOLLIN) < 0) {
+        return -1;
+    }
+
+    // Drop the notifications of the startup configuration, then start from
+    // the current state
+    can_nl_read_events(on_link, NULL);
+    for (int i = 0; i < num_links; i++) {
+        refresh_link(i);
+    }
+    return 0;
+}
+
+void can_recovery_error_frame(int iface, const struct canfd_frame* frame) {
+    struct stats_iface* st = &stats->ifaces[iface];
+    uint32_t state = CAN_STATE_MAX;
+
+    if (frame->can_id & CAN_ERR_BUSOFF) {
+        stats_add(&st->bus_off, 1);
+        state = CAN_STATE_BUS_OFF;
+    }
+    else if (frame->can_id & CAN_ERR_RESTARTED) {
+        stats_add(&st->restarts, 1);
+        state = CAN_STATE_ERROR_ACTIVE;
+    }
+    else if (frame->can_id & CAN_ERR_CRTL) {
+        uint8_t ctrl = frame->data[1];
+        if (ctrl & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) {
+            state = CAN_STATE_ERROR_PASSIVE;
+        }
+        else if (ctrl & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING)) {
+            state = CAN_STATE_ERROR_WARNING;
+        }
+        else if (ctrl & CAN_ERR_CRTL_ACTIVE) {
+            state = CAN_STATE_ERROR_ACTIVE;
+        }
+    }
+    if (state != CAN_STATE_MAX) {
+        __atomic_store_n(&st->can_state, state, __ATOMIC_RELAXED);
+    }
+}
+
+bool can_recovery_socket_error(int iface, int err) {
+    if (err != ENETDOWN || iface < 0 || iface >= num_links) {
+        return false;
+    }
+    refresh_link(iface);
+    return true;
+}
+
+void can_recovery_close(void) {
+    if (num_links > 0 && timer_ev.fd >= 0) {
+        close(timer_ev.fd);
+        timer_ev.fd = -1;
+    }
+    num_links = 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Per-interface bus-off recovery
+ *
+ * CAN controllers are configured with a restart delay (restart-ms), so the
+ * kernel restarts a controller by itself after bus-off; the bridge does not
+ * take the link down and the other interfaces are not affected. rtnetlink
+ * link notifications tell when a link stops (bus-off, carrier or link down)
+ * and when it runs again: in between, frames routed to it wait in its
+ * bounded forwarding ring instead of failing in sendmmsg(), and are sent
+ * once it is back (forward_set_link()). A controller without automatic
+ * restarts is restarted over rtnetlink after the same delay.
+ *
+ * Bus-off, restart and controller state error frames are always received;
+ * they keep the counters and the controller state in the stats segment
+ * current without waiting for the link notification.
+ */
+
+#ifndef CAN_RECOVERY_H
+#define CAN_RECOVERY_H
+
+#include <stdint.h>
+#include <linux/can.h>
+#include <linux/can/error.h>
+#include <linux/can/netlink.h>
+
+#include "can_fd.h"
+#include "can_iface.h"
+#include "event_loop.h"
+
+// Bus-off restart delay set on the controllers, and used for manual
+// restarts when a controller has none
+#define CAN_RECOVERY_RESTART_MS 100
+
+// Error classes needed to follow the controller state
+#define CAN_RECOVERY_ERR_MASK (CAN_ERR_CRTL | CAN_ERR_BUSOFF | CAN_ERR_RESTARTED)
+
+// Start following the links of the interface table (after stats_open(),
+// with the rtnetlink sockets of can_nl_open() still open). Returns 0 or -1.
+int can_recovery_init(struct event_loop* loop, const struct can_iface* ifaces, int count);
+
+// Account an error frame (any thread)
+void can_recovery_error_frame(int iface, const struct canfd_frame* frame);
+
+// A socket of the interface reported err (event loop thread). ENETDOWN
+// re-reads the link state; returns true if err was a link error.
+bool can_recovery_socket_error(int iface, int err);
+
+void can_recovery_close(void);
+
+static inline const char* can_state_name(uint32_t state) {
+    switch (state) {
+    case CAN_STATE_ERROR_ACTIVE: return "error-active";
+    case CAN_STATE_ERROR_WARNING: return "error-warning";
+    case CAN_STATE_ERROR_PASSIVE: return "error-passive";
+    case CAN_STATE_BUS_OFF: return "bus-off";
+    case CAN_STATE_STOPPED: return "stopped";
+    case CAN_STATE_SLEEPING: return "sleeping";
+    default: return "unknown";
+    }
+}
+
+#endif // CAN_RECOVERY_H
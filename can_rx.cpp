@@ -0,0 +1,103 @@
+/*
+ * Batched CAN frame reception
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "can_rx.h"
+#include "clock_util.h"
+
+void rx_batch_init(struct rx_batch* batch) {
+    memset(batch, 0, sizeof(*batch));
+
+    for (int i = 0; i < RX_BATCH_SIZE; i++) {
+        batch->iov[i].iov_base = &batch->frames[i];
+        batch->iov[i].iov_len = CANFD_MTU;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_control = batch->control[i];
+    }
+}
+
+// Pull the SO_TIMESTAMPING software stamp and the SO_RXQ_OVFL drop count
+// (only sent once the socket dropped something) out of one message's
+// ancillary data
+static void parse_control(struct msghdr* hdr, uint64_t* sw, uint32_t* drops) {
+    *sw = 0;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+            const struct scm_timestamping* st = (const struct scm_timestamping*)CMSG_DATA(cmsg);
+            *sw = timespec_ns(&st->ts[0]);
+        }
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(drops, CMSG_DATA(cmsg), sizeof(*drops));
+        }
+    }
+}
+
+static int read_batch(int sock, struct rx_batch* batch, int flags) {
+    int n;
+
+    batch->count = 0;
+    // The batch buffer may be shared by several sockets; a count only
+    // belongs to the socket that reported it in this read
+    batch->drops = 0;
+
+    // The kernel shrinks msg_controllen to what it used; reset it each call
+    for (int i = 0; i < RX_BATCH_SIZE; i++) {
+        batch->msgs[i].msg_hdr.msg_controllen = RX_CMSG_SPACE;
+    }
+
+    n = recvmmsg(sock, batch->msgs, RX_BATCH_SIZE, flags, NULL);
+    if (n < 0 && errno == ENETDOWN) {
+        // A link going down is reported once, ahead of the frames still
+        // queued; the bus recovery follows the link itself
+        n = recvmmsg(sock, batch->msgs, RX_BATCH_SIZE, flags | MSG_DONTWAIT, NULL);
+    }
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            perror("Error reading from CAN");
+        }
+        return -1;
+    }
+
+    batch->user_ts = realtime_ns();
+
+    // Drop incomplete frames, keeping the valid ones contiguous
+    int valid = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned int msg_len = batch->msgs[i].msg_len;
+        if (msg_len != CAN_MTU && msg_len != CANFD_MTU) {
+            fprintf(stderr, "Incomplete CAN frame received\n");
+            continue;
+        }
+        if (valid != i) {
+            memcpy(&batch->frames[valid], &batch->frames[i], msg_len);
+        }
+        // Older kernels do not mark FD frames themselves
+        if (msg_len == CANFD_MTU) {
+            batch->frames[valid].flags |= CANFD_FDF;
+        }
+        batch->local[valid] = (batch->msgs[i].msg_hdr.msg_flags & MSG_DONTROUTE) != 0;
+        parse_control(&batch->msgs[i].msg_hdr, &batch->rx_ts[valid], &batch->drops);
+        valid++;
+    }
+
+    batch->count = valid;
+    return n;
+}
+
+int rx_batch_read(int sock, struct rx_batch* batch) {
+    return read_batch(sock, batch, MSG_DONTWAIT);
+}
+
+int rx_batch_wait(int sock, struct rx_batch* batch) {
+    // Block for the first frame only, then take whatever else is queued
+    return read_batch(sock, batch, MSG_WAITFORONE);
+}
@@ -0,0 +1,53 @@
+/*
+ * Batched CAN frame reception
+ *
+ * Drains a raw CAN socket with recvmmsg() into a fixed array of frames so
+ * that a burst of traffic costs one syscall per batch instead of one per
+ * frame.
+ */
+
+#ifndef CAN_RX_H
+#define CAN_RX_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/errqueue.h>
+
+#include "can_fd.h"
+
+// Maximum number of frames received by a single recvmmsg() call
+#define RX_BATCH_SIZE 32
+
+// Ancillary data space per message (SO_TIMESTAMPING and SO_RXQ_OVFL)
+#define RX_CMSG_SPACE (CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(uint32_t)))
+
+// Receive buffers for one batch (reused across calls, no allocation)
+struct rx_batch {
+    struct canfd_frame frames[RX_BATCH_SIZE];  // Classic and FD frames (see can_fd.h)
+    uint64_t rx_ts[RX_BATCH_SIZE];  // Kernel software RX time (CLOCK_REALTIME ns), 0 if none
+    bool local[RX_BATCH_SIZE];      // Sent from this host and looped back (MSG_DONTROUTE)
+    uint64_t user_ts;               // CLOCK_REALTIME when recvmmsg() returned
+    uint32_t drops;                 // Frames the socket dropped so far (SO_RXQ_OVFL),
+                                    // as of the last frame of this batch that
+                                    // reported it, 0 if none did
+    struct iovec iov[RX_BATCH_SIZE];
+    struct mmsghdr msgs[RX_BATCH_SIZE];
+    char control[RX_BATCH_SIZE][RX_CMSG_SPACE];
+    int count;      // Number of valid frames after rx_batch_read()
+};
+
+
+// Wire the iovec/mmsghdr arrays to the frame buffers
+void rx_batch_init(struct rx_batch* batch);
+
+// Read up to RX_BATCH_SIZE frames without blocking.
+// Returns the number of messages received (0 if the socket is empty, -1 on
+// error); batch->count holds how many of them were complete frames.
+int rx_batch_read(int sock, struct rx_batch* batch);
+
+// Like rx_batch_read() but blocks until at least one frame arrives (or the
+// socket's SO_RCVTIMEO expires, which returns 0)
+int rx_batch_wait(int sock, struct rx_batch* batch);
+
+#endif // CAN_RX_H
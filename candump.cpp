@@ -0,0 +1,135 @@
+/*
+ * candump log format (candump -l / -L)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "candump.h"
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+int candump_parse_frame(const char* frame_text, struct canfd_frame* frame) {
+    memset(frame, 0, sizeof(*frame));
+
+    // CAN ID: 3 hex digits for standard frames, 8 for extended frames
+    const char* hash = strchr(frame_text, '#');
+    if (hash == NULL) {
+        return -1;
+    }
+    size_t id_len = hash - frame_text;
+    canid_t id = 0;
+    for (size_t i = 0; i < id_len; i++) {
+        int v = hex_value(frame_text[i]);
+        if (v < 0) {
+            return -1;
+        }
+        id = (id << 4) | v;
+    }
+    if (id_len == 8) {
+        id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    }
+    else if (id_len != 3) {
+        return -1;
+    }
+
+    const char* data = hash + 1;
+    if (*data == 'R' || *data == 'r') {
+        frame->can_id = id | CAN_RTR_FLAG;
+        frame->len = isdigit((unsigned char)data[1]) ? data[1] - '0' : 0;
+        return 0;
+    }
+
+    // CAN-FD: "##" and the flags digit before the payload
+    int max_len = CAN_MAX_DLEN;
+    if (*data == '#') {
+        int flags = hex_value(data[1]);
+        if (flags < 0) {
+            return -1;
+        }
+        frame->flags = CANFD_FDF | (flags & (CANFD_BRS | CANFD_ESI));
+        max_len = CANFD_MAX_DLEN;
+        data += 2;
+    }
+
+    // Payload: pairs of hex digits, optionally separated by '.'
+    int len = 0;
+    while (*data != '\0' && len < max_len) {
+        if (*data == '.') {
+            data++;
+            continue;
+        }
+        int hi = hex_value(data[0]);
+        int lo = hex_value(data[1]);
+        if (hi < 0 || lo < 0) {
+            return -1;
+        }
+        frame->data[len++] = (hi << 4) | lo;
+        data += 2;
+    }
+
+    frame->can_id = id;
+    frame->len = len;
+    return 0;
+}
+
+int candump_parse_line(const char* line, struct candump_entry* entry) {
+    unsigned long long sec;
+    unsigned long usec;
+    char frame_text[160];
+    int consumed = 0;
+
+    memset(entry, 0, sizeof(*entry));
+
+    if (sscanf(line, " (%llu.%lu) %15s %159s%n", &sec, &usec, entry->ifname, frame_text, &consumed) != 4) {
+        return -1;
+    }
+    entry->ts_ns = sec * 1000000000ull + usec * 1000ull;
+    return candump_parse_frame(frame_text, &entry->frame);
+}
+
+int candump_format(char* buf, size_t size, uint64_t ts_ns, const char* ifname,
+                   const struct canfd_frame* frame) {
+    static const char hex[] = "0123456789ABCDEF";
+    int len;
+
+    if (frame->can_id & CAN_EFF_FLAG) {
+        len = snprintf(buf, size, "(%llu.%06llu) %s %08X#",
+                       (unsigned long long)(ts_ns / 1000000000ull),
+                       (unsigned long long)(ts_ns % 1000000000ull / 1000),
+                       ifname, frame->can_id & CAN_EFF_MASK);
+    }
+    else {
+        len = snprintf(buf, size, "(%llu.%06llu) %s %03X#",
+                       (unsigned long long)(ts_ns / 1000000000ull),
+                       (unsigned long long)(ts_ns % 1000000000ull / 1000),
+                       ifname, frame->can_id & CAN_SFF_MASK);
+    }
+
+    if (frame->can_id & CAN_RTR_FLAG) {
+        len += snprintf(buf + len, size - len, "R\n");
+        return len;
+    }
+
+    if (can_frame_is_fd(frame) && len + 3 < (int)size) {
+        buf[len++] = '#';
+        buf[len++] = hex[frame->flags & (CANFD_BRS | CANFD_ESI)];
+    }
+
+    int dlen = can_frame_len(frame);
+    for (int i = 0; i < dlen && len + 3 < (int)size; i++) {
+        buf[len++] = hex[frame->data[i] >> 4];
+        buf[len++] = hex[frame->data[i] & 0x0F];
+    }
+    if (len + 1 < (int)size) {
+        buf[len++] = '\n';
+        buf[len] = '\0';
+    }
+    return len;
+}
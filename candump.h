@@ -0,0 +1,39 @@
+/*
+ * candump log format (candump -l / -L)
+ *
+ *   (1436509052.249713) canfd1 18FF0280#0500000000000000
+ *   (1436509052.249713) canfd1 18FF0280##10500000000000000  (CAN-FD)
+ *
+ * CAN-FD frames use "##" followed by one hex digit of CANFD_BRS/CANFD_ESI
+ * flags and up to 64 data bytes.
+ */
+
+#ifndef CANDUMP_H
+#define CANDUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+
+// One parsed log line
+struct candump_entry {
+    uint64_t ts_ns;             // Timestamp from the log (CLOCK_REALTIME ns)
+    char ifname[IFNAMSIZ];
+    struct canfd_frame frame;   // CANFD_FDF set for FD frames
+};
+
+// Parse the frame field of a line ("18FF0280#0500000000000000"). Returns 0
+// on success, -1 if the text is not a frame.
+int candump_parse_frame(const char* text, struct canfd_frame* frame);
+
+// Parse one log line. Returns 0 on success, -1 if the line is not a frame.
+int candump_parse_line(const char* line, struct candump_entry* entry);
+
+// Format a frame as a log line (with trailing newline). Returns the length.
+int candump_format(char* buf, size_t size, uint64_t ts_ns, const char* ifname,
+                   const struct canfd_frame* frame);
+
+#endif // CANDUMP_H
@@ -0,0 +1,294 @@
+/*
+ * Binary frame capture
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "arena.h"
+
+#define CAPTURE_PAGE_SIZE 4096
+
+struct capture_segment {
+    struct capture_header* hdr;
+    char* records;
+    size_t size;
+};
+
+bool capture_enabled = false;
+
+static struct capture_segment segments[CAPTURE_MAX_FILES];
+static int num_segments = 0;
+static int current = 0;
+static uint64_t next_sequence = 1;
+static uint32_t record_size = CAPTURE_RECORD_SIZE;
+static const char* const* names;
+static int num_names;
+
+// Header plus index, rounded up to whole pages
+static size_t header_size_for(size_t file_size, uint32_t* capacity) {
+    size_t header = CAPTURE_PAGE_SIZE;
+    size_t records;
+
+    // Grow the header until the index covers every record it leaves room for
+    for (;;) {
+        records = (file_size - header) / record_size;
+        size_t entries = (records + CAPTURE_INDEX_STRIDE - 1) / CAPTURE_INDEX_STRIDE;
+        if (sizeof(struct capture_header) + entries * sizeof(uint64_t) <= header) {
+            break;
+        }
+        header += CAPTURE_PAGE_SIZE;
+    }
+    *capacity = records;
+    return header;
+}
+
+static bool header_matches(const struct capture_header* hdr, size_t header_size, uint32_t capacity) {
+    return memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) == 0 &&
+           hdr->version == CAPTURE_VERSION && hdr->header_size == header_size &&
+           hdr->record_size == record_size && hdr->capacity == capacity &&
+           hdr->index_stride == CAPTURE_INDEX_STRIDE;
+}
+
+static void set_ifaces(struct capture_header* hdr) {
+    memset(hdr->ifaces, 0, sizeof(hdr->ifaces));
+    hdr->num_ifaces = num_names;
+    for (int i = 0; i < num_names && i < MAX_CAN_IFACES; i++) {
+        strncpy(hdr->ifaces[i], names[i], IFNAMSIZ - 1);
+    }
+}
+
+static void init_header(struct capture_header* hdr, size_t header_size, uint32_t capacity) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic));
+    hdr->version = CAPTURE_VERSION;
+    hdr->header_size = header_size;
+    hdr->record_size = record_size;
+    hdr->capacity = capacity;
+    hdr->index_stride = CAPTURE_INDEX_STRIDE;
+    set_ifaces(hdr);
+}
+
+// Create or reuse one preallocated ring file and map it
+static int open_segment(const char* path, struct capture_segment* seg, size_t file_size,
+                        size_t header_size, uint32_t capacity) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    // Reserve the blocks up front so a full eMMC cannot fail a write later
+    int err = posix_fallocate(fd, 0, file_size);
+    if (err != 0) {
+        fprintf(stderr, "%s: preallocation failed: %s\n", path, strerror(err));
+        close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping capture file");
+        return -1;
+    }
+
+    seg->hdr = (struct capture_header*)map;
+    seg->records = (char*)map + header_size;
+    seg->size = file_size;
+
+    // Files from another layout (or new ones) start out empty
+    if (!header_matches(seg->hdr, header_size, capacity)) {
+        init_header(seg->hdr, header_size, capacity);
+    }
+    return 0;
+}
+
+// Start writing a segment from scratch (oldest data in the ring is lost)
+static void reset_segment(struct capture_segment* seg) {
+    struct capture_header* hdr = seg->hdr;
+
+    __atomic_store_n(&hdr->count, 0, __ATOMIC_RELEASE);
+    set_ifaces(hdr);
+    hdr->sequence = next_sequence++;
+    hdr->first_ts = 0;
+    hdr->last_ts = 0;
+}
+
+int capture_open(const char* dir, int files, size_t file_size,
+                 const char* const* iface_names, int count, bool fd) {
+    char path[PATH_MAX];
+    uint32_t capacity;
+
+    if (files < 1 || files > CAPTURE_MAX_FILES) {
+        fprintf(stderr, "Capture file count must be 1..%d\n", CAPTURE_MAX_FILES);
+        return -1;
+    }
+    if (file_size < 4 * CAPTURE_PAGE_SIZE) {
+        fprintf(stderr, "Capture file size too small\n");
+        return -1;
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+
+    record_size = fd ? CAPTURE_FD_RECORD_SIZE : CAPTURE_RECORD_SIZE;
+    size_t header_size = header_size_for(file_size, &capacity);
+    names = iface_names;
+    num_names = count;
+
+    // Continue after the newest file so earlier captures survive a restart
+    uint64_t newest = 0;
+    current = 0;
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/capture.%02d.bin", dir, i);
+        if (open_segment(path, &segments[i], file_size, header_size, capacity) < 0) {
+            num_segments = i;
+            capture_close();
+            return -1;
+        }
+        if (segments[i].hdr->sequence > newest) {
+            newest = segments[i].hdr->sequence;
+            current = (i + 1) % files;
+        }
+    }
+    num_segments = files;
+    next_sequence = newest + 1;
+
+    reset_segment(&segments[current]);
+    arena_charge("capture files", (size_t)files * file_size);
+    capture_enabled = true;
+    return 0;
+}
+
+void capture_close(void) {
+    capture_enabled = false;
+    for (int i = 0; i < num_segments; i++) {
+        msync(segments[i].hdr, segments[i].size, MS_ASYNC);
+        munmap(segments[i].hdr, segments[i].size);
+    }
+    num_segments = 0;
+}
+
+void capture_write(uint64_t ts_ns, int iface, const struct canfd_frame* frame) {
+    struct capture_segment* seg = &segments[current];
+    struct capture_header* hdr = seg->hdr;
+    uint32_t n = hdr->count;
+
+    // Current file full: reuse the oldest one
+    if (n == hdr->capacity) {
+        current = (current + 1) % num_segments;
+        seg = &segments[current];
+        hdr = seg->hdr;
+        reset_segment(seg);
+        n = 0;
+    }
+
+    // Classic records keep the first 8 data bytes. Only the frame's MTU is
+    // read: a replayed frame may be a view of a classic record.
+    alignas(8) char buf[CAPTURE_FD_RECORD_SIZE];
+    struct capture_record* rec = (struct capture_record*)buf;
+    unsigned int data_size = record_size - offsetof(struct capture_record, data);
+    unsigned int avail = can_frame_mtu(frame) - offsetof(struct canfd_frame, data);
+    unsigned int len = can_frame_len(frame);
+    rec->ts_ns = ts_ns;
+    rec->can_id = frame->can_id;
+    rec->iface = iface;
+    rec->len = len < data_size ? len : data_size;
+    rec->flags = frame->flags;
+    rec->pad = 0;
+    if (avail < data_size) {
+        memset(buf + offsetof(struct capture_record, data) + avail, 0, data_size - avail);
+    }
+    memcpy(buf + offsetof(struct capture_record, data), frame->data, avail < data_size ? avail : data_size);
+    memcpy(seg->records + (size_t)n * record_size, buf, record_size);
+
+    if (n % CAPTURE_INDEX_STRIDE == 0) {
+        hdr->index[n / CAPTURE_INDEX_STRIDE] = ts_ns;
+    }
+    if (n == 0) {
+        hdr->first_ts = ts_ns;
+    }
+    hdr->last_ts = ts_ns;
+    __atomic_store_n(&hdr->count, n + 1, __ATOMIC_RELEASE);
+}
+
+int capture_file_open(const char* path, struct capture_file* file) {
+    struct stat st;
+
+    file->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (file->fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(file->fd, &st) < 0 || (size_t)st.st_size < sizeof(struct capture_header)) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        close(file->fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping capture file");
+        close(file->fd);
+        return -1;
+    }
+    file->size = st.st_size;
+    file->hdr = (const struct capture_header*)map;
+
+    const struct capture_header* hdr = file->hdr;
+    if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != CAPTURE_VERSION ||
+        (hdr->record_size != CAPTURE_RECORD_SIZE && hdr->record_size != CAPTURE_FD_RECORD_SIZE) ||
+        hdr->index_stride == 0 ||
+        hdr->header_size + (size_t)hdr->capacity * hdr->record_size > file->size) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        capture_file_close(file);
+        return -1;
+    }
+    file->records = (const char*)map + hdr->header_size;
+    return 0;
+}
+
+void capture_file_close(struct capture_file* file) {
+    munmap((void*)file->hdr, file->size);
+    close(file->fd);
+}
+
+uint32_t capture_file_count(const struct capture_file* file) {
+    uint32_t count = __atomic_load_n(&file->hdr->count, __ATOMIC_ACQUIRE);
+    return count < file->hdr->capacity ? count : file->hdr->capacity;
+}
+
+uint32_t capture_file_seek(const struct capture_file* file, uint64_t ts) {
+    const struct capture_header* hdr = file->hdr;
+    uint32_t count = capture_file_count(file);
+    uint32_t entries = (count + hdr->index_stride - 1) / hdr->index_stride;
+
+    // Last index entry at or before ts, then scan within its stride
+    uint32_t lo = 0;
+    uint32_t hi = entries;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (hdr->index[mid] <= ts) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    uint32_t pos = lo > 0 ? (lo - 1) * hdr->index_stride : 0;
+    while (pos < count && capture_file_record(file, pos)->ts_ns < ts) {
+        pos++;
+    }
+    return pos;
+}
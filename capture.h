@@ -0,0 +1,139 @@
+/*
+ * Binary frame capture
+ *
+ * Received frames are written as fixed-size records (24 bytes, 80 bytes
+ * when CAN-FD interfaces are captured) into a ring of
+ * preallocated, memory-mapped files (capture.00.bin, capture.01.bin, ...).
+ * When the current file is full the oldest one is reused, so the disk
+ * footprint never grows beyond files * file size. Writing a frame is a
+ * memcpy into the mapping; the kernel writes the pages back.
+ *
+ * Each file starts with a header holding the interface names, a sequence
+ * number (files are read back in sequence order) and a time index with the
+ * timestamp of every CAPTURE_INDEX_STRIDE-th record for seeking.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+#include "can_iface.h"
+
+#define CAPTURE_MAGIC "CANCAP1"
+#define CAPTURE_VERSION 2
+
+// Default ring: 8 files of 4 MiB
+#define CAPTURE_DEFAULT_FILES 8
+#define CAPTURE_DEFAULT_FILE_MB 4
+#define CAPTURE_MAX_FILES 64
+
+// One index entry per this many records
+#define CAPTURE_INDEX_STRIDE 64
+
+// One captured frame. Records in FD capture files are CAPTURE_FD_RECORD_SIZE
+// bytes with up to 64 data bytes (read them through capture_record_data()).
+// From can_id on, a record has the layout of a struct canfd_frame, with the
+// interface in its first reserved byte, so a reader can use the frame in
+// place (capture_record_frame()).
+struct capture_record {
+    uint64_t ts_ns;         // Receive time (CLOCK_REALTIME ns)
+    uint32_t can_id;        // Including the EFF/RTR/ERR flags
+    uint8_t len;
+    uint8_t flags;          // canfd_frame flags (CANFD_FDF for FD frames)
+    uint8_t iface;          // Index into the header's interface names (__res0)
+    uint8_t pad;            // Always 0 (__res1, len8_dlc of a classic frame)
+    uint8_t data[CAN_MAX_DLEN];
+};
+
+#define CAPTURE_RECORD_SIZE sizeof(struct capture_record)
+#define CAPTURE_FD_RECORD_SIZE (offsetof(struct capture_record, data) + CANFD_MAX_DLEN)
+#define CAPTURE_FRAME_OFFSET offsetof(struct capture_record, can_id)
+
+static_assert(offsetof(struct capture_record, len) - CAPTURE_FRAME_OFFSET == offsetof(struct canfd_frame, len) &&
+              offsetof(struct capture_record, flags) - CAPTURE_FRAME_OFFSET ==
+              offsetof(struct canfd_frame, flags) &&
+              offsetof(struct capture_record, data) - CAPTURE_FRAME_OFFSET == offsetof(struct canfd_frame, data) &&
+              CAPTURE_FRAME_OFFSET % alignof(struct canfd_frame) == 0,
+              "capture records must hold a canfd_frame");
+
+static inline const uint8_t* capture_record_data(const struct capture_record* rec) {
+    return (const uint8_t*)rec + offsetof(struct capture_record, data);
+}
+
+// The frame of a record, in place. Only its first record_size -
+// CAPTURE_FRAME_OFFSET bytes are there: all of an FD frame in FD files, the
+// classic can_frame part (CAN_MTU) in classic ones. The interface index
+// shows in the reserved byte.
+static inline const struct canfd_frame* capture_record_frame(const struct capture_record* rec) {
+    return (const struct canfd_frame*)((const char*)rec + CAPTURE_FRAME_OFFSET);
+}
+
+// File header, followed by the index, records start at header_size
+struct capture_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;       // Offset of the first record (page aligned)
+    uint32_t record_size;       // CAPTURE_RECORD_SIZE or CAPTURE_FD_RECORD_SIZE
+    uint32_t capacity;          // Records per file
+    uint32_t index_stride;
+    uint32_t num_ifaces;
+    char ifaces[MAX_CAN_IFACES][IFNAMSIZ];
+    uint64_t sequence;          // Order of the files in the ring, 0 = empty
+    uint64_t first_ts;
+    uint64_t last_ts;
+    uint32_t count;             // Valid records (stored with release order)
+    uint32_t reserved;
+    uint64_t index[];           // index[k] = ts of record k * index_stride
+};
+
+extern bool capture_enabled;
+
+// Open (creating and preallocating as needed) the capture ring in dir.
+// Writing continues after the newest existing file. iface_names are
+// recorded in every file header. fd selects records with room for CAN-FD
+// payloads (classic records hold the first 8 bytes).
+int capture_open(const char* dir, int files, size_t file_size,
+                 const char* const* iface_names, int count, bool fd);
+
+// Sync and unmap the capture files
+void capture_close(void);
+
+// Append a frame (downstream stage only; rotates to the next file when full)
+void capture_write(uint64_t ts_ns, int iface, const struct canfd_frame* frame);
+
+static inline void capture_frame(uint64_t ts_ns, int iface, const struct canfd_frame* frame) {
+    if (capture_enabled) {
+        capture_write(ts_ns, iface, frame);
+    }
+}
+
+// Read-only view of one capture file
+struct capture_file {
+    int fd;
+    size_t size;
+    const struct capture_header* hdr;
+    const char* records;        // hdr->record_size bytes apart
+};
+
+// Map a capture file for reading. Returns -1 if it is not a capture file.
+int capture_file_open(const char* path, struct capture_file* file);
+void capture_file_close(struct capture_file* file);
+
+static inline const struct capture_record* capture_file_record(const struct capture_file* file,
+                                                               uint32_t pos) {
+    return (const struct capture_record*)(file->records + (size_t)pos * file->hdr->record_size);
+}
+
+// Number of valid records in a (possibly still written) file
+uint32_t capture_file_count(const struct capture_file* file);
+
+// Position of the first record with ts_ns >= ts (count if there is none),
+// found through the index. Records are assumed to be in time order.
+uint32_t capture_file_seek(const struct capture_file* file, uint64_t ts);
+
+#endif // CAPTURE_H
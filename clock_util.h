@@ -0,0 +1,28 @@
+/*
+ * Clock helpers (nanosecond timestamps)
+ */
+
+#ifndef CLOCK_UTIL_H
+#define CLOCK_UTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t timespec_ns(const struct timespec* ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+// Wall clock, same time base as kernel software RX timestamps
+static inline uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return timespec_ns(&ts);
+}
+
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_ns(&ts);
+}
+
+#endif // CLOCK_UTIL_H
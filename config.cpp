@@ -0,0 +1,251 @@
+/*
+ * Configuration file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+// Longest line and most words per line
+#define CONFIG_LINE_MAX 256
+#define CONFIG_MAX_WORDS 16
+
+int config_parse_id(const char* text, canid_t* id, canid_t* mask) {
+    char* end;
+
+    *id = strtoul(text, &end, 16);
+    *mask = CAN_EFF_MASK;
+    if (end == text) {
+        return -1;
+    }
+    if (*end == '/') {
+        const char* mask_text = end + 1;
+        *mask = strtoul(mask_text, &end, 16);
+        if (end == mask_text) {
+            return -1;
+        }
+    }
+    return *end == '\0' ? 0 : -1;
+}
+
+int config_parse_limit(const char* text, struct fwd_limit* limit) {
+    char* end;
+
+    if (strncmp(text, "rate=", 5) == 0) {
+        limit->rate = strtoul(text + 5, &end, 10);
+        limit->burst = 1;
+        if (*end == '/') {
+            const char* burst_text = end + 1;
+            limit->burst = strtoul(burst_text, &end, 10);
+            if (end == burst_text || limit->burst == 0) {
+                return -1;
+            }
+        }
+        return end == text + 5 || *end != '\0' || limit->rate == 0 || limit->rate > 1000000000 ? -1 : 0;
+    }
+    if (strcmp(text, "change") == 0) {
+        limit->on_change = true;
+        limit->refresh_ms = 0;
+        return 0;
+    }
+    if (strncmp(text, "change=", 7) == 0) {
+        limit->on_change = true;
+        limit->refresh_ms = strtoul(text + 7, &end, 10);
+        return end == text + 7 || *end != '\0' ? -1 : 0;
+    }
+    return 1;
+}
+
+// Copy a name into a fixed field. Returns -1 if it does not fit.
+static int copy_name(char* dst, size_t size, const char* src) {
+    if (strlen(src) == 0 || strlen(src) >= size) {
+        return -1;
+    }
+    snprintf(dst, size, "%s", src);
+    return 0;
+}
+
+static int parse_line(char** words, int count, struct bridge_config* cfg, const char** error) {
+    const char* cmd = words[0];
+
+    if (strcmp(cmd, "interface") == 0) {
+        if (count < 3 || count > 4) {
+            *error = "expected interface name bitrate [dbitrate]";
+            return -1;
+        }
+        if (cfg->num_ifaces >= MAX_CAN_IFACES) {
+            *error = "too many interfaces";
+            return -1;
+        }
+        struct config_iface* iface = &cfg->ifaces[cfg->num_ifaces];
+        if (copy_name(iface->name, sizeof(iface->name), words[1]) < 0) {
+            *error = "invalid interface name";
+            return -1;
+        }
+        iface->bitrate = atoi(words[2]);
+        iface->dbitrate = count > 3 ? atoi(words[3]) : 0;
+        cfg->num_ifaces++;
+        return 0;
+    }
+    if (strcmp(cmd, "route") == 0) {
+        if (count < 3) {
+            *error = "expected route src dst [id[/mask]] [rate=n[/burst]] [change[=ms]]";
+            return -1;
+        }
+        if (cfg->num_routes >= FWD_MAX_ROUTES) {
+            *error = "too many routes";
+            return -1;
+        }
+        struct config_route* route = &cfg->routes[cfg->num_routes];
+        if (copy_name(route->src, sizeof(route->src), words[1]) < 0 ||
+            copy_name(route->dst, sizeof(route->dst), words[2]) < 0) {
+            *error = "invalid interface name";
+            return -1;
+        }
+        route->id = 0;
+        route->mask = 0;
+        memset(&route->limit, 0, sizeof(route->limit));
+        for (int i = 3; i < count; i++) {
+            int ret = config_parse_limit(words[i], &route->limit);
+            if (ret < 0) {
+                *error = "invalid route limit";
+                return -1;
+            }
+            if (ret > 0 && (i > 3 || config_parse_id(words[i], &route->id, &route->mask) < 0)) {
+                *error = "invalid CAN ID/mask";
+                return -1;
+            }
+        }
+        cfg->num_routes++;
+        return 0;
+    }
+    if (strcmp(cmd, "filter") == 0) {
+        if (count != 3) {
+            *error = "expected filter iface id[/mask]";
+            return -1;
+        }
+        if (cfg->num_filters >= CAN_FILTER_MAX_RULES) {
+            *error = "too many filters";
+            return -1;
+        }
+        struct config_filter* filter = &cfg->filters[cfg->num_filters];
+        if (copy_name(filter->iface, sizeof(filter->iface), words[1]) < 0) {
+            *error = "invalid interface name";
+            return -1;
+        }
+        if (config_parse_id(words[2], &filter->id, &filter->mask) < 0) {
+            *error = "invalid CAN ID/mask";
+            return -1;
+        }
+        cfg->num_filters++;
+        return 0;
+    }
+    if (strcmp(cmd, "rewrite") == 0) {
+        if (count < 4) {
+            *error = "expected rewrite dst id[/mask] op...";
+            return -1;
+        }
+        if (cfg->num_rewrites >= CONFIG_MAX_REWRITES) {
+            *error = "too many rewrite rules";
+            return -1;
+        }
+        struct config_rewrite* rw = &cfg->rewrites[cfg->num_rewrites];
+        if (copy_name(rw->dst, sizeof(rw->dst), words[1]) < 0) {
+            *error = "invalid interface name";
+            return -1;
+        }
+        // Compiled by the caller (rewrite_add()), which reports bad rules
+        size_t len = 0;
+        for (int i = 2; i < count; i++) {
+            len += snprintf(rw->rule + len, sizeof(rw->rule) - len, "%s%s", i > 2 ? " " : "", words[i]);
+            if (len >= sizeof(rw->rule)) {
+                *error = "rewrite rule too long";
+                return -1;
+            }
+        }
+        cfg->num_rewrites++;
+        return 0;
+    }
+    if (strcmp(cmd, "decoder") == 0) {
+        if (count != 2) {
+            *error = "expected decoder name";
+            return -1;
+        }
+        if (cfg->num_decoders >= CONFIG_MAX_DECODERS) {
+            *error = "too many decoders";
+            return -1;
+        }
+        if (copy_name(cfg->decoders[cfg->num_decoders], CONFIG_NAME_LEN, words[1]) < 0) {
+            *error = "invalid decoder name";
+            return -1;
+        }
+        cfg->num_decoders++;
+        return 0;
+    }
+    *error = "unknown directive";
+    return -1;
+}
+
+int config_load(const char* path, struct bridge_config* cfg) {
+    FILE* file = fopen(path, "r");
+    char line[CONFIG_LINE_MAX];
+    int line_no = 0;
+    int ret = 0;
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    memset(cfg, 0, sizeof(*cfg));
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char* words[CONFIG_MAX_WORDS];
+        int count = 0;
+        bool too_long = false;
+        for (char* tok = strtok(line, " \t\r\n"); tok != NULL; tok = strtok(NULL, " \t\r\n")) {
+            if (count == CONFIG_MAX_WORDS) {
+                too_long = true;
+                break;
+            }
+            words[count++] = tok;
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        const char* error = too_long ? "too many words" : NULL;
+        if (too_long || parse_line(words, count, cfg, &error) < 0) {
+            fprintf(stderr, "%s:%d: %s\n", path, line_no, error);
+            ret = -1;
+        }
+    }
+    fclose(file);
+    return ret;
+}
+
+bool config_needs_restart(const struct bridge_config* a, const struct bridge_config* b) {
+    if (a->num_ifaces != b->num_ifaces || a->num_decoders != b->num_decoders) {
+        return true;
+    }
+    for (int i = 0; i < a->num_ifaces; i++) {
+        if (strcmp(a->ifaces[i].name, b->ifaces[i].name) != 0 ||
+            a->ifaces[i].bitrate != b->ifaces[i].bitrate ||
+            a->ifaces[i].dbitrate != b->ifaces[i].dbitrate) {
+            return true;
+        }
+    }
+    for (int i = 0; i < a->num_decoders; i++) {
+        if (strcmp(a->decoders[i], b->decoders[i]) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
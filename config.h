@@ -0,0 +1,94 @@
+/*
+ * Configuration file
+ *
+ * One directive per line, '#' starts a comment:
+ *
+ *   interface canfd1 250000 [2000000]   name, bitrate (0 = keep), data bitrate
+ *   route canfd1 canfd2 [id[/mask]]     like -r; id and mask in hex, then
+ *         [rate=n[/burst]] [change[=ms]]  optional limits (see -r)
+ *   filter canfd1 id[/mask]             also receive these frames (capture,
+ *                                       uplink, -v) without routing them
+ *   decoder TSC1                        decoders to run (default: all)
+ *   rewrite canfd2 0C000003/FFFF00 clamp:TSC1.RequestedSpeed=0..2000
+ *                                       modify frames sent on an interface
+ *                                       (rule syntax in rewrite.h)
+ *
+ * The file is read at startup (-f) and again on SIGHUP. A reload replaces
+ * the routes, rewrite rules and kernel filters while traffic keeps flowing: the new
+ * routing table is precompiled aside and swapped in with one pointer store
+ * (forward_set_routes()), and CAN_RAW_FILTER is replaced in place on the
+ * open sockets. Interfaces, bitrates and decoders only change at startup,
+ * so reloads never go through the interface restart.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "can_filter.h"
+#include "can_iface.h"
+#include "forward.h"
+
+#define CONFIG_MAX_DECODERS 8
+#define CONFIG_NAME_LEN 16
+#define CONFIG_MAX_REWRITES 32
+#define CONFIG_RULE_LEN 192
+
+struct config_iface {
+    char name[IFNAMSIZ];
+    int bitrate;
+    int dbitrate;
+};
+
+struct config_route {
+    char src[IFNAMSIZ];
+    char dst[IFNAMSIZ];
+    canid_t id;
+    canid_t mask;
+    struct fwd_limit limit;
+};
+
+struct config_filter {
+    char iface[IFNAMSIZ];
+    canid_t id;
+    canid_t mask;
+};
+
+struct config_rewrite {
+    char dst[IFNAMSIZ];
+    char rule[CONFIG_RULE_LEN];     // Words after the interface
+};
+
+// A parsed file; interface names are resolved by the caller
+struct bridge_config {
+    struct config_iface ifaces[MAX_CAN_IFACES];
+    int num_ifaces;
+    struct config_route routes[FWD_MAX_ROUTES];
+    int num_routes;
+    struct config_filter filters[CAN_FILTER_MAX_RULES];
+    int num_filters;
+    struct config_rewrite rewrites[CONFIG_MAX_REWRITES];
+    int num_rewrites;
+    char decoders[CONFIG_MAX_DECODERS][CONFIG_NAME_LEN];
+    int num_decoders;
+};
+
+// Parse path into cfg. Errors are reported as path:line. Returns 0 or -1
+// (cfg is then incomplete).
+int config_load(const char* path, struct bridge_config* cfg);
+
+// Parse a hex CAN ID with an optional /mask (default: all 29 ID bits).
+// Returns 0 or -1.
+int config_parse_id(const char* text, canid_t* id, canid_t* mask);
+
+// Parse a route limit option into limit: "rate=n[/burst]" (frames per
+// second) or "change[=ms]" (on change, refreshed every ms). Returns 0, -1
+// if it is malformed, 1 if the text is not a limit option.
+int config_parse_limit(const char* text, struct fwd_limit* limit);
+
+// True if the startup-only parts (interfaces, decoders) differ
+bool config_needs_restart(const struct bridge_config* a, const struct bridge_config* b);
+
+#endif // CONFIG_H
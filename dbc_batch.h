@@ -0,0 +1,243 @@
+/*
+ * Batched (SIMD) CAN signal extraction
+ *
+ * Payloads of many frames of the same message are gathered into two
+ * structure-of-arrays word planes (bytes 0-3 and 4-7). A signal that lies
+ * within one 32-bit word is then extracted for four frames per instruction:
+ * NEON on ARM, SSE2 on x86, plain C elsewhere. Results are written as one
+ * array per signal.
+ *
+ * This is a library for consumers that want whole batches of one message
+ * as arrays (bench_decode, offline analysis of captures). The RX pipeline
+ * does not use it: dispatch_message() decodes frame by frame, and only
+ * the payloads that changed (signal_store.h), which on a J1939 bus are
+ * rarely enough of one PGN within a receive batch to fill the vectors.
+ */
+
+#ifndef DBC_BATCH_H
+#define DBC_BATCH_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dbc_signal.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DBC_BATCH_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DBC_BATCH_SSE2 1
+#endif
+
+// Maximum number of frames per batch (multiple of the 4-lane vector width)
+#define DBC_BATCH_MAX 64
+
+struct dbc_batch {
+    alignas(16) uint32_t lo[DBC_BATCH_MAX];     // Payload bytes 0-3 (little-endian)
+    alignas(16) uint32_t hi[DBC_BATCH_MAX];     // Payload bytes 4-7
+    int count;
+};
+
+static inline void dbc_batch_clear(struct dbc_batch* batch) {
+    batch->count = 0;
+}
+
+// Append the 8 data bytes of a frame. Returns false if the batch is full.
+static inline bool dbc_batch_add(struct dbc_batch* batch, const uint8_t* data) {
+    if (batch->count >= DBC_BATCH_MAX) {
+        return false;
+    }
+    uint64_t word = dbc_load(data);
+    batch->lo[batch->count] = (uint32_t)word;
+    batch->hi[batch->count] = (uint32_t)(word >> 32);
+    batch->count++;
+    return true;
+}
+
+// Word plane holding signal S (signals must not cross bytes 3/4)
+template <typename S>
+static inline const uint32_t* dbc_batch_plane(const struct dbc_batch* batch) {
+    static_assert(!S::big_endian, "batched extraction needs Intel signals");
+    static_assert(S::start / 32 == (S::start + S::length - 1) / 32,
+                  "batched signals must lie within one 32-bit word");
+    return S::start < 32 ? batch->lo : batch->hi;
+}
+
+// Scalar extraction of S from its 32-bit word, the same math as the vector
+// paths (used for the batch tail)
+template <typename S>
+static inline int32_t dbc_word_raw(uint32_t word) {
+    const unsigned shift = S::start % 32;
+    uint32_t bits = word >> shift;
+    if (S::length < 32) {
+        bits &= (1u << (S::length % 32)) - 1;
+    }
+    if (S::is_signed) {
+        return (int32_t)(bits << (32 - S::length)) >> (32 - S::length);
+    }
+    return (int32_t)bits;
+}
+
+#ifdef DBC_BATCH_SSE2
+// Low 32 bits of a 32x32 multiply per lane (SSE2 has no pmulld)
+static inline __m128i dbc_mullo32(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+template <typename S>
+static inline __m128i dbc_vec_raw(__m128i words) {
+    const int shift = S::start % 32;
+    const int unused = 32 - S::length;
+    __m128i bits = _mm_slli_epi32(words, unused - shift);
+    return S::is_signed ? _mm_srai_epi32(bits, unused) : _mm_srli_epi32(bits, unused);
+}
+#endif
+
+#ifdef DBC_BATCH_NEON
+template <typename S>
+static inline uint32x4_t dbc_vec_raw(uint32x4_t words) {
+    const int shift = S::start % 32;
+    const int unused = 32 - S::length;
+    // vshlq with a negative count shifts right; it also accepts a count of 0
+    uint32x4_t bits = vshlq_u32(words, vdupq_n_s32(unused - shift));
+    if (S::is_signed) {
+        return vreinterpretq_u32_s32(vshlq_s32(vreinterpretq_s32_u32(bits), vdupq_n_s32(-unused)));
+    }
+    return vshlq_u32(bits, vdupq_n_s32(-unused));
+}
+#endif
+
+// Scaled values of S for every frame, in units of 2^-S::frac_bits
+template <typename S>
+static inline void dbc_batch_fixed(const struct dbc_batch* batch, int32_t* out) {
+    static_assert(S::fixed, "signal factor/offset not representable in fixed point");
+    static_assert(S::length <= 31 || (S::mul == 1 && S::add == 0), "scaled value does not fit 32 bits");
+
+    const uint32_t* words = dbc_batch_plane<S>(batch);
+    int i = 0;
+
+#if defined(DBC_BATCH_SSE2)
+    const __m128i mul = _mm_set1_epi32((int32_t)S::mul);
+    const __m128i add = _mm_set1_epi32((int32_t)S::add);
+    for (; i + 4 <= batch->count; i += 4) {
+        __m128i v = dbc_vec_raw<S>(_mm_load_si128((const __m128i*)&words[i]));
+        if (S::mul != 1) {
+            v = dbc_mullo32(v, mul);
+        }
+        v = _mm_add_epi32(v, add);
+        _mm_storeu_si128((__m128i*)&out[i], v);
+    }
+#elif defined(DBC_BATCH_NEON)
+    const int32x4_t mul = vdupq_n_s32((int32_t)S::mul);
+    const int32x4_t add = vdupq_n_s32((int32_t)S::add);
+    for (; i + 4 <= batch->count; i += 4) {
+        int32x4_t v = vreinterpretq_s32_u32(dbc_vec_raw<S>(vld1q_u32(&words[i])));
+        vst1q_s32(&out[i], vmlaq_s32(add, v, mul));
+    }
+#endif
+
+    for (; i < batch->count; i++) {
+        out[i] = dbc_word_raw<S>(words[i]) * (int32_t)S::mul + (int32_t)S::add;
+    }
+}
+
+// Raw values of an unsigned signal of up to 8 bits for every frame
+template <typename S>
+static inline void dbc_batch_raw8(const struct dbc_batch* batch, uint8_t* out) {
+    static_assert(S::length <= 8 && !S::is_signed, "raw8 needs an unsigned signal of at most 8 bits");
+
+    const uint32_t* words = dbc_batch_plane<S>(batch);
+    int i = 0;
+
+#if defined(DBC_BATCH_SSE2)
+    for (; i + 4 <= batch->count; i += 4) {
+        __m128i v = dbc_vec_raw<S>(_mm_load_si128((const __m128i*)&words[i]));
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        int32_t packed = _mm_cvtsi128_si32(v);
+        memcpy(&out[i], &packed, 4);
+    }
+#elif defined(DBC_BATCH_NEON)
+    for (; i + 4 <= batch->count; i += 4) {
+        uint16x4_t narrow = vmovn_u32(dbc_vec_raw<S>(vld1q_u32(&words[i])));
+        uint8x8_t bytes = vmovn_u16(vcombine_u16(narrow, narrow));
+        vst1_lane_u32((uint32_t*)&out[i], vreinterpret_u32_u8(bytes), 0);
+    }
+#endif
+
+    for (; i < batch->count; i++) {
+        out[i] = (uint8_t)dbc_word_raw<S>(words[i]);
+    }
+}
+
+// Scalar form of dbc_state_mask() on one 32-bit word
+template <typename First, unsigned Count, unsigned State>
+static inline uint8_t dbc_word_state_mask(uint32_t word) {
+    const uint32_t lanes = (1u << (2 * Count)) - 1;
+    uint32_t fields = (word >> (First::start % 32)) & lanes;
+    uint32_t eq = ~(fields ^ (0x55555555u * State));
+    uint32_t bits = eq & (eq >> 1) & 0x55555555u & lanes;
+    bits = (bits | (bits >> 1)) & 0x33333333u;
+    bits = (bits | (bits >> 2)) & 0x0F0F0F0Fu;
+    bits = (bits | (bits >> 4)) & 0x00FF00FFu;
+    return (uint8_t)bits;
+}
+
+// dbc_state_mask() for every frame: bit i of out[n] is set if 2-bit status
+// signal First+i of frame n equals State (up to 8 consecutive signals)
+template <typename First, unsigned Count, unsigned State>
+static inline void dbc_batch_state_mask(const struct dbc_batch* batch, uint8_t* out) {
+    static_assert(First::length == 2 && !First::big_endian, "state masks need 2-bit Intel signals");
+    static_assert(Count >= 1 && Count <= 8 && First::start % 32 + 2 * Count <= 32,
+                  "batched state signals must lie within one 32-bit word");
+    static_assert(State <= 3, "2-bit state out of range");
+
+    const uint32_t* words = First::start < 32 ? batch->lo : batch->hi;
+    const uint32_t lanes = (1u << (2 * Count)) - 1;
+    const uint32_t pattern = 0x55555555u * State;
+    int i = 0;
+
+#if defined(DBC_BATCH_SSE2)
+    const __m128i vlanes = _mm_set1_epi32((int32_t)(lanes & 0x55555555u));
+    const __m128i vpattern = _mm_set1_epi32((int32_t)~pattern);
+    const __m128i m33 = _mm_set1_epi32(0x33333333);
+    const __m128i m0f = _mm_set1_epi32(0x0F0F0F0F);
+    for (; i + 4 <= batch->count; i += 4) {
+        __m128i v = _mm_srli_epi32(_mm_load_si128((const __m128i*)&words[i]), First::start % 32);
+        __m128i eq = _mm_xor_si128(v, vpattern);
+        __m128i bits = _mm_and_si128(_mm_and_si128(eq, _mm_srli_epi32(eq, 1)), vlanes);
+        bits = _mm_and_si128(_mm_or_si128(bits, _mm_srli_epi32(bits, 1)), m33);
+        bits = _mm_and_si128(_mm_or_si128(bits, _mm_srli_epi32(bits, 2)), m0f);
+        bits = _mm_or_si128(bits, _mm_srli_epi32(bits, 4));
+        // Count <= 8, so the mask is complete in the low byte of each lane
+        bits = _mm_and_si128(bits, _mm_set1_epi32(0xFF));
+        bits = _mm_packus_epi16(_mm_packs_epi32(bits, bits), bits);
+        int32_t packed = _mm_cvtsi128_si32(bits);
+        memcpy(&out[i], &packed, 4);
+    }
+#elif defined(DBC_BATCH_NEON)
+    const uint32x4_t vlanes = vdupq_n_u32(lanes & 0x55555555u);
+    const uint32x4_t vpattern = vdupq_n_u32(~pattern);
+    const int32x4_t start = vdupq_n_s32(-(int)(First::start % 32));
+    for (; i + 4 <= batch->count; i += 4) {
+        uint32x4_t v = vshlq_u32(vld1q_u32(&words[i]), start);
+        uint32x4_t eq = veorq_u32(v, vpattern);
+        uint32x4_t bits = vandq_u32(vandq_u32(eq, vshrq_n_u32(eq, 1)), vlanes);
+        bits = vandq_u32(vorrq_u32(bits, vshrq_n_u32(bits, 1)), vdupq_n_u32(0x33333333));
+        bits = vandq_u32(vorrq_u32(bits, vshrq_n_u32(bits, 2)), vdupq_n_u32(0x0F0F0F0F));
+        bits = vandq_u32(vorrq_u32(bits, vshrq_n_u32(bits, 4)), vdupq_n_u32(0xFF));
+        uint16x4_t narrow = vmovn_u32(bits);
+        uint8x8_t bytes = vmovn_u16(vcombine_u16(narrow, narrow));
+        vst1_lane_u32((uint32_t*)&out[i], vreinterpret_u32_u8(bytes), 0);
+    }
+#endif
+
+    for (; i < batch->count; i++) {
+        out[i] = dbc_word_state_mask<First, Count, State>(words[i]);
+    }
+}
+
+#endif // DBC_BATCH_H
@@ -0,0 +1,113 @@
+/*
+ * Compile-time CAN signal extraction
+ *
+ * Each signal of a DBC message (start bit, length, byte order, sign) becomes
+ * a type whose raw() is a constant shift and mask on the 64-bit payload, so
+ * extraction has no loops or branches. Scaling is done in fixed point when
+ * the DBC factor is a multiple of a power of two (value in units of
+ * 2^-frac_bits), and in float otherwise. The signal types are generated
+ * from j1939.dbc by tools/dbc2h.awk into signals_gen.h.
+ */
+
+#ifndef DBC_SIGNAL_H
+#define DBC_SIGNAL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define DBC_INTEL false         // Little-endian (@1 in DBC)
+#define DBC_MOTOROLA true       // Big-endian (@0 in DBC)
+#define DBC_UNSIGNED false
+#define DBC_SIGNED true
+
+// Load the 8 data bytes of a frame as a little-endian word
+static inline uint64_t dbc_load(const uint8_t* data) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+// Runtime description of a signal (for rules that name signals in text)
+struct dbc_signal_desc {
+    const char* message;
+    const char* name;
+    unsigned start;
+    unsigned length;
+    bool big_endian;
+    bool is_signed;
+    double factor;
+    double offset;
+};
+
+template <unsigned Start, unsigned Len, bool BigEndian, bool Signed>
+struct dbc_signal {
+    static_assert(Len >= 1 && Len <= 64, "signal length out of range");
+
+    static constexpr unsigned start = Start;
+    static constexpr unsigned length = Len;
+    static constexpr bool big_endian = BigEndian;
+    static constexpr bool is_signed = Signed;
+
+    // Motorola start bits name the MSB in sawtooth numbering; convert them to
+    // the LSB position in the byte-swapped word
+    static constexpr unsigned msb = (Start / 8) * 8 + (7 - Start % 8);
+    static constexpr unsigned shift = BigEndian ? 63 - (msb + Len - 1) : Start;
+    static constexpr uint64_t mask = Len == 64 ? ~(uint64_t)0 : ((uint64_t)1 << (Len % 64)) - 1;
+
+    static_assert(BigEndian || Start + Len <= 64, "Intel signal exceeds 8 bytes");
+    static_assert(!BigEndian || msb + Len <= 64, "Motorola signal exceeds 8 bytes");
+
+    // Raw value of the signal (sign-extended for signed signals)
+    static inline int64_t raw(uint64_t payload) {
+        uint64_t word = BigEndian ? __builtin_bswap64(payload) : payload;
+        uint64_t bits = (word >> shift) & mask;
+        if (Signed) {
+            return (int64_t)(bits << (64 - Len)) >> (64 - Len);
+        }
+        return (int64_t)bits;
+    }
+};
+
+// Scaled value in units of 2^-S::frac_bits (only for fixed-point signals)
+template <typename S>
+static inline int64_t dbc_fixed(uint64_t payload) {
+    static_assert(S::fixed, "signal factor/offset not representable in fixed point");
+    return S::raw(payload) * S::mul + S::add;
+}
+
+// Physical value (raw * factor + offset)
+template <typename S>
+static inline float dbc_phys(uint64_t payload) {
+    return (float)S::raw(payload) * (float)S::factor + (float)S::offset;
+}
+
+// Bit mask of the J1939 2-bit status signals First .. First+Count-1 (bit i
+// set if signal i equals State). The signals must be consecutive Intel
+// fields; they are compared in parallel instead of one by one.
+template <typename First, unsigned Count, unsigned State>
+static inline uint32_t dbc_state_mask(uint64_t payload) {
+    static_assert(First::mask == 0x3 && First::shift == First::start && !First::big_endian,
+                  "state masks need 2-bit Intel signals");
+    static_assert(Count >= 1 && Count <= 32 && First::start + 2 * Count <= 64, "state signals exceed 8 bytes");
+    static_assert(State <= 3, "2-bit state out of range");
+
+    const uint64_t lanes = Count == 32 ? ~(uint64_t)0 : ((uint64_t)1 << (2 * Count)) - 1;
+    uint64_t fields = (payload >> First::start) & lanes;
+
+    // Both bits of a lane match the wanted state -> low bit of the lane set
+    uint64_t eq = ~(fields ^ (0x5555555555555555ull * State));
+    uint64_t bits = eq & (eq >> 1) & 0x5555555555555555ull & lanes;
+
+    // Gather the even bits
+    bits = (bits | (bits >> 1)) & 0x3333333333333333ull;
+    bits = (bits | (bits >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    bits = (bits | (bits >> 4)) & 0x00FF00FF00FF00FFull;
+    bits = (bits | (bits >> 8)) & 0x0000FFFF0000FFFFull;
+    bits = (bits | (bits >> 16)) & 0x00000000FFFFFFFFull;
+    return (uint32_t)bits;
+}
+
+#endif // DBC_SIGNAL_H
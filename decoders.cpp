@@ -0,0 +1,215 @@
+/*
+ * J1939 message decoders
+ */
+
+#include <stdio.h>
+#include <strings.h>
+
+#include "decoders.h"
+#include "dispatch.h"
+#include "shm_bus.h"
+#include "signal_store.h"
+#include "signals_gen.h"
+
+// Decoded state per receiving interface. The keypad and TSC1 registrations
+// are bound to one source address, so the interface index is enough to
+// identify the stream; each entry is written by that interface's RX path only.
+static struct keypad_state keypad[MAX_CAN_IFACES];
+static struct tsc1_request tsc1[MAX_CAN_IFACES];
+static struct dm1_state dm1[MAX_CAN_IFACES];
+
+// Button states as last printed by formatKeypadButtons() (logger thread)
+static bool printedStates[8] = {false};
+
+// Pressed-button mask of a keypad payload (BTN0..BTN7 state 01)
+static uint8_t keypadPressed(const unsigned char* data) {
+    return dbc_state_mask<KEYPAD_BTN0, 8, 0x01>(dbc_load(data));
+}
+
+// Decode keypad button data (J1939 format)
+void decodeKeypadButtons(const unsigned char* data, const unsigned char* prev, struct keypad_state* out) {
+    out->pressed = keypadPressed(data);
+    out->changed = out->pressed ^ keypadPressed(prev);
+}
+
+// Unpack the TSC1 fields from the payload
+static void unpackTSC1(const unsigned char* data, struct tsc1_request* req) {
+    uint64_t p = dbc_load(data);
+    
+    req->ctrl_mode = TSC1_OverrideCtrlModes::raw(p);
+    req->speed_rpm = dbc_phys<TSC1_RequestedSpeed>(p);      // RPM
+    req->torque_pct = dbc_fixed<TSC1_RequestedTorque>(p);   // Percent
+    req->priority = TSC1_OverridePriority::raw(p);
+}
+
+// Decode J1939 TSC1 message (Torque/Speed Control)
+void decodeTSC1(const unsigned char* data, struct tsc1_request* out) {
+    unpackTSC1(data, out);
+}
+
+// Decode J1939 DM1: two lamp status bytes, then 4 bytes per DTC. A message
+// without faults carries one all-zero DTC.
+void decodeDM1(const unsigned char* data, unsigned int len, struct dm1_state* out) {
+    out->lamps = data[0];
+    out->num_dtcs = 0;
+    
+    for (unsigned int pos = 2; pos + 4 <= len; pos += 4) {
+        const unsigned char* d = data + pos;
+        uint32_t spn = d[0] | (d[1] << 8) | ((uint32_t)(d[2] >> 5) << 16);
+        uint8_t fmi = d[2] & 0x1F;
+        if ((spn == 0 && fmi == 0) || out->num_dtcs >= DM1_MAX_DTCS) {
+            continue;
+        }
+        out->dtcs[out->num_dtcs].spn = spn;
+        out->dtcs[out->num_dtcs].fmi = fmi;
+        out->dtcs[out->num_dtcs].occurrences = d[3] & 0x7F;
+        out->num_dtcs++;
+    }
+}
+
+void decodeKeypadBatch(const struct dbc_batch* batch, uint8_t* pressed) {
+    dbc_batch_state_mask<KEYPAD_BTN0, 8, 0x01>(batch, pressed);
+}
+
+void decodeTSC1Batch(const struct dbc_batch* batch, struct tsc1_batch* out) {
+    static_assert(TSC1_RequestedSpeed::frac_bits == 3, "speed_q3 expects 0.125 rpm/bit");
+    
+    dbc_batch_raw8<TSC1_OverrideCtrlModes>(batch, out->ctrl_mode);
+    dbc_batch_fixed<TSC1_RequestedSpeed>(batch, out->speed_q3);
+    dbc_batch_fixed<TSC1_RequestedTorque>(batch, out->torque_pct);
+    dbc_batch_raw8<TSC1_OverridePriority>(batch, out->priority);
+    out->count = batch->count;
+}
+
+const struct keypad_state* keypad_state(int iface) {
+    return &keypad[iface];
+}
+
+const struct tsc1_request* last_tsc1_request(int iface) {
+    return &tsc1[iface];
+}
+
+const struct dm1_state* last_dm1(int iface) {
+    return &dm1[iface];
+}
+
+int formatKeypadButtons(const unsigned char* data, char* buf, size_t size) {
+    uint8_t pressedMask = keypadPressed(data);
+    int len = snprintf(buf, size, "  Keypad Buttons: ");
+    
+    for (int i = 0; i < 8 && len < (int)size; i++) {
+        bool pressed = (pressedMask >> i) & 1;
+        bool changed = (pressed != printedStates[i]);
+        printedStates[i] = pressed;
+        
+        // Asterisk indicates state change
+        if (pressed) {
+            len += snprintf(buf + len, size - len, "[BTN%d:PRESSED]%s ", i, changed ? "*" : "");
+        }
+    }
+    if (len < (int)size) {
+        len += snprintf(buf + len, size - len, "\n");
+    }
+    return len;
+}
+
+int formatTSC1(const unsigned char* data, char* buf, size_t size) {
+    struct tsc1_request req;
+    
+    unpackTSC1(data, &req);
+    return snprintf(buf, size, "  TSC1: Speed=%.1f RPM, Torque=%d%%, Priority=%d, CtrlMode=0x%02X\n",
+                    req.speed_rpm, req.torque_pct, req.priority, req.ctrl_mode);
+}
+
+int formatDM1(const unsigned char* data, unsigned int len, char* buf, size_t size) {
+    struct dm1_state state;
+    
+    decodeDM1(data, len, &state);
+    int n = snprintf(buf, size, "  DM1: Lamps=0x%02X, %d DTC%s", state.lamps, state.num_dtcs,
+                     state.num_dtcs == 1 ? "" : "s");
+    for (int i = 0; i < state.num_dtcs && n < (int)size; i++) {
+        n += snprintf(buf + n, size - n, " [SPN %u FMI %u OC %u]", state.dtcs[i].spn,
+                      state.dtcs[i].fmi, state.dtcs[i].occurrences);
+    }
+    if (n < (int)size) {
+        n += snprintf(buf + n, size - n, "\n");
+    }
+    return n;
+}
+
+// Decoders only run when the signal store saw a new payload
+static void on_keypad(const struct j1939_msg* msg) {
+    const unsigned char* prev = msg->signal != NULL ? msg->signal->prev : msg->data;
+    decodeKeypadButtons(msg->data, prev, &keypad[msg->iface]);
+    shm_bus_publish_signal(msg->ts_ns, msg->iface, SHM_BUS_KEYPAD, &keypad[msg->iface], sizeof(keypad[0]));
+}
+
+static void on_tsc1(const struct j1939_msg* msg) {
+    decodeTSC1(msg->data, &tsc1[msg->iface]);
+    shm_bus_publish_signal(msg->ts_ns, msg->iface, SHM_BUS_TSC1, &tsc1[msg->iface], sizeof(tsc1[0]));
+}
+
+static void on_dm1(const struct j1939_msg* msg) {
+    decodeDM1(msg->data, msg->len, &dm1[msg->iface]);
+    dm1[msg->iface].sa = msg->sa;
+    shm_bus_publish_signal(msg->ts_ns, msg->iface, SHM_BUS_DM1, &dm1[msg->iface], sizeof(dm1[0]));
+}
+
+static int format_keypad(const struct j1939_msg* msg, char* buf, size_t size) {
+    return formatKeypadButtons(msg->data, buf, size);
+}
+
+static int format_tsc1(const struct j1939_msg* msg, char* buf, size_t size) {
+    return formatTSC1(msg->data, buf, size);
+}
+
+static int format_dm1(const struct j1939_msg* msg, char* buf, size_t size) {
+    return formatDM1(msg->data, msg->len, buf, size);
+}
+
+int register_decoder_id(int id) {
+    switch (id) {
+    case DECODER_KEYPAD:
+        return dispatch_register(PGN_KEYPAD, SA_KEYPAD, J1939_ANY_ADDR, KEYPAD_MIN_LEN, on_keypad, format_keypad, "keypad");
+    case DECODER_TSC1:
+        return dispatch_register(PGN_TSC1, SA_TSC1, DA_TSC1, TSC1_MIN_LEN, on_tsc1, format_tsc1, "TSC1");
+    case DECODER_DM1:
+        return dispatch_register(PGN_DM1, J1939_ANY_ADDR, J1939_ANY_ADDR, DM1_MIN_LEN, on_dm1, format_dm1, "DM1");
+    }
+    return -1;
+}
+
+int register_decoder(const char* name) {
+    if (strcasecmp(name, "keypad") == 0) {
+        return register_decoder_id(DECODER_KEYPAD);
+    }
+    if (strcasecmp(name, "TSC1") == 0) {
+        return register_decoder_id(DECODER_TSC1);
+    }
+    if (strcasecmp(name, "DM1") == 0) {
+        return register_decoder_id(DECODER_DM1);
+    }
+    fprintf(stderr, "Unknown decoder '%s' (keypad, TSC1, DM1)\n", name);
+    return -1;
+}
+
+void decoder_run(int id, const struct j1939_msg* msg) {
+    switch (id) {
+    case DECODER_KEYPAD:
+        on_keypad(msg);
+        break;
+    case DECODER_TSC1:
+        on_tsc1(msg);
+        break;
+    case DECODER_DM1:
+        on_dm1(msg);
+        break;
+    }
+}
+
+int register_decoders(void) {
+    if (register_decoder("keypad") < 0 || register_decoder("TSC1") < 0 || register_decoder("DM1") < 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * J1939 message decoders
+ *
+ * Signal layouts come from j1939.dbc (see dbc_signal.h). Payload pointers
+ * must reference the full 8 data bytes of a frame.
+ */
+
+#ifndef DECODERS_H
+#define DECODERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can_iface.h"
+#include "dbc_batch.h"
+
+// CAN ID for keypad messages
+#define CAN_ID_KEYPAD 0x18FF0280
+
+// CAN ID for J1939 TSC1 (Torque/Speed Control)
+#define CAN_ID_TSC1 0x0C000003
+
+// J1939 PGN and source address of the keypad messages
+#define PGN_KEYPAD 0xFF02
+#define SA_KEYPAD 0x80
+
+// J1939 PGN, source and destination address (engine #1) of TSC1. TSC1 is
+// PDU1: the registration matches all three, so requests to other
+// destinations are neither decoded nor cached. The priority is not checked,
+// as J1939 lets a sender change it (CAN_ID_TSC1 is priority 3).
+#define PGN_TSC1 0x0000
+#define SA_TSC1 0x03
+#define DA_TSC1 0x00
+
+// J1939 DM1 (active diagnostic trouble codes), from any source address.
+// More than one DTC is sent with the transport protocol.
+#define PGN_DM1 0xFECA
+#define DM1_MIN_LEN 6
+#define DM1_MAX_DTCS 16
+
+// Decoders by identifier (fixed topology build, see topology.h)
+enum decoder_id {
+    DECODER_KEYPAD,
+    DECODER_TSC1,
+    DECODER_DM1
+};
+
+struct j1939_msg;
+
+// Keypad button state, one bit per button (bit i = BTN i)
+struct keypad_state {
+    uint8_t pressed;        // Buttons currently pressed
+    uint8_t changed;        // Buttons that changed with the last message
+};
+
+// Decoded TSC1 request
+struct tsc1_request {
+    float speed_rpm;        // Requested speed/speed limit
+    int16_t torque_pct;     // Requested torque/torque limit
+    uint8_t priority;       // Override control mode priority
+    uint8_t ctrl_mode;      // Override control modes
+};
+
+// One J1939-73 diagnostic trouble code
+struct j1939_dtc {
+    uint32_t spn;           // Suspect parameter number (19 bits)
+    uint8_t fmi;            // Failure mode identifier
+    uint8_t occurrences;
+};
+
+// Decoded DM1 message
+struct dm1_state {
+    uint8_t sa;             // Source address of the message
+    uint8_t lamps;          // Lamp status byte (MIL, red stop, amber warning, protect)
+    int num_dtcs;           // Active DTCs, at most DM1_MAX_DTCS are kept
+    struct j1939_dtc dtcs[DM1_MAX_DTCS];
+};
+
+// Decode keypad button data (J1939 format). prev is the previous payload
+// of the same stream (used for the changed mask).
+void decodeKeypadButtons(const unsigned char* data, const unsigned char* prev, struct keypad_state* out);
+
+// Decode J1939 TSC1 message (Torque/Speed Control)
+void decodeTSC1(const unsigned char* data, struct tsc1_request* out);
+
+// Decode a DM1 payload of len bytes (single frame or reassembled)
+void decodeDM1(const unsigned char* data, unsigned int len, struct dm1_state* out);
+
+// TSC1 requests of a batch of frames, one array per field
+struct tsc1_batch {
+    alignas(16) int32_t speed_q3[DBC_BATCH_MAX];    // Requested speed in 0.125 rpm units
+    alignas(16) int32_t torque_pct[DBC_BATCH_MAX];
+    uint8_t priority[DBC_BATCH_MAX];
+    uint8_t ctrl_mode[DBC_BATCH_MAX];
+    int count;
+};
+
+// Pressed-button masks (struct keypad_state::pressed) of a batch of keypad
+// payloads, decoded with SIMD where available. The batch decoders are not
+// called from the RX pipeline (see dbc_batch.h).
+void decodeKeypadBatch(const struct dbc_batch* batch, uint8_t* pressed);
+
+// Decode a batch of TSC1 payloads in one pass
+void decodeTSC1Batch(const struct dbc_batch* batch, struct tsc1_batch* out);
+
+// Keypad state last decoded on an interface (only updated on change)
+const struct keypad_state* keypad_state(int iface);
+
+// Last TSC1 request decoded on an interface (only updated on change)
+const struct tsc1_request* last_tsc1_request(int iface);
+
+// Last DM1 decoded on an interface (any source address)
+const struct dm1_state* last_dm1(int iface);
+
+// Text formatters used by the logger thread (not called on the RX path).
+// Return the number of characters written, like snprintf().
+int formatKeypadButtons(const unsigned char* data, char* buf, size_t size);
+int formatTSC1(const unsigned char* data, char* buf, size_t size);
+int formatDM1(const unsigned char* data, unsigned int len, char* buf, size_t size);
+
+// Register one decoder by name (keypad, TSC1 or DM1, any case) with the
+// PGN dispatch table. Returns 0 or -1.
+int register_decoder(const char* name);
+
+// Register one decoder by identifier. Returns 0 or -1.
+int register_decoder_id(int id);
+
+// Run a decoder on a message that passed its registration's checks, with
+// a direct call (fixed topology build)
+void decoder_run(int id, const struct j1939_msg* msg);
+
+// Register all decoders
+int register_decoders(void);
+
+#endif // DECODERS_H
@@ -0,0 +1,205 @@
+/*
+ * J1939 PGN dispatch table
+ */
+
+#include <stdio.h>
+
+#include "dispatch.h"
+#include "clock_util.h"
+#include "j1939_tp.h"
+#include "signal_store.h"
+#include "topology.h"
+#include "usdt.h"
+
+#define DISPATCH_TABLE_MASK (DISPATCH_TABLE_SIZE - 1)
+
+// Empty slot marker (no valid key has bit 31 set)
+#define DISPATCH_EMPTY 0xFFFFFFFFu
+
+struct dispatch_entry {
+    uint32_t key;           // (PGN << 8) | source address
+    uint8_t da;             // Destination address, J1939_ANY_ADDR for all
+    unsigned int min_len;
+    pgn_decoder_fn fn;
+    pgn_format_fn format;
+    const char* name;
+};
+
+static struct dispatch_entry table[DISPATCH_TABLE_SIZE];
+static bool table_ready = false;
+static int num_decoders = 0;
+
+// Longest probe sequence of any registered key; lookups never go further
+static unsigned int max_probe = 0;
+
+static inline uint32_t make_key(uint32_t pgn, uint8_t sa) {
+    return ((pgn & 0x3FFFF) << 8) | sa;
+}
+
+// Fibonacci hashing of the 26-bit key
+static inline unsigned int hash_key(uint32_t key) {
+    return (key * 2654435769u) >> (32 - DISPATCH_TABLE_BITS);
+}
+
+static void table_init(void) {
+    for (int i = 0; i < DISPATCH_TABLE_SIZE; i++) {
+        table[i].key = DISPATCH_EMPTY;
+    }
+    table_ready = true;
+}
+
+static const struct dispatch_entry* lookup(uint32_t key) {
+    unsigned int slot = hash_key(key);
+
+    for (unsigned int probe = 0; probe <= max_probe; probe++) {
+        const struct dispatch_entry* e = &table[(slot + probe) & DISPATCH_TABLE_MASK];
+        if (e->key == key) {
+            return e;
+        }
+        if (e->key == DISPATCH_EMPTY) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+int dispatch_register(uint32_t pgn, uint8_t sa, uint8_t da, unsigned int min_len,
+                      pgn_decoder_fn fn, pgn_format_fn format, const char* name) {
+    if (!table_ready) {
+        table_init();
+    }
+    if (num_decoders >= DISPATCH_MAX_DECODERS) {
+        fprintf(stderr, "Dispatch table full, cannot register %s\n", name);
+        return -1;
+    }
+    // PDU2 PGNs have no destination
+    if (da != J1939_ANY_ADDR && ((pgn >> 8) & 0xFF) >= 240) {
+        fprintf(stderr, "PGN 0x%05X of %s has no destination address\n", pgn, name);
+        return -1;
+    }
+
+    uint32_t key = make_key(pgn, sa);
+    unsigned int slot = hash_key(key);
+    unsigned int probe = 0;
+
+    while (table[(slot + probe) & DISPATCH_TABLE_MASK].key != DISPATCH_EMPTY) {
+        if (table[(slot + probe) & DISPATCH_TABLE_MASK].key == key) {
+            fprintf(stderr, "Decoder for PGN 0x%05X SA 0x%02X already registered\n", pgn, sa);
+            return -1;
+        }
+        probe++;
+    }
+
+    struct dispatch_entry* e = &table[(slot + probe) & DISPATCH_TABLE_MASK];
+    e->key = key;
+    e->da = da;
+    e->min_len = min_len;
+    e->fn = fn;
+    e->format = format;
+    e->name = name;
+    if (probe > max_probe) {
+        max_probe = probe;
+    }
+    num_decoders++;
+    return 0;
+}
+
+// Find the entry for a message: exact source address first, then the
+// wildcard registration. The destination address is checked here so that
+// messages to other nodes never reach the signal store.
+static const struct dispatch_entry* find_entry(const struct j1939_msg* msg) {
+    if (!table_ready) {
+        return NULL;
+    }
+
+    const struct dispatch_entry* e = lookup(make_key(msg->pgn, msg->sa));
+    if (e == NULL) {
+        e = lookup(make_key(msg->pgn, J1939_ANY_ADDR));
+    }
+    if (e == NULL || msg->len < e->min_len || (e->da != J1939_ANY_ADDR && e->da != msg->da)) {
+        return NULL;
+    }
+    return e;
+}
+
+int dispatch_message(const struct j1939_msg* msg) {
+#ifdef CAN_BRIDGE_TOPOLOGY
+    // Compiled-in decoders: no table lookup, no indirect call
+    int decoder = topology_decoder(msg->pgn, msg->sa, msg->da, msg->len);
+    bool found = decoder >= 0;
+#else
+    const struct dispatch_entry* e = find_entry(msg);
+    bool found = e != NULL;
+#endif
+    if (!found) {
+        return 0;
+    }
+
+    // Repeated payloads stop here: no decode, no signals published
+    bool changed;
+    struct j1939_msg m = *msg;
+    m.signal = signal_store_update(msg, &changed);
+    if (!changed) {
+        return 0;
+    }
+
+    PROBE3(decode, m.iface, m.pgn, m.sa);
+#ifdef CAN_BRIDGE_TOPOLOGY
+    decoder_run(decoder, &m);
+#else
+    e->fn(&m);
+#endif
+    PROBE2(decode_end, m.iface, m.pgn);
+    return 1;
+}
+
+bool dispatch_wants(uint32_t pgn, uint8_t sa) {
+    return table_ready && (lookup(make_key(pgn, sa)) != NULL ||
+                           lookup(make_key(pgn, J1939_ANY_ADDR)) != NULL);
+}
+
+int dispatch_frame(const struct canfd_frame* frame, int iface, uint64_t ts_ns) {
+    struct j1939_msg msg;
+
+    PROBE2(dispatch, iface, frame->can_id);
+    // J1939 only uses 29-bit data frames
+    if ((frame->can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_ERR_FLAG)) != CAN_EFF_FLAG) {
+        return 0;
+    }
+
+    j1939_from_frame(&msg, frame, iface, ts_ns);
+    if (j1939_tp_pgn(msg.pgn)) {
+        return j1939_tp_receive(&msg, monotonic_ns());
+    }
+    return dispatch_message(&msg);
+}
+
+int dispatch_format(const struct canfd_frame* frame, int iface, char* buf, size_t size) {
+    struct j1939_msg msg;
+
+    if ((frame->can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_ERR_FLAG)) != CAN_EFF_FLAG) {
+        return 0;
+    }
+
+    j1939_from_frame(&msg, frame, iface, 0);
+    const struct dispatch_entry* e = find_entry(&msg);
+    if (e == NULL || e->format == NULL) {
+        return 0;
+    }
+    return e->format(&msg, buf, size);
+}
+
+int dispatch_count(void) {
+    return num_decoders;
+}
+
+void dispatch_foreach(dispatch_visit_fn fn, void* ctx) {
+    if (!table_ready) {
+        return;
+    }
+    for (int i = 0; i < DISPATCH_TABLE_SIZE; i++) {
+        if (table[i].key != DISPATCH_EMPTY) {
+            fn(table[i].key >> 8, table[i].key & 0xFF, table[i].da, ctx);
+        }
+    }
+}
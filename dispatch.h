@@ -0,0 +1,104 @@
+/*
+ * J1939 PGN dispatch table
+ *
+ * Decoders register for a PGN (optionally restricted to one source address,
+ * and for PDU1 PGNs to one destination address) at startup. Lookups hash the (PGN, source address) key into a fixed
+ * open-addressing table, so the cost per frame does not depend on how many
+ * decoders are registered.
+ */
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+
+// Number of hash slots (power of two, kept at most half full)
+#define DISPATCH_TABLE_BITS 8
+#define DISPATCH_TABLE_SIZE (1 << DISPATCH_TABLE_BITS)
+#define DISPATCH_MAX_DECODERS (DISPATCH_TABLE_SIZE / 2)
+
+// Source/destination address wildcard for registrations
+#define J1939_ANY_ADDR 0xFF
+
+struct signal_entry;
+
+// J1939 message as seen by a decoder
+struct j1939_msg {
+    uint32_t pgn;
+    uint8_t priority;
+    uint8_t sa;             // Source address
+    uint8_t da;             // Destination address (0xFF for PDU2/broadcast)
+    int iface;              // Index of the receiving interface
+    const uint8_t* data;    // 8 bytes readable, up to 64 for FD frames
+    unsigned int len;
+    uint64_t ts_ns;         // RX time (CLOCK_REALTIME ns) of the frame, or of the
+                            // last packet of a transfer; 0 if unknown
+    const struct signal_entry* signal;  // Cached stream state, set by dispatch_message()
+};
+
+typedef void (*pgn_decoder_fn)(const struct j1939_msg* msg);
+
+// Optional text formatter, used off the RX path for verbose logging
+typedef int (*pgn_format_fn)(const struct j1939_msg* msg, char* buf, size_t size);
+
+// Extract the PGN from a 29-bit identifier (PDU1 PGNs drop the DA byte)
+static inline uint32_t j1939_pgn(canid_t id) {
+    uint32_t pgn = (id >> 8) & 0x3FFFF;
+    if (((pgn >> 8) & 0xFF) < 240) {
+        pgn &= 0x3FF00;
+    }
+    return pgn;
+}
+
+// Fill a j1939_msg from an extended CAN or CAN-FD frame
+static inline void j1939_from_frame(struct j1939_msg* msg, const struct canfd_frame* frame, int iface,
+                                    uint64_t ts_ns) {
+    canid_t id = frame->can_id & CAN_EFF_MASK;
+    msg->pgn = j1939_pgn(id);
+    msg->priority = (id >> 26) & 0x07;
+    msg->sa = id & 0xFF;
+    msg->da = (((id >> 16) & 0xFF) < 240) ? (id >> 8) & 0xFF : 0xFF;
+    msg->iface = iface;
+    msg->data = frame->data;
+    msg->len = can_frame_len(frame);
+    msg->ts_ns = ts_ns;
+    msg->signal = NULL;
+}
+
+// Register a decoder for a PGN. sa and da may be J1939_ANY_ADDR (da has to be
+// for PDU2 PGNs); messages to another destination or shorter than min_len
+// are not passed to the decoder or the signal store. format may be NULL.
+// Returns 0 on success, -1 if the key is already taken or the table is full.
+int dispatch_register(uint32_t pgn, uint8_t sa, uint8_t da, unsigned int min_len,
+                      pgn_decoder_fn fn, pgn_format_fn format, const char* name);
+
+// Record the message in the signal store and, if its payload changed, run
+// the decoder registered for it.
+// Returns 1 if a decoder ran, 0 otherwise (no decoder or a repeated payload).
+int dispatch_message(const struct j1939_msg* msg);
+
+// True if a decoder takes messages of this PGN and source address (used to
+// skip reassembling unwanted transfers)
+bool dispatch_wants(uint32_t pgn, uint8_t sa);
+
+// Decode an extended CAN frame received on an interface at ts_ns
+// (CLOCK_REALTIME, 0 if unknown). Transport protocol frames go to the J1939
+// TP reassembly, which dispatches complete messages.
+int dispatch_frame(const struct canfd_frame* frame, int iface, uint64_t ts_ns);
+
+// Format a frame with the formatter registered for its PGN.
+// Returns the number of characters written, 0 if there is no formatter.
+int dispatch_format(const struct canfd_frame* frame, int iface, char* buf, size_t size);
+
+// Number of registered decoders
+int dispatch_count(void);
+
+// Call fn for every registration (used to derive kernel filters)
+typedef void (*dispatch_visit_fn)(uint32_t pgn, uint8_t sa, uint8_t da, void* ctx);
+void dispatch_foreach(dispatch_visit_fn fn, void* ctx);
+
+#endif // DISPATCH_H
@@ -0,0 +1,73 @@
+/*
+ * epoll based event loop
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/epoll.h>
+
+#include "event_loop.h"
+#include "health.h"
+#include "usdt.h"
+
+int event_loop_init(struct event_loop* loop) {
+    loop->running = 1;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        perror("Error creating epoll instance");
+        return -1;
+    }
+    return 0;
+}
+
+int event_loop_add(struct event_loop* loop, struct event_source* src, uint32_t events) {
+    struct epoll_event ev;
+
+    ev.events = events | EPOLLET;
+    ev.data.ptr = src;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0) {
+        perror("Error registering file descriptor with epoll");
+        return -1;
+    }
+    return 0;
+}
+
+int event_loop_run(struct event_loop* loop) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    while (loop->running) {
+        // No timeout: shutdown requests arrive as events (signalfd)
+        int n = epoll_wait(loop->epfd, events, EVENT_LOOP_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait error");
+            return -1;
+        }
+        PROBE1(loop_wakeup, n);
+
+        uint64_t start = health_loop_begin();
+        for (int i = 0; i < n; i++) {
+            struct event_source* src = (struct event_source*)events[i].data.ptr;
+            src->handler(src, events[i].events);
+        }
+        health_loop_end(start);
+    }
+
+    return 0;
+}
+
+void event_loop_stop(struct event_loop* loop) {
+    loop->running = 0;
+}
+
+void event_loop_close(struct event_loop* loop) {
+    if (loop->epfd >= 0) {
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+}
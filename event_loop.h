@@ -0,0 +1,50 @@
+/*
+ * epoll based event loop
+ *
+ * File descriptors are registered once (edge-triggered) together with a
+ * handler; each wakeup only touches the descriptors that are ready, so the
+ * cost per wakeup does not grow with the number of registered interfaces.
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <signal.h>
+
+// Maximum number of events handled per epoll_wait() call
+#define EVENT_LOOP_MAX_EVENTS 16
+
+struct event_source;
+
+typedef void (*event_handler_fn)(struct event_source* src, uint32_t events);
+
+// A registered file descriptor and the handler that services it
+struct event_source {
+    int fd;
+    event_handler_fn handler;
+    void* ctx;
+};
+
+struct event_loop {
+    int epfd;
+    volatile sig_atomic_t running;
+};
+
+// Create the epoll instance. Returns 0 on success, -1 on error.
+int event_loop_init(struct event_loop* loop);
+
+// Register a source for the given epoll events (EPOLLET is added).
+// The source must stay valid while the loop runs.
+int event_loop_add(struct event_loop* loop, struct event_source* src, uint32_t events);
+
+// Dispatch events until event_loop_stop() is called. Returns 0 on a clean
+// stop, -1 if epoll_wait() fails.
+int event_loop_run(struct event_loop* loop);
+
+// Make event_loop_run() return after the current batch of events
+void event_loop_stop(struct event_loop* loop);
+
+void event_loop_close(struct event_loop* loop);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,610 @@
+/*
+ * CAN frame forwarding engine
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "forward.h"
+#include "rewrite.h"
+#include "latency.h"
+#include "stats.h"
+#include "clock_util.h"
+#include "topology.h"
+#include "usdt.h"
+
+#define FWD_RING_MASK (FWD_RING_SIZE - 1)
+
+// Queued frame with the timestamps needed for latency accounting
+struct fwd_slot {
+    struct canfd_frame frame;
+    uint64_t wire_ts;
+    uint64_t user_ts;
+    int src;
+};
+
+// Bounded ring of one priority level
+struct fwd_queue {
+    struct fwd_slot ring[FWD_RING_SIZE];
+    unsigned int head;          // Next slot to fill
+    unsigned int tail;          // Next slot to send
+};
+
+// Destination interface with its pending TX queues
+struct fwd_dest {
+    int sock;                   // -1 when the interface is not a destination
+    bool sink;                  // No socket: frames are counted as sent
+    bool fd;                    // Interface accepts CAN-FD frames
+    const char* name;
+    struct fwd_queue queues[FWD_PRIO_LEVELS];
+    unsigned int queued;        // Frames in all levels
+    bool blocked;               // Waiting for EPOLLOUT or the retry timer
+    bool link_down;             // Bus-off or link down: frames wait in the ring
+    struct fwd_dest_stats stats;
+};
+
+// Routing table with the route indices grouped by source interface for
+// fast lookup. A table is immutable once it is active.
+struct fwd_table {
+    struct fwd_route routes[FWD_MAX_ROUTES];
+    int num_routes;
+    int src_routes[FWD_MAX_DESTS][FWD_MAX_ROUTES];
+    int src_route_count[FWD_MAX_DESTS];
+};
+
+// The active table and the one the next forward_set_routes() builds. The
+// readers (forward_frame(), the filter build) run on the event loop thread
+// like the reloads, so a replaced table is out of use once the swap is done.
+static struct fwd_table tables[2];
+static struct fwd_table* active = &tables[0];
+
+static struct fwd_dest dests[FWD_MAX_DESTS];
+
+// Token bucket of each route of the active table, as nanoseconds of credit
+struct fwd_bucket {
+    uint64_t credit_ns;
+    uint64_t last_ns;
+};
+
+static struct fwd_bucket buckets[FWD_MAX_ROUTES];
+
+// What a frame admitted by limit_admit() takes once it is queued
+struct fwd_admit {
+    struct fwd_stream* stream;  // On-change stream to update, NULL if none
+    uint64_t data;
+    struct fwd_bucket* bucket;  // Bucket to take cost from, NULL if no rate
+    uint64_t cost;
+};
+
+// Last forwarded payload of a stream on an on-change route
+struct fwd_stream {
+    uint32_t can_id;
+    uint16_t route;         // Route index + 1, 0 while the slot is unused
+    uint8_t len;
+    uint64_t data;
+    uint64_t last_ns;
+};
+
+#define FWD_STREAM_MASK (FWD_STREAM_SLOTS - 1)
+#define FWD_STREAM_PROBES 8
+
+static struct fwd_stream streams[FWD_STREAM_SLOTS];
+
+// Destinations with queued frames (bit per interface index)
+static uint32_t pending_mask = 0;
+
+static struct event_source retry_ev;
+static bool retry_armed = false;
+
+static void on_retry_timer(struct event_source* src, uint32_t events) {
+    uint64_t expirations;
+    (void)events;
+
+    while (read(src->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {
+    }
+
+    retry_armed = false;
+    for (int i = 0; i < FWD_MAX_DESTS; i++) {
+        dests[i].blocked = false;
+    }
+    forward_flush();
+}
+
+static void arm_retry_timer(void) {
+    struct itimerspec its;
+
+    if (retry_armed) {
+        return;
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = FWD_RETRY_NS;
+    if (timerfd_settime(retry_ev.fd, 0, &its, NULL) == 0) {
+        retry_armed = true;
+    }
+}
+
+int forward_init(struct event_loop* loop) {
+    memset(dests, 0, sizeof(dests));
+    for (int i = 0; i < FWD_MAX_DESTS; i++) {
+        dests[i].sock = -1;
+    }
+    memset(tables, 0, sizeof(tables));
+    active = &tables[0];
+    pending_mask = 0;
+
+    retry_ev.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (retry_ev.fd < 0) {
+        perror("Error creating forwarding retry timer");
+        return -1;
+    }
+    retry_ev.handler = on_retry_timer;
+    retry_ev.ctx = NULL;
+
+    return event_loop_add(loop, &retry_ev, EPOLLIN);
+}
+
+int forward_set_dest(int index, int sock, const char* name, bool fd) {
+    if (index < 0 || index >= FWD_MAX_DESTS) {
+        return -1;
+    }
+    dests[index].sock = sock;
+    dests[index].sink = false;
+    dests[index].fd = fd;
+    dests[index].name = name;
+    return 0;
+}
+
+int forward_set_sink(int index, const char* name) {
+    if (forward_set_dest(index, -1, name, true) < 0) {
+        return -1;
+    }
+    dests[index].sink = true;
+    return 0;
+}
+
+static int table_add(struct fwd_table* table, const struct fwd_route* add) {
+    int src = add->src;
+    int dst = add->dst;
+
+    if (src < 0 || src >= FWD_MAX_DESTS || dst < 0 || dst >= FWD_MAX_DESTS) {
+        fprintf(stderr, "Invalid route %d -> %d\n", src, dst);
+        return -1;
+    }
+    if (table->num_routes >= FWD_MAX_ROUTES) {
+        fprintf(stderr, "Routing table full\n");
+        return -1;
+    }
+
+    struct fwd_route* route = &table->routes[table->num_routes];
+    *route = *add;
+    route->id = add->id & add->mask;
+    table->src_routes[src][table->src_route_count[src]++] = table->num_routes;
+    table->num_routes++;
+    return 0;
+}
+
+int forward_set_routes(const struct fwd_route* routes, int count) {
+    struct fwd_table* next = active == &tables[0] ? &tables[1] : &tables[0];
+
+#ifdef CAN_BRIDGE_TOPOLOGY
+    // forward_frame() routes with the compiled-in copy of this table
+    bool same = count == TOPOLOGY_NUM_ROUTES;
+    for (int i = 0; same && i < count; i++) {
+        const struct fwd_route* a = &routes[i];
+        const struct fwd_route* b = &topology_routes[i];
+        same = a->src == b->src && a->id == b->id && a->mask == b->mask && a->dst == b->dst &&
+               a->limit.rate == b->limit.rate && a->limit.burst == b->limit.burst &&
+               a->limit.on_change == b->limit.on_change && a->limit.refresh_ms == b->limit.refresh_ms;
+    }
+    if (!same) {
+        fprintf(stderr, "Routes are fixed by the topology of this build\n");
+        return -1;
+    }
+#endif
+    next->num_routes = 0;
+    memset(next->src_route_count, 0, sizeof(next->src_route_count));
+    for (int i = 0; i < count; i++) {
+        if (table_add(next, &routes[i]) < 0) {
+            return -1;
+        }
+    }
+    __atomic_store_n(&active, next, __ATOMIC_RELEASE);
+
+    // Route indices changed meaning; the old table is out of use
+    memset(buckets, 0, sizeof(buckets));
+    memset(streams, 0, sizeof(streams));
+    return 0;
+}
+
+int forward_route_count(void) {
+    return active->num_routes;
+}
+
+const struct fwd_route* forward_routes(int* count) {
+    *count = active->num_routes;
+    return active->routes;
+}
+
+// Find or add the stream of a frame on an on-change route. NULL if its
+// probe sequence is full (the frame then counts as changed).
+static struct fwd_stream* find_stream(int index, canid_t can_id) {
+    uint32_t hash = (can_id * 0x9E3779B1u) ^ ((uint32_t)index * 0x85EBCA6Bu);
+
+    for (int probe = 0; probe < FWD_STREAM_PROBES; probe++) {
+        struct fwd_stream* s = &streams[(hash + probe) & FWD_STREAM_MASK];
+        if (s->route == 0) {
+            s->route = index + 1;
+            s->can_id = can_id;
+            s->len = 0xFF;      // Never matches: the first frame is a change
+            return s;
+        }
+        if (s->route == index + 1 && s->can_id == can_id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// Apply a route's limits to a frame at time now (ns). Returns true if it
+// may be forwarded; nothing is taken until limit_commit() once the frame
+// is queued, so a frame dropped later (rule, full queue) leaves its change
+// pending and its token unused.
+static bool limit_admit(int index, const struct fwd_route* route, const struct canfd_frame* frame,
+                        uint64_t now, struct fwd_dest_stats* st, struct fwd_admit* admit) {
+    const struct fwd_limit* limit = &route->limit;
+
+    admit->stream = NULL;
+    admit->data = 0;
+    admit->bucket = NULL;
+
+    // Repeats are dropped before they use up tokens
+    if (limit->on_change) {
+        admit->stream = find_stream(index, frame->can_id);
+        if (admit->stream != NULL && frame->len <= 8) {
+            const struct fwd_stream* s = admit->stream;
+            memcpy(&admit->data, frame->data, frame->len);
+            bool fresh = limit->refresh_ms > 0 && now - s->last_ns >= limit->refresh_ms * 1000000ull;
+            if (s->len == frame->len && s->data == admit->data && !fresh) {
+                st->unchanged++;
+                return false;
+            }
+        }
+    }
+
+    if (limit->rate > 0) {
+        struct fwd_bucket* b = &buckets[index];
+        uint64_t cost = 1000000000ull / limit->rate;
+        uint64_t depth = cost * (limit->burst > 0 ? limit->burst : 1);
+
+        if (b->last_ns == 0) {
+            b->credit_ns = depth;
+        }
+        else if (now > b->last_ns) {
+            b->credit_ns += now - b->last_ns;
+            if (b->credit_ns > depth) {
+                b->credit_ns = depth;
+            }
+        }
+        b->last_ns = now;
+        if (b->credit_ns < cost) {
+            st->rate_limited++;
+            return false;
+        }
+        admit->bucket = b;
+        admit->cost = cost;
+    }
+    return true;
+}
+
+// Take what an admitted frame uses once it is queued. Only frames that go
+// out update the stream, so a change held back by the rate limit or a full
+// queue is still a change next time.
+static void limit_commit(const struct fwd_admit* admit, const struct canfd_frame* frame, uint64_t now) {
+    if (admit->bucket != NULL) {
+        admit->bucket->credit_ns -= admit->cost;
+    }
+    if (admit->stream != NULL) {
+        admit->stream->len = frame->len <= 8 ? frame->len : 0xFF;
+        admit->stream->data = admit->data;
+        admit->stream->last_ns = now;
+    }
+}
+
+// Queue a frame that matched route index, unless its destination already
+// has it (matched) or the route's limits hold it back
+static inline __attribute__((always_inline))
+void queue_route(int index, const struct fwd_route* route, int src, const struct canfd_frame* frame,
+                 uint64_t wire_ts, uint64_t user_ts, uint32_t* matched) {
+    struct canfd_frame rewritten;
+    struct fwd_admit admit;
+
+    // Queue each frame at most once per destination
+    uint32_t bit = 1u << route->dst;
+    if (*matched & bit) {
+        return;
+    }
+    *matched |= bit;
+
+    struct fwd_dest* dest = &dests[route->dst];
+    if (dest->sock < 0 && !dest->sink) {
+        return;
+    }
+    if (!dest->fd && can_frame_is_fd(frame)) {
+        dest->stats.tx_errors++;
+        return;
+    }
+    bool limited = route->limit.rate > 0 || route->limit.on_change;
+    if (limited && !limit_admit(index, route, frame, user_ts, &dest->stats, &admit)) {
+        return;
+    }
+
+    // Rules may change the priority, so they run before the level is known
+    const struct canfd_frame* out = frame;
+    if (rewrite_dests & bit) {
+        memcpy(&rewritten, frame, can_frame_mtu(frame));
+        if (!rewrite_run(route->dst, &rewritten)) {
+            dest->stats.rule_drops++;
+            return;
+        }
+        out = &rewritten;
+    }
+
+    int level = fwd_prio_level(out->can_id);
+    struct fwd_queue* q = &dest->queues[level];
+    unsigned int depth = q->head - q->tail;
+    if (depth >= FWD_RING_SIZE) {
+        dest->stats.dropped++;
+        dest->stats.level_dropped[level]++;
+        PROBE4(enqueue_drop, src, route->dst, out->can_id, level);
+        return;
+    }
+    if (depth + 1 > dest->stats.depth_max[level]) {
+        dest->stats.depth_max[level] = depth + 1;
+    }
+    struct fwd_slot* slot = &q->ring[q->head & FWD_RING_MASK];
+    memcpy(&slot->frame, out, can_frame_mtu(out));
+    slot->frame.__res0 = 0;     // The interface of a replayed capture record
+    slot->wire_ts = wire_ts;
+    slot->user_ts = user_ts;
+    slot->src = src;
+    q->head++;
+    dest->queued++;
+    if (limited) {
+        limit_commit(&admit, frame, user_ts);
+    }
+    PROBE4(enqueue, src, route->dst, out->can_id, level);
+}
+
+#ifdef CAN_BRIDGE_TOPOLOGY
+// The topology's routes unrolled in table order: each is a compare against
+// constants, and its destination and limits are known to queue_route().
+// The routing table holds the same routes (forward_set_routes() at startup)
+// for the kernel filters and the route indices of the limit state.
+template <int N>
+struct fixed_routes {
+    static inline __attribute__((always_inline))
+    void route(int src, const struct canfd_frame* frame, uint64_t wire_ts, uint64_t user_ts,
+               uint32_t* matched) {
+        fixed_routes<N - 1>::route(src, frame, wire_ts, user_ts, matched);
+
+        const struct fwd_route* r = &topology_routes[N - 1];
+        if (src == r->src && (frame->can_id & r->mask) == r->id) {
+            queue_route(N - 1, r, src, frame, wire_ts, user_ts, matched);
+        }
+    }
+};
+
+template <>
+struct fixed_routes<0> {
+    static inline void route(int, const struct canfd_frame*, uint64_t, uint64_t, uint32_t*) {
+    }
+};
+#endif
+
+void forward_frame(int src, const struct canfd_frame* frame, uint64_t wire_ts, uint64_t user_ts) {
+    uint32_t matched = 0;
+
+    if (src < 0 || src >= FWD_MAX_DESTS) {
+        return;
+    }
+
+#ifdef CAN_BRIDGE_TOPOLOGY
+    fixed_routes<TOPOLOGY_NUM_ROUTES>::route(src, frame, wire_ts, user_ts, &matched);
+#else
+    const struct fwd_table* table = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < table->src_route_count[src]; i++) {
+        int index = table->src_routes[src][i];
+        const struct fwd_route* route = &table->routes[index];
+
+        if ((frame->can_id & route->mask) == route->id) {
+            queue_route(index, route, src, frame, wire_ts, user_ts, &matched);
+        }
+    }
+#endif
+
+    pending_mask |= matched;
+}
+
+// Remove the first count frames of a batch built with taken[level] frames
+// per level
+static void consume(struct fwd_dest* dest, const unsigned int* taken, unsigned int count) {
+    dest->queued -= count;
+    for (int level = 0; level < FWD_PRIO_LEVELS && count > 0; level++) {
+        unsigned int n = taken[level] < count ? taken[level] : count;
+        dest->queues[level].tail += n;
+        count -= n;
+    }
+}
+
+// Account a sink destination's queues as sent
+static void flush_sink(struct fwd_dest* dest) {
+    uint64_t now = realtime_ns();
+
+    for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+        struct fwd_queue* q = &dest->queues[level];
+        for (unsigned int i = q->tail; i != q->head; i++) {
+            const struct fwd_slot* slot = &q->ring[i & FWD_RING_MASK];
+            latency_record_span(&iface_latency[slot->src].user_to_tx, slot->user_ts, now);
+            dest->stats.tx_bytes += can_frame_len(&slot->frame);
+            stats_tx_frame(dest - dests, &slot->frame);
+        }
+        dest->stats.tx_frames += q->head - q->tail;
+        q->tail = q->head;
+    }
+    dest->queued = 0;
+}
+
+// Send as much of one destination's queues as the socket accepts, highest
+// priority level first
+static void flush_dest(int index) {
+    struct fwd_dest* dest = &dests[index];
+    struct mmsghdr msgs[FWD_TX_BATCH];
+    struct iovec iov[FWD_TX_BATCH];
+    const struct fwd_slot* slots[FWD_TX_BATCH];
+    unsigned int taken[FWD_PRIO_LEVELS];
+
+    if (dest->sink) {
+        flush_sink(dest);
+    }
+
+    while (dest->queued > 0) {
+        // A batch may span levels; it always starts at the highest one
+        unsigned int count = 0;
+        for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+            const struct fwd_queue* q = &dest->queues[level];
+            taken[level] = 0;
+            for (unsigned int i = q->tail; i != q->head && count < FWD_TX_BATCH; i++) {
+                slots[count++] = &q->ring[i & FWD_RING_MASK];
+                taken[level]++;
+            }
+        }
+
+        memset(msgs, 0, sizeof(struct mmsghdr) * count);
+        for (unsigned int i = 0; i < count; i++) {
+            iov[i].iov_base = (void*)&slots[i]->frame;
+            iov[i].iov_len = can_frame_mtu(&slots[i]->frame);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = sendmmsg(dest->sock, msgs, count, MSG_DONTWAIT);
+        PROBE3(tx, index, count, sent);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Socket buffer full: EPOLLOUT will resume the flush
+                dest->blocked = true;
+            }
+            else if (errno == ENOBUFS) {
+                // Device TX queue full: no wakeup is generated, poll again
+                dest->blocked = true;
+                arm_retry_timer();
+            }
+            else if (errno == ENETDOWN) {
+                // Hold the frames until the next link notification or query
+                // finds the link up (can_recovery.cpp reports every one)
+                dest->link_down = true;
+            }
+            else if (errno != EINTR) {
+                // Drop the offending frame so one bad frame cannot stall the queues
+                perror("Error forwarding CAN frame");
+                dest->stats.tx_errors++;
+                consume(dest, taken, 1);
+            }
+            break;
+        }
+
+        // One clock read per sendmmsg() covers the whole batch
+        uint64_t now = realtime_ns();
+        for (int i = 0; i < sent; i++) {
+            struct iface_latency* lat = &iface_latency[slots[i]->src];
+
+            latency_record_span(&lat->user_to_tx, slots[i]->user_ts, now);
+            latency_record_span(&lat->total, slots[i]->wire_ts, now);
+            dest->stats.tx_bytes += can_frame_len(&slots[i]->frame);
+            stats_tx_frame(index, &slots[i]->frame);
+        }
+
+        consume(dest, taken, sent);
+        dest->stats.tx_frames += sent;
+    }
+
+    if (dest->queued == 0) {
+        pending_mask &= ~(1u << index);
+    }
+}
+
+void forward_flush(void) {
+    uint32_t mask = pending_mask;
+
+    while (mask) {
+        int index = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        if (!dests[index].blocked && !dests[index].link_down) {
+            flush_dest(index);
+        }
+    }
+}
+
+void forward_on_writable(int index) {
+    if (index < 0 || index >= FWD_MAX_DESTS) {
+        return;
+    }
+    dests[index].blocked = false;
+    if (dests[index].queued > 0 && !dests[index].link_down) {
+        flush_dest(index);
+    }
+}
+
+void forward_set_link(int index, bool up) {
+    if (index < 0 || index >= FWD_MAX_DESTS) {
+        return;
+    }
+    struct fwd_dest* dest = &dests[index];
+    bool was_down = dest->link_down;
+    dest->link_down = !up;
+    if (!up || !was_down) {
+        return;
+    }
+
+    uint64_t now = realtime_ns();
+    for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+        struct fwd_queue* q = &dest->queues[level];
+        while (q->tail != q->head && now - q->ring[q->tail & FWD_RING_MASK].user_ts > FWD_HOLD_NS) {
+            dest->stats.stale++;
+            q->tail++;
+            dest->queued--;
+        }
+    }
+    dest->blocked = false;
+    flush_dest(index);
+}
+
+unsigned int forward_queue_depth(int index, int level) {
+    if (index < 0 || index >= FWD_MAX_DESTS || level < 0 || level >= FWD_PRIO_LEVELS) {
+        return 0;
+    }
+    const struct fwd_queue* q = &dests[index].queues[level];
+    return q->head - q->tail;
+}
+
+const struct fwd_dest_stats* forward_dest_stats(int index) {
+    if (index < 0 || index >= FWD_MAX_DESTS) {
+        return NULL;
+    }
+    return &dests[index].stats;
+}
+
+void forward_close(void) {
+    if (retry_ev.fd >= 0) {
+        close(retry_ev.fd);
+        retry_ev.fd = -1;
+    }
+}
@@ -0,0 +1,147 @@
+/*
+ * CAN frame forwarding engine
+ *
+ * Routes are keyed by source interface and CAN ID/mask. Matching frames are
+ * queued in bounded rings per destination and written in batches with
+ * sendmmsg(). The receive side never blocks: if a destination cannot take
+ * more frames, they wait in its rings, and once a ring is full new frames
+ * are dropped and counted.
+ *
+ * Each destination has one ring per priority level (fwd_prio_level()),
+ * drained in strict priority order: when the destination bus is saturated,
+ * a TSC1 waits for at most one batch of lower priority frames already
+ * handed to the socket, never behind the queued keypad or diagnostic
+ * traffic. Frames of one level keep their order.
+ */
+
+#ifndef FORWARD_H
+#define FORWARD_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+
+#include "event_loop.h"
+
+// Maximum number of routes in the routing table
+#define FWD_MAX_ROUTES 64
+
+// Maximum number of destination interfaces
+#define FWD_MAX_DESTS 8
+
+// Priority levels per destination. Level 0 is sent first.
+#define FWD_PRIO_LEVELS 4
+
+// Frames buffered per priority level and destination (power of two)
+#define FWD_RING_SIZE 256
+
+// Frames written by a single sendmmsg() call
+#define FWD_TX_BATCH 32
+
+// Retry interval when a destination reports ENOBUFS (device queue full)
+#define FWD_RETRY_NS 1000000
+
+// Frames held for a destination whose link is down are discarded instead
+// of sent once they are older than this
+#define FWD_HOLD_NS 1000000000ull
+
+// Streams (route, CAN ID) whose last forwarded payload is kept for
+// on-change routes (power of two)
+#define FWD_STREAM_SLOTS 1024
+
+// Optional limits of a route (all zero: forward every frame)
+struct fwd_limit {
+    uint32_t rate;          // Token bucket: frames per second, 0 for no limit
+    uint32_t burst;         // Frames let through back to back (0 counts as 1)
+    bool on_change;         // Only forward a frame whose payload changed...
+    uint32_t refresh_ms;    // ...or that comes refresh_ms after its stream was
+                            // last forwarded (0: changes only)
+};
+
+// Route: frames from interface src with (can_id & mask) == id go to dst
+struct fwd_route {
+    int src;
+    canid_t id;
+    canid_t mask;
+    int dst;
+    struct fwd_limit limit;
+};
+
+// Per-destination counters
+struct fwd_dest_stats {
+    uint64_t tx_frames;
+    uint64_t tx_bytes;      // Data bytes of the frames sent
+    uint64_t dropped;       // Ring full
+    uint64_t tx_errors;     // sendmmsg() failures other than backpressure, and
+                            // FD frames routed to a classic CAN destination
+    uint64_t rule_drops;    // Dropped by a rewrite rule
+    uint64_t rate_limited;  // Over a route's rate
+    uint64_t unchanged;     // Repeats suppressed by an on-change route
+    uint64_t stale;         // Held past FWD_HOLD_NS while the link was down
+    uint64_t level_dropped[FWD_PRIO_LEVELS];    // Part of dropped, by level
+    uint32_t depth_max[FWD_PRIO_LEVELS];        // Highest queue depth seen
+};
+
+// Queue level of a frame: the 3-bit J1939 priority of 29-bit identifiers
+// (0 highest) and the top bits of 11-bit ones, two values per level, the
+// order the bus arbitrates them in. TSC1 (priority 3) is level 1, keypad
+// and DM1 (priority 6) level 3.
+static inline int fwd_prio_level(canid_t can_id) {
+    if (can_id & CAN_EFF_FLAG) {
+        return ((can_id >> 26) & 0x7) * FWD_PRIO_LEVELS / 8;
+    }
+    return ((can_id & CAN_SFF_MASK) >> 8) * FWD_PRIO_LEVELS / 8;
+}
+
+// Initialize the engine and register its retry timer with the event loop
+int forward_init(struct event_loop* loop);
+
+// Attach a destination socket to an interface index. fd tells whether the
+// interface can send CAN-FD frames.
+int forward_set_dest(int index, int sock, const char* name, bool fd);
+
+// Make an interface index a destination without a socket: routed frames
+// are queued and counted as forwarded but not sent (offline replay)
+int forward_set_sink(int index, const char* name);
+
+// Install a routing table (at startup, and at runtime from the event loop
+// thread). The new table is built aside and swapped in with one pointer
+// store, so frames are routed by either the old or the new table, never a
+// mix. Rate limiters and on-change state start over with the new table.
+// Returns -1 and keeps the old table if a route is invalid or the table is
+// full.
+int forward_set_routes(const struct fwd_route* routes, int count);
+
+// Number of configured routes
+int forward_route_count(void);
+
+// The routing table, with its size stored in count
+const struct fwd_route* forward_routes(int* count);
+
+// Queue a received frame on every matching destination. wire_ts is the
+// kernel RX timestamp (0 if unknown) and user_ts the time the frame reached
+// userspace, both CLOCK_REALTIME ns; they feed the latency histograms.
+void forward_frame(int src, const struct canfd_frame* frame, uint64_t wire_ts, uint64_t user_ts);
+
+// Write queued frames to all destinations without blocking
+void forward_flush(void);
+
+// Destination socket became writable again (EPOLLOUT)
+void forward_on_writable(int index);
+
+// Pause or resume sending to a destination (bus-off or link down). Frames
+// keep being queued while it is down, up to the ring size; on resume the
+// ones older than FWD_HOLD_NS are discarded and the rest sent. Reporting
+// the state it already has does nothing, so it can be called on every
+// link query.
+void forward_set_link(int index, bool up);
+
+const struct fwd_dest_stats* forward_dest_stats(int index);
+
+// Frames currently queued at one priority level of a destination
+unsigned int forward_queue_depth(int index, int level);
+
+void forward_close(void);
+
+#endif // FORWARD_H
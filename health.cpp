@@ -0,0 +1,183 @@
+/*
+ * Event loop health and systemd watchdog
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include "health.h"
+#include "rx_threads.h"
+
+static struct event_source timer_ev = { -1, NULL, NULL };
+
+// systemd notification socket (NOTIFY_SOCKET), -1 if not run by systemd
+static int notify_fd = -1;
+static struct sockaddr_un notify_addr;
+static socklen_t notify_len = 0;
+
+// State of the last check, to report stalls once when they start and end
+static int stalled_iface = -1;
+static uint64_t reported_stalls = 0;
+
+// sd_notify() without libsystemd: one datagram per state change. Only the
+// first failure is reported, not one per watchdog interval.
+static void notify(const char* state) {
+    static bool failed = false;
+
+    if (notify_fd < 0) {
+        return;
+    }
+    if (sendto(notify_fd, state, strlen(state), MSG_NOSIGNAL, (const struct sockaddr*)&notify_addr,
+               notify_len) < 0 && errno != EAGAIN && !failed) {
+        perror("Error notifying systemd");
+        failed = true;
+    }
+}
+
+static int open_notify(void) {
+    const char* path = getenv("NOTIFY_SOCKET");
+
+    if (path == NULL || path[0] == '\0') {
+        return 0;
+    }
+    // A filesystem path, or an abstract socket name given with a leading @
+    if ((path[0] != '/' && path[0] != '@') || strlen(path) >= sizeof(notify_addr.sun_path)) {
+        fprintf(stderr, "Ignoring unsupported NOTIFY_SOCKET %s\n", path);
+        return 0;
+    }
+    memset(&notify_addr, 0, sizeof(notify_addr));
+    notify_addr.sun_family = AF_UNIX;
+    memcpy(notify_addr.sun_path, path, strlen(path));
+    if (path[0] == '@') {
+        notify_addr.sun_path[0] = '\0';
+    }
+    notify_len = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+
+    notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (notify_fd < 0) {
+        perror("Error creating systemd notification socket");
+        return -1;
+    }
+
+    // The watchdog applies to this process only if WATCHDOG_PID says so
+    const char* usec = getenv("WATCHDOG_USEC");
+    const char* pid = getenv("WATCHDOG_PID");
+    if (usec != NULL && (pid == NULL || atol(pid) == (long)getpid())) {
+        stats_set(&stats->watchdog_usec, strtoull(usec, NULL, 10));
+    }
+    return 0;
+}
+
+// Interface whose RX thread has not returned from its socket for
+// HEALTH_STALL_MS, -1 if none; the time it has been gone in *gone_ns
+static int stalled_rx_thread(uint64_t now, uint64_t* gone_ns) {
+    int worst = -1;
+
+    *gone_ns = 0;
+    for (uint32_t i = 0; i < stats->num_ifaces; i++) {
+        uint64_t beat = rx_thread_heartbeat(i);
+        if (beat != 0 && now > beat && now - beat > *gone_ns) {
+            *gone_ns = now - beat;
+            worst = i;
+        }
+    }
+    return *gone_ns > HEALTH_STALL_MS * 1000000ull ? worst : -1;
+}
+
+static void on_health_timer(struct event_source* src, uint32_t events) {
+    uint64_t expirations;
+    uint64_t gone_ns;
+    (void)events;
+
+    while (read(src->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {
+    }
+
+    // Iterations that stalled since the last check
+    uint64_t stalls = stats->loop_stalls;
+    if (stalls != reported_stalls) {
+        fprintf(stderr, "Event loop stalled %llu time(s), slowest iteration %.1f ms\n",
+                (unsigned long long)(stalls - reported_stalls), stats->loop_max_ns / 1e6);
+        reported_stalls = stalls;
+    }
+
+    // This handler running means the loop iterates; the RX threads are
+    // checked separately
+    int iface = stalled_rx_thread(monotonic_ns(), &gone_ns);
+    if (iface != stalled_iface) {
+        if (iface >= 0) {
+            fprintf(stderr, "%s: RX thread stalled for %.0f ms%s\n", stats->ifaces[iface].name,
+                    gone_ns / 1e6, stats->watchdog_usec > 0 ? ", not notifying the watchdog" : "");
+        }
+        else {
+            fprintf(stderr, "RX threads running again\n");
+        }
+        stalled_iface = iface;
+    }
+
+    if (stats->watchdog_usec == 0) {
+        return;
+    }
+    if (iface >= 0) {
+        stats_add(&stats->watchdog_skipped, 1);
+        return;
+    }
+    notify("WATCHDOG=1");
+    stats_add(&stats->watchdog_pings, 1);
+}
+
+int health_init(struct event_loop* loop) {
+    struct itimerspec its;
+
+    if (open_notify() < 0) {
+        return -1;
+    }
+
+    timer_ev.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_ev.fd < 0) {
+        perror("Error creating health timer");
+        return -1;
+    }
+    timer_ev.handler = on_health_timer;
+    timer_ev.ctx = NULL;
+
+    // Twice per watchdog interval, as systemd recommends
+    uint64_t interval_ns = stats->watchdog_usec > 0 ? stats->watchdog_usec * 500
+                                                    : HEALTH_CHECK_MS * 1000000ull;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = interval_ns / 1000000000ull;
+    its.it_value.tv_nsec = interval_ns % 1000000000ull;
+    its.it_interval = its.it_value;
+    if (timerfd_settime(timer_ev.fd, 0, &its, NULL) < 0) {
+        perror("Error arming health timer");
+        return -1;
+    }
+    if (stats->watchdog_usec > 0) {
+        printf("systemd watchdog every %.1f s\n", stats->watchdog_usec / 1e6);
+    }
+    return event_loop_add(loop, &timer_ev, EPOLLIN);
+}
+
+void health_ready(void) {
+    notify("READY=1");
+}
+
+void health_close(void) {
+    notify("STOPPING=1");
+    if (timer_ev.fd >= 0) {
+        close(timer_ev.fd);
+        timer_ev.fd = -1;
+    }
+    if (notify_fd >= 0) {
+        close(notify_fd);
+        notify_fd = -1;
+    }
+}
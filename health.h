@@ -0,0 +1,73 @@
+/*
+ * Event loop health and systemd watchdog
+ *
+ * The event loop records when each iteration starts and ends, and the RX
+ * paths when an interface last delivered a batch, in the statistics
+ * segment (relaxed atomics, CLOCK_MONOTONIC ns), so a monitor sees a loop
+ * stuck in a blocking write() or a slow console while it is stuck:
+ * loop_busy_since stays set. The slowest iteration and the iterations
+ * longer than HEALTH_STALL_MS are kept as well.
+ *
+ * Under systemd (NOTIFY_SOCKET set) the bridge reports READY=1 once it
+ * runs and, with WatchdogSec= (WATCHDOG_USEC), sends WATCHDOG=1 from a
+ * timer on the event loop at half the watchdog interval. The timer only
+ * fires while the loop iterates, and it skips the notification while an
+ * RX thread has not come back from its socket for HEALTH_STALL_MS, so a
+ * stalled pipeline lets the watchdog expire and systemd restart the
+ * bridge. Without systemd the same checks run every HEALTH_CHECK_MS and
+ * only report stalls.
+ */
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <stdint.h>
+
+#include "clock_util.h"
+#include "event_loop.h"
+#include "stats.h"
+
+// An iteration or RX thread taking longer than this is a stall
+#define HEALTH_STALL_MS 500
+
+// Check interval without a systemd watchdog
+#define HEALTH_CHECK_MS 1000
+
+// Start the health timer and read the systemd notification settings
+// (after stats_open() and rx_threads_start()). Returns 0 or -1.
+int health_init(struct event_loop* loop);
+
+// Tell systemd the bridge is up (no-op without NOTIFY_SOCKET)
+void health_ready(void);
+
+// Send STOPPING=1 and stop the timer
+void health_close(void);
+
+// Event loop iteration boundaries (event loop thread)
+static inline uint64_t health_loop_begin(void) {
+    uint64_t now = monotonic_ns();
+    stats_set(&stats->loop_busy_since, now);
+    return now;
+}
+
+static inline void health_loop_end(uint64_t start) {
+    uint64_t now = monotonic_ns();
+    uint64_t took = now - start;
+
+    stats_set(&stats->loop_busy_since, 0);
+    stats_set(&stats->loop_last_ns, now);
+    stats_add(&stats->loop_iterations, 1);
+    if (took > stats->loop_max_ns) {
+        stats_set(&stats->loop_max_ns, took);
+    }
+    if (took > HEALTH_STALL_MS * 1000000ull) {
+        stats_add(&stats->loop_stalls, 1);
+    }
+}
+
+// A received batch went through the RX stage of an interface
+static inline void health_rx(int iface) {
+    stats_set(&stats->ifaces[iface].last_rx_ns, monotonic_ns());
+}
+
+#endif // HEALTH_H
@@ -0,0 +1,371 @@
+/*
+ * J1939 transport protocol reassembly
+ */
+
+#include <string.h>
+
+#include "j1939_tp.h"
+#include "dispatch.h"
+#include "mem_pool.h"
+
+#define WHEEL_MASK (J1939_TP_WHEEL_SIZE - 1)
+
+// Control bytes of TP.CM and ETP.CM
+#define TP_CM_RTS 16
+#define TP_CM_CTS 17
+#define TP_CM_EOMA 19
+#define TP_CM_BAM 32
+#define ETP_CM_RTS 20
+#define ETP_CM_CTS 21
+#define ETP_CM_DPO 22
+#define ETP_CM_EOMA 23
+#define TP_CM_ABORT 255
+
+// Payload bytes per data packet
+#define TP_PACKET_DATA 7
+
+struct tp_session {
+    bool active;
+    bool bam;               // Broadcast (no CTS flow control)
+    bool extended;          // ETP
+    uint8_t sa;             // Originator
+    uint8_t da;             // Destination, 0xFF for BAM
+    uint8_t priority;       // Of the announcement
+    uint32_t pgn;
+    uint32_t size;
+    uint32_t packets;       // Total data packets
+    uint32_t next_packet;   // Next expected packet number (1-based)
+    uint32_t dpo_offset;    // ETP: packet offset of the current DPO window
+    uint8_t* buf;
+    struct mem_pool* pool;  // Pool buf came from
+
+    // Timer wheel slot list
+    uint64_t deadline;      // Tick at which the session times out
+    struct tp_session* next;
+    struct tp_session** pprev;
+};
+
+struct tp_iface {
+    struct tp_session sessions[J1939_TP_MAX_SESSIONS];
+    struct tp_session* wheel[J1939_TP_WHEEL_SIZE];
+    uint64_t tick;          // Last tick the wheel was advanced to
+    struct mem_pool tp_pool;
+    struct mem_pool etp_pool;
+    alignas(8) uint8_t tp_storage[MEM_POOL_STORAGE(J1939_TP_MAX_SIZE, J1939_TP_POOL_BLOCKS)];
+    alignas(8) uint8_t etp_storage[MEM_POOL_STORAGE(J1939_ETP_MAX_SIZE, J1939_ETP_POOL_BLOCKS)];
+    struct j1939_tp_stats stats;
+    bool ready;
+};
+
+static struct tp_iface tp_ifaces[MAX_CAN_IFACES];
+
+static struct tp_iface* get_iface(int iface) {
+    if (iface < 0 || iface >= MAX_CAN_IFACES) {
+        return NULL;
+    }
+
+    struct tp_iface* t = &tp_ifaces[iface];
+    if (!t->ready) {
+        mem_pool_init(&t->tp_pool, t->tp_storage, J1939_TP_MAX_SIZE, J1939_TP_POOL_BLOCKS);
+        mem_pool_init(&t->etp_pool, t->etp_storage, J1939_ETP_MAX_SIZE, J1939_ETP_POOL_BLOCKS);
+        t->ready = true;
+    }
+    return t;
+}
+
+static inline uint64_t ms_to_ticks(unsigned int ms) {
+    return (ms + J1939_TP_TICK_MS - 1) / J1939_TP_TICK_MS;
+}
+
+static void wheel_remove(struct tp_session* s) {
+    if (s->pprev != NULL) {
+        *s->pprev = s->next;
+        if (s->next != NULL) {
+            s->next->pprev = s->pprev;
+        }
+        s->next = NULL;
+        s->pprev = NULL;
+    }
+}
+
+// (Re)arm the session timeout
+static void wheel_arm(struct tp_iface* t, struct tp_session* s, unsigned int timeout_ms) {
+    wheel_remove(s);
+    s->deadline = t->tick + ms_to_ticks(timeout_ms);
+
+    struct tp_session** head = &t->wheel[s->deadline & WHEEL_MASK];
+    s->next = *head;
+    s->pprev = head;
+    if (*head != NULL) {
+        (*head)->pprev = &s->next;
+    }
+    *head = s;
+}
+
+static void end_session(struct tp_session* s) {
+    wheel_remove(s);
+    if (s->buf != NULL) {
+        mem_pool_free(s->pool, s->buf);
+        s->buf = NULL;
+    }
+    s->active = false;
+}
+
+// Expire every session whose deadline passed. A gap longer than the wheel
+// visits each slot once, which covers every armed session.
+static void wheel_advance(struct tp_iface* t, uint64_t now_ns) {
+    uint64_t now = now_ns / (J1939_TP_TICK_MS * 1000000ull);
+
+    if (t->tick == 0 || now <= t->tick) {
+        if (t->tick == 0) {
+            t->tick = now;
+        }
+        return;
+    }
+
+    uint64_t steps = now - t->tick;
+    if (steps > J1939_TP_WHEEL_SIZE) {
+        steps = J1939_TP_WHEEL_SIZE;
+    }
+    for (uint64_t i = 1; i <= steps; i++) {
+        struct tp_session* s = t->wheel[(t->tick + i) & WHEEL_MASK];
+        while (s != NULL) {
+            struct tp_session* next = s->next;
+            if (s->deadline <= now) {
+                end_session(s);
+                t->stats.timeouts++;
+            }
+            s = next;
+        }
+    }
+    t->tick = now;
+}
+
+static struct tp_session* find_session(struct tp_iface* t, uint8_t sa, uint8_t da, bool extended) {
+    for (int i = 0; i < J1939_TP_MAX_SESSIONS; i++) {
+        struct tp_session* s = &t->sessions[i];
+        if (s->active && s->sa == sa && s->da == da && s->extended == extended) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static struct tp_session* free_session(struct tp_iface* t) {
+    for (int i = 0; i < J1939_TP_MAX_SESSIONS; i++) {
+        if (!t->sessions[i].active) {
+            return &t->sessions[i];
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t get_pgn(const uint8_t* d) {
+    return (d[5] | (d[6] << 8) | ((uint32_t)d[7] << 16)) & 0x3FFFF;
+}
+
+// Start a session for an RTS or BAM announcement
+static void start_session(struct tp_iface* t, const struct j1939_msg* msg, bool bam,
+                          bool extended, uint32_t size) {
+    uint32_t pgn = get_pgn(msg->data);
+    uint32_t max = extended ? J1939_ETP_MAX_SIZE : J1939_TP_MAX_SIZE;
+    uint32_t min = extended ? J1939_TP_MAX_SIZE + 1 : 9;
+
+    // A new announcement replaces the pair's current transfer
+    struct tp_session* s = find_session(t, msg->sa, msg->da, extended);
+    if (s != NULL) {
+        end_session(s);
+        t->stats.aborted++;
+    }
+
+    // Only reassemble what someone will look at
+    if (size < min || size > max || !dispatch_wants(pgn, msg->sa)) {
+        t->stats.ignored++;
+        return;
+    }
+    if (!extended && msg->data[3] != (size + TP_PACKET_DATA - 1) / TP_PACKET_DATA) {
+        t->stats.ignored++;
+        return;
+    }
+
+    s = free_session(t);
+    struct mem_pool* pool = extended ? &t->etp_pool : &t->tp_pool;
+    uint8_t* buf = s != NULL ? (uint8_t*)mem_pool_alloc(pool) : NULL;
+    if (buf == NULL) {
+        t->stats.no_buffer++;
+        return;
+    }
+
+    s->active = true;
+    s->bam = bam;
+    s->extended = extended;
+    s->sa = msg->sa;
+    s->da = msg->da;
+    s->priority = msg->priority;
+    s->pgn = pgn;
+    s->size = size;
+    s->packets = (size + TP_PACKET_DATA - 1) / TP_PACKET_DATA;
+    s->next_packet = 1;
+    s->dpo_offset = 0;
+    s->buf = buf;
+    s->pool = pool;
+    s->next = NULL;
+    s->pprev = NULL;
+    wheel_arm(t, s, bam ? J1939_TP_T1_MS : J1939_TP_T2_MS);
+}
+
+// Dispatch a completed message and release its session
+static int deliver(struct tp_iface* t, struct tp_session* s, int iface, uint64_t ts_ns) {
+    struct j1939_msg m;
+
+    m.pgn = s->pgn;
+    m.priority = s->priority;
+    m.sa = s->sa;
+    m.da = s->da;
+    m.iface = iface;
+    m.data = s->buf;
+    m.len = s->size;
+    m.ts_ns = ts_ns;
+    m.signal = NULL;
+
+    int ret = dispatch_message(&m);
+    t->stats.completed++;
+    end_session(s);
+    return ret;
+}
+
+static void on_control(struct tp_iface* t, const struct j1939_msg* msg, bool extended) {
+    const uint8_t* d = msg->data;
+    struct tp_session* s;
+
+    switch (d[0]) {
+    case TP_CM_BAM:
+        if (!extended && msg->da == 0xFF) {
+            start_session(t, msg, true, false, d[1] | (d[2] << 8));
+        }
+        break;
+    case TP_CM_RTS:
+    case ETP_CM_RTS:
+        if (extended == (d[0] == ETP_CM_RTS) && msg->da != 0xFF) {
+            uint32_t size = extended ? d[1] | (d[2] << 8) | (d[3] << 16) | ((uint32_t)d[4] << 24)
+                                     : d[1] | (d[2] << 8);
+            start_session(t, msg, false, extended, size);
+        }
+        break;
+    case TP_CM_CTS:
+    case ETP_CM_CTS:
+        // Sent by the receiver: the session is keyed by the originator
+        s = find_session(t, msg->da, msg->sa, extended);
+        if (s != NULL && extended == (d[0] == ETP_CM_CTS)) {
+            uint32_t next = extended ? d[2] | (d[3] << 8) | ((uint32_t)d[4] << 16) : d[2];
+            if (d[1] == 0) {
+                wheel_arm(t, s, J1939_TP_T4_MS);
+            }
+            else if (next == 0 || next > s->packets) {
+                // Asks for packets outside the message: the transfer is broken
+                end_session(s);
+                t->stats.bad_packets++;
+            }
+            else {
+                // May ask for packets again after a loss
+                s->next_packet = next;
+                wheel_arm(t, s, J1939_TP_T2_MS);
+            }
+        }
+        break;
+    case ETP_CM_DPO:
+        s = find_session(t, msg->sa, msg->da, true);
+        if (s != NULL && extended) {
+            uint32_t offset = d[2] | (d[3] << 8) | ((uint32_t)d[4] << 16);
+            // The window of d[1] packets must lie inside the message
+            if (offset + d[1] > s->packets) {
+                end_session(s);
+                t->stats.bad_packets++;
+                break;
+            }
+            s->dpo_offset = offset;
+            wheel_arm(t, s, J1939_TP_T2_MS);
+        }
+        break;
+    case TP_CM_EOMA:
+    case ETP_CM_EOMA:
+        // Completed sessions are gone by now; one still open missed packets
+        s = find_session(t, msg->da, msg->sa, extended);
+        if (s != NULL && extended == (d[0] == ETP_CM_EOMA)) {
+            end_session(s);
+            t->stats.bad_packets++;
+        }
+        break;
+    case TP_CM_ABORT:
+        // Either peer may abort
+        s = find_session(t, msg->sa, msg->da, extended);
+        if (s == NULL) {
+            s = find_session(t, msg->da, msg->sa, extended);
+        }
+        if (s != NULL) {
+            end_session(s);
+            t->stats.aborted++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static int on_data(struct tp_iface* t, const struct j1939_msg* msg, bool extended) {
+    struct tp_session* s = find_session(t, msg->sa, msg->da, extended);
+    if (s == NULL) {
+        return 0;
+    }
+
+    uint32_t packet = msg->data[0] + (extended ? s->dpo_offset : 0);
+    if (msg->data[0] == 0 || packet != s->next_packet || packet > s->packets) {
+        t->stats.bad_packets++;
+        // Broadcasts cannot be repeated: the message is lost
+        if (s->bam) {
+            end_session(s);
+        }
+        return 0;
+    }
+
+    uint32_t offset = (packet - 1) * TP_PACKET_DATA;
+    uint32_t n = s->size - offset < TP_PACKET_DATA ? s->size - offset : TP_PACKET_DATA;
+    memcpy(s->buf + offset, msg->data + 1, n);
+    s->next_packet++;
+
+    if (packet == s->packets) {
+        return deliver(t, s, msg->iface, msg->ts_ns);
+    }
+    wheel_arm(t, s, s->bam ? J1939_TP_T1_MS : J1939_TP_T3_MS);
+    return 0;
+}
+
+int j1939_tp_receive(const struct j1939_msg* msg, uint64_t now_ns) {
+    struct tp_iface* t = get_iface(msg->iface);
+
+    // Transport frames are always 8 bytes
+    if (t == NULL || msg->len < 8) {
+        return 0;
+    }
+    wheel_advance(t, now_ns);
+
+    switch (msg->pgn) {
+    case J1939_TP_CM_PGN:
+        on_control(t, msg, false);
+        return 0;
+    case J1939_ETP_CM_PGN:
+        on_control(t, msg, true);
+        return 0;
+    case J1939_TP_DT_PGN:
+        return on_data(t, msg, false);
+    case J1939_ETP_DT_PGN:
+        return on_data(t, msg, true);
+    default:
+        return 0;
+    }
+}
+
+const struct j1939_tp_stats* j1939_tp_stats(int iface) {
+    struct tp_iface* t = get_iface(iface);
+    return t != NULL ? &t->stats : NULL;
+}
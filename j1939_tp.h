@@ -0,0 +1,74 @@
+/*
+ * J1939 transport protocol reassembly
+ *
+ * Multi-packet messages sent with TP (BAM and RTS/CTS, up to 1785 bytes)
+ * and ETP (RTS/CTS with data packet offsets) are reassembled and passed to
+ * dispatch_message() like any single-frame PGN. The bridge only listens:
+ * connection mode transfers are followed from the frames of both peers,
+ * it never answers with CTS itself.
+ *
+ * Sessions are tracked per interface and (source, destination) address
+ * pair. Payload buffers come from fixed per-interface block pools and the
+ * J1939-21 timeouts from a timer wheel that is advanced by every transport
+ * frame, so the RX path neither allocates memory nor arms timers. Each
+ * interface's sessions are only touched by that interface's RX path.
+ */
+
+#ifndef J1939_TP_H
+#define J1939_TP_H
+
+#include <stdint.h>
+
+#include "can_iface.h"
+
+// Transport protocol PGNs (PDU1, the DA is in the identifier)
+#define J1939_TP_CM_PGN 0xEC00
+#define J1939_TP_DT_PGN 0xEB00
+#define J1939_ETP_CM_PGN 0xC800
+#define J1939_ETP_DT_PGN 0xC700
+
+// Largest TP message, and largest ETP message that is reassembled (bigger
+// transfers such as software downloads are ignored)
+#define J1939_TP_MAX_SIZE 1785
+#define J1939_ETP_MAX_SIZE (16 * 1024)
+
+// Concurrent sessions and pooled buffers per interface
+#define J1939_TP_MAX_SESSIONS 16
+#define J1939_TP_POOL_BLOCKS 8
+#define J1939_ETP_POOL_BLOCKS 1
+
+// Timer wheel: 10 ms ticks, 256 slots (more than the longest timeout)
+#define J1939_TP_TICK_MS 10
+#define J1939_TP_WHEEL_BITS 8
+#define J1939_TP_WHEEL_SIZE (1 << J1939_TP_WHEEL_BITS)
+
+// J1939-21 timeouts
+#define J1939_TP_T1_MS 750      // Between broadcast data packets
+#define J1939_TP_T2_MS 1250     // From RTS/CTS to the first data packet
+#define J1939_TP_T3_MS 1250     // From a data packet to the next packet or CTS
+#define J1939_TP_T4_MS 1050     // Hold (CTS for 0 packets) to the next CTS
+
+struct j1939_tp_stats {
+    uint64_t completed;     // Messages reassembled and dispatched
+    uint64_t aborted;       // Aborts seen, or sessions replaced by a new announcement
+    uint64_t timeouts;
+    uint64_t no_buffer;     // Sessions lost because the session table or pool was full
+    uint64_t ignored;       // Announcements for unwanted PGNs or oversized/invalid ones
+    uint64_t bad_packets;   // Data packets out of sequence, CTS/DPO outside the message
+};
+
+static inline bool j1939_tp_pgn(uint32_t pgn) {
+    return pgn == J1939_TP_CM_PGN || pgn == J1939_TP_DT_PGN ||
+           pgn == J1939_ETP_CM_PGN || pgn == J1939_ETP_DT_PGN;
+}
+
+struct j1939_msg;
+
+// Handle one transport frame (msg->pgn is one of the PGNs above). now_ns is
+// CLOCK_MONOTONIC. Returns 1 if a completed message ran a decoder.
+int j1939_tp_receive(const struct j1939_msg* msg, uint64_t now_ns);
+
+// Counters of an interface
+const struct j1939_tp_stats* j1939_tp_stats(int iface);
+
+#endif // J1939_TP_H
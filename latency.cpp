@@ -0,0 +1,66 @@
+/*
+ * Per-interface latency histograms
+ */
+
+#include "latency.h"
+
+struct iface_latency iface_latency[MAX_CAN_IFACES];
+
+// Largest value that falls into bucket b
+static uint64_t bucket_upper(unsigned int b) {
+    if (b < 2 * LAT_SUB_COUNT) {
+        return b;
+    }
+
+    unsigned int shift = b / LAT_SUB_COUNT - 1;
+    uint64_t low = (uint64_t)(LAT_SUB_COUNT + b % LAT_SUB_COUNT) << shift;
+    return low + (1ull << shift) - 1;
+}
+
+uint64_t latency_quantile(const struct latency_hist* hist, double q) {
+    uint64_t total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(q * total + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < LAT_BUCKETS; b++) {
+        seen += __atomic_load_n(&hist->counts[b], __ATOMIC_RELAXED);
+        if (seen >= target) {
+            uint64_t upper = bucket_upper(b);
+            uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+            return upper < max ? upper : max;
+        }
+    }
+    return __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+}
+
+static void dump_hist(FILE* out, const char* name, const char* label, const struct latency_hist* hist) {
+    uint64_t total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+    if (total == 0) {
+        return;
+    }
+
+    fprintf(out, "  %-8s %-12s n=%llu p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+            name, label, (unsigned long long)total,
+            latency_quantile(hist, 0.50) / 1000.0,
+            latency_quantile(hist, 0.99) / 1000.0,
+            latency_quantile(hist, 0.999) / 1000.0,
+            __atomic_load_n(&hist->max, __ATOMIC_RELAXED) / 1000.0);
+}
+
+void latency_dump(FILE* out, const char* const* names, int count) {
+    fprintf(out, "Latency histograms:\n");
+    for (int i = 0; i < count && i < MAX_CAN_IFACES; i++) {
+        dump_hist(out, names[i], "wire->user", &iface_latency[i].wire_to_user);
+        dump_hist(out, names[i], "user->tx", &iface_latency[i].user_to_tx);
+        dump_hist(out, names[i], "total", &iface_latency[i].total);
+        dump_hist(out, names[i], "tx jitter", &iface_latency[i].tx_jitter);
+    }
+    fflush(out);
+}
@@ -0,0 +1,76 @@
+/*
+ * Per-interface latency histograms
+ *
+ * Log-linear (HDR-style) buckets: 16 linear sub-buckets per power of two,
+ * giving about 6% resolution from 1 ns up to ~18 minutes in a fixed 4.6 KiB
+ * per histogram. Recording is a handful of relaxed atomic adds, so the RX
+ * and TX paths can update histograms that another thread is reading.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "can_iface.h"
+
+#define LAT_SUB_BITS 4
+#define LAT_SUB_COUNT (1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS 40
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB_COUNT)
+
+struct latency_hist {
+    uint64_t counts[LAT_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+// Latencies measured for frames received on one interface
+struct iface_latency {
+    struct latency_hist wire_to_user;   // Kernel RX timestamp -> recvmmsg() return
+    struct latency_hist user_to_tx;     // recvmmsg() return -> sendmmsg() complete
+    struct latency_hist total;          // Kernel RX timestamp -> sendmmsg() complete
+    struct latency_hist tx_jitter;      // Cyclic messages: |interval - period| (tx_sched.h)
+};
+
+extern struct iface_latency iface_latency[MAX_CAN_IFACES];
+
+static inline unsigned int latency_bucket(uint64_t ns) {
+    if (ns < LAT_SUB_COUNT) {
+        return (unsigned int)ns;
+    }
+    if (ns >> LAT_MAX_BITS) {
+        return LAT_BUCKETS - 1;
+    }
+
+    unsigned int msb = 63 - __builtin_clzll(ns);
+    unsigned int shift = msb - LAT_SUB_BITS;
+    return (shift + 1) * LAT_SUB_COUNT + (unsigned int)((ns >> shift) - LAT_SUB_COUNT);
+}
+
+static inline void latency_record(struct latency_hist* hist, uint64_t ns) {
+    __atomic_fetch_add(&hist->counts[latency_bucket(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&hist->max, &max, ns, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Record end - start, ignoring missing (0) or out-of-order timestamps
+// (CLOCK_REALTIME may step)
+static inline void latency_record_span(struct latency_hist* hist, uint64_t start, uint64_t end) {
+    if (start != 0 && end >= start) {
+        latency_record(hist, end - start);
+    }
+}
+
+// Upper bound of the bucket holding the q-quantile (0 < q <= 1), in ns
+uint64_t latency_quantile(const struct latency_hist* hist, double q);
+
+// Print count/p50/p99/p99.9/max for every non-empty histogram
+void latency_dump(FILE* out, const char* const* names, int count);
+
+#endif // LATENCY_H
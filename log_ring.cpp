@@ -0,0 +1,157 @@
+/*
+ * Asynchronous frame log
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "log_ring.h"
+#include "dispatch.h"
+
+// Records formatted per pass; output is written once per pass
+#define LOG_BATCH 64
+#define LOG_OUTPUT_SIZE (LOG_BATCH * 160)
+
+struct spsc_ring<struct log_record> log_ring;
+uint64_t log_drops = 0;
+bool log_enabled = false;
+
+static const char* const* names;
+static int num_names;
+static pthread_t logger_thread;
+static volatile bool logger_running = false;
+
+// Write the whole buffer, retrying on short writes
+static void write_all(const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static int format_record(const struct log_record* rec, char* buf, size_t size) {
+    const struct canfd_frame* frame = &rec->frame;
+    unsigned int dlen = can_frame_len(frame);
+    const char* name = (int)rec->iface < num_names ? names[rec->iface] : "?";
+    int len;
+
+    len = snprintf(buf, size, "%llu.%06llu [RX %s] ID=0x%08X %s=%u Data: ",
+                   (unsigned long long)(rec->ts_ns / 1000000000ull),
+                   (unsigned long long)(rec->ts_ns % 1000000000ull / 1000),
+                   name, frame->can_id & CAN_EFF_MASK, can_frame_is_fd(frame) ? "FD LEN" : "DLC", dlen);
+
+    // Hex dump without printf per byte
+    static const char hex[] = "0123456789ABCDEF";
+    for (unsigned int i = 0; i < dlen && len + 4 < (int)size; i++) {
+        buf[len++] = hex[frame->data[i] >> 4];
+        buf[len++] = hex[frame->data[i] & 0x0F];
+        buf[len++] = ' ';
+    }
+    if (len + 1 < (int)size) {
+        buf[len++] = '\n';
+    }
+
+    // Decoded view of registered PGNs
+    len += dispatch_format(frame, rec->iface, buf + len, size - len);
+    return len < (int)size ? len : (int)size - 1;
+}
+
+// Format and write everything currently in the ring. Returns records written.
+static uint32_t drain(char* out) {
+    struct log_record batch[LOG_BATCH];
+    uint32_t total = 0;
+    uint32_t n;
+
+    while ((n = spsc_pop_batch(&log_ring, batch, LOG_BATCH)) > 0) {
+        size_t len = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (LOG_OUTPUT_SIZE - len < 512) {
+                write_all(out, len);
+                len = 0;
+            }
+            len += format_record(&batch[i], out + len, LOG_OUTPUT_SIZE - len);
+        }
+        write_all(out, len);
+        total += n;
+    }
+    return total;
+}
+
+// Report records dropped since the last report
+static void report_drops(char* out, uint64_t* reported) {
+    uint64_t drops = __atomic_load_n(&log_drops, __ATOMIC_RELAXED);
+
+    if (drops != *reported) {
+        int len = snprintf(out, LOG_OUTPUT_SIZE, "[LOG] %llu records dropped\n",
+                           (unsigned long long)(drops - *reported));
+        write_all(out, len);
+        *reported = drops;
+    }
+}
+
+static void* logger_main(void* arg) {
+    static char out[LOG_OUTPUT_SIZE];
+    uint64_t reported_drops = 0;
+    (void)arg;
+
+    while (__atomic_load_n(&logger_running, __ATOMIC_ACQUIRE)) {
+        if (drain(out) == 0) {
+            usleep(LOG_POLL_INTERVAL_US);
+        }
+        report_drops(out, &reported_drops);
+    }
+
+    // Final drain after the RX side stopped
+    drain(out);
+    report_drops(out, &reported_drops);
+    return NULL;
+}
+
+int log_init(const char* const* iface_names, int count, uint32_t capacity) {
+    names = iface_names;
+    num_names = count;
+    log_drops = 0;
+
+    if (spsc_init(&log_ring, capacity, "log ring") < 0) {
+        fprintf(stderr, "Failed to allocate log ring\n");
+        return -1;
+    }
+    return 0;
+}
+
+int log_start(void) {
+    // Anything printed before the thread starts must not interleave with it
+    fflush(stdout);
+
+    logger_running = true;
+    pthread_attr_t attr;
+    arena_thread_attr(&attr);
+    int ret = pthread_create(&logger_thread, &attr, logger_main, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to start logger thread: %s\n", strerror(ret));
+        logger_running = false;
+        return -1;
+    }
+    log_enabled = true;
+    return 0;
+}
+
+void log_stop(void) {
+    log_enabled = false;
+    if (logger_running) {
+        __atomic_store_n(&logger_running, false, __ATOMIC_RELEASE);
+        pthread_join(logger_thread, NULL);
+    }
+    spsc_free(&log_ring);
+}
@@ -0,0 +1,62 @@
+/*
+ * Asynchronous frame log
+ *
+ * The RX path pushes raw frames and timestamps into an SPSC ring; a logger
+ * thread formats them and writes the text to stdout in large chunks. When
+ * the ring is full the record is dropped and counted instead of stalling
+ * reception.
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+#include "spsc_ring.h"
+
+// Default number of records buffered between RX and the logger thread
+#define LOG_RING_SIZE 4096
+
+// Logger poll interval when the ring is empty
+#define LOG_POLL_INTERVAL_US 5000
+
+// One logged frame (binary, formatted later by the logger thread)
+struct log_record {
+    uint64_t ts_ns;         // CLOCK_REALTIME receive time
+    uint32_t iface;
+    struct canfd_frame frame;
+};
+
+extern struct spsc_ring<struct log_record> log_ring;
+extern uint64_t log_drops;
+extern bool log_enabled;
+
+// Allocate the ring. iface_names must stay valid until log_stop().
+int log_init(const char* const* iface_names, int count, uint32_t capacity);
+
+// Start the logger thread
+int log_start(void);
+
+// Drain the remaining records, stop the logger thread and free the ring
+void log_stop(void);
+
+// Queue a frame for logging (RX path, never blocks)
+static inline void log_frame(uint64_t ts_ns, int iface, const struct canfd_frame* frame) {
+    struct log_record rec;
+
+    if (!log_enabled) {
+        return;
+    }
+
+    rec.ts_ns = ts_ns;
+    rec.iface = iface;
+    memcpy(&rec.frame, frame, can_frame_mtu(frame));
+    if (!spsc_push(&log_ring, rec)) {
+        __atomic_fetch_add(&log_drops, 1, __ATOMIC_RELAXED);
+    }
+}
+
+#endif // LOG_RING_H
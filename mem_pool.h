@@ -0,0 +1,70 @@
+/*
+ * Fixed-size block pool
+ *
+ * Blocks are carved out of caller-provided storage once and kept on a free
+ * list linked through the free blocks themselves, so allocating and
+ * releasing a block is a pointer swap and never touches the heap. A pool
+ * is not thread safe; it belongs to one thread (e.g. one interface's RX
+ * path).
+ */
+
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes of storage for a pool of blocks * block_size
+#define MEM_POOL_STORAGE(block_size, blocks) \
+    ((((block_size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1)) * (blocks))
+
+struct mem_pool {
+    void* free_list;            // First free block, NULL when exhausted
+    size_t block_size;
+    uint32_t blocks;
+    uint32_t in_use;
+    uint32_t high_water;        // Most blocks in use at once
+    unsigned long failures;     // Allocations that found the pool empty
+};
+
+// storage must hold blocks * block_size bytes; block_size is rounded up to
+// pointer alignment
+static inline void mem_pool_init(struct mem_pool* pool, void* storage, size_t block_size,
+                                 uint32_t blocks) {
+    block_size = (block_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    pool->free_list = NULL;
+    pool->block_size = block_size;
+    pool->blocks = blocks;
+    pool->in_use = 0;
+    pool->high_water = 0;
+    pool->failures = 0;
+
+    // Link the blocks back to front so the first allocation returns the first block
+    for (uint32_t i = blocks; i > 0; i--) {
+        void** block = (void**)((char*)storage + (size_t)(i - 1) * block_size);
+        *block = pool->free_list;
+        pool->free_list = block;
+    }
+}
+
+static inline void* mem_pool_alloc(struct mem_pool* pool) {
+    void** block = (void**)pool->free_list;
+    if (block == NULL) {
+        pool->failures++;
+        return NULL;
+    }
+    pool->free_list = *block;
+    if (++pool->in_use > pool->high_water) {
+        pool->high_water = pool->in_use;
+    }
+    return block;
+}
+
+static inline void mem_pool_free(struct mem_pool* pool, void* ptr) {
+    void** block = (void**)ptr;
+    *block = pool->free_list;
+    pool->free_list = block;
+    pool->in_use--;
+}
+
+#endif // MEM_POOL_H
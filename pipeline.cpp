@@ -0,0 +1,85 @@
+/*
+ * Frame processing pipeline
+ */
+
+#include "pipeline.h"
+#include "can_recovery.h"
+#include "capture.h"
+#include "dispatch.h"
+#include "forward.h"
+#include "health.h"
+#include "latency.h"
+#include "log_ring.h"
+#include "shm_bus.h"
+#include "stats.h"
+#include "tx_sched.h"
+#include "uplink.h"
+#include "usdt.h"
+
+bool pipeline_rx_frame(struct can_iface* iface, const struct canfd_frame* frame,
+                       uint64_t wire_ts, uint64_t user_ts) {
+    latency_record_span(&iface_latency[iface->index].wire_to_user, wire_ts, user_ts);
+
+    // Error frames are only counted, never decoded or forwarded
+    if (frame->can_id & CAN_ERR_FLAG) {
+        stats_error_frame(iface->index);
+        can_recovery_error_frame(iface->index, frame);
+        return false;
+    }
+
+    stats_rx_frame(iface->index, frame);
+    dispatch_frame(frame, iface->index, wire_ts != 0 ? wire_ts : user_ts);
+    return true;
+}
+
+void pipeline_downstream(int iface, const struct canfd_frame* frame,
+                         uint64_t wire_ts, uint64_t user_ts) {
+    log_frame(user_ts, iface, frame);
+    capture_frame(wire_ts != 0 ? wire_ts : user_ts, iface, frame);
+    shm_bus_publish_frame(wire_ts != 0 ? wire_ts : user_ts, iface, frame);
+    uplink_frame(wire_ts != 0 ? wire_ts : user_ts, iface, frame);
+    forward_frame(iface, frame, wire_ts, user_ts);
+}
+
+void pipeline_process_batch(struct can_iface* iface, const struct rx_batch* batch) {
+    // One userspace timestamp per batch (taken by rx_batch_read())
+    uint64_t ts = batch->user_ts;
+
+    PROBE2(rx_batch_start, iface->index, batch->count);
+    health_rx(iface->index);
+    stats_kernel_drops(iface->index, batch->drops);
+    for (int i = 0; i < batch->count; i++) {
+        const struct canfd_frame* frame = &batch->frames[i];
+        uint64_t wire_ts = batch->rx_ts[i];
+
+        if (batch->local[i] && tx_sched_echo(iface->index, frame, wire_ts != 0 ? wire_ts : ts)) {
+            continue;
+        }
+        if (pipeline_rx_frame(iface, frame, wire_ts, ts)) {
+            pipeline_downstream(iface->index, frame, wire_ts, ts);
+        }
+    }
+    PROBE2(rx_batch_end, iface->index, batch->count);
+}
+
+int read_and_process_frames(struct can_iface* iface, struct rx_batch* batch) {
+    int total = 0;
+    int n;
+
+    // Keep reading while full batches come back; a short batch means the
+    // socket receive queue is empty
+    do {
+        n = rx_batch_read(iface->sock, batch);
+        if (n < 0) {
+            break;
+        }
+        pipeline_process_batch(iface, batch);
+        total += batch->count;
+    } while (n == RX_BATCH_SIZE);
+
+    if (total > 0) {
+        forward_flush();
+    }
+
+    return n < 0 ? -1 : total;
+}
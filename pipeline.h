@@ -0,0 +1,36 @@
+/*
+ * Frame processing pipeline
+ *
+ * RX stage (per interface): latency accounting, error frame handling and
+ * PGN dispatch. Downstream stage (single thread): logging, capture and
+ * forwarding.
+ * In the default single-threaded mode both stages run back to back; with
+ * RX threads the stages are connected by one SPSC queue per interface.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "can_iface.h"
+#include "can_rx.h"
+
+// RX stage for one frame. Returns true if the frame goes downstream.
+bool pipeline_rx_frame(struct can_iface* iface, const struct canfd_frame* frame,
+                       uint64_t wire_ts, uint64_t user_ts);
+
+// Downstream stage for one frame (logging, capture and forwarding queues)
+void pipeline_downstream(int iface, const struct canfd_frame* frame,
+                         uint64_t wire_ts, uint64_t user_ts);
+
+// Run both stages for every frame of a received batch
+void pipeline_process_batch(struct can_iface* iface, const struct rx_batch* batch);
+
+// Drain all pending frames from an interface in batches and run them
+// through the pipeline, then flush forwarding queues.
+// Returns the number of frames processed, -1 on a read error.
+int read_and_process_frames(struct can_iface* iface, struct rx_batch* batch);
+
+#endif // PIPELINE_H
@@ -0,0 +1,406 @@
+/*
+ * Offline replay
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "replay.h"
+#include "arena.h"
+#include "capture.h"
+#include "candump.h"
+#include "clock_util.h"
+#include "forward.h"
+#include "pipeline.h"
+
+// Longest candump line that is parsed
+#define REPLAY_MAX_LINE 256
+
+struct replay_frame {
+    uint64_t ts_ns;
+    int iface;              // Index into the configured interfaces, -1 if unknown
+    const struct canfd_frame* frame;    // In the capture mapping, or parsed
+};
+
+enum replay_kind {
+    REPLAY_CAPTURE,
+    REPLAY_CANDUMP,
+};
+
+struct replay_source {
+    enum replay_kind kind;
+
+    // Capture files in sequence order, with their interface mapping
+    struct capture_file files[CAPTURE_MAX_FILES];
+    int iface_map[CAPTURE_MAX_FILES][MAX_CAN_IFACES];
+    int num_files;
+    int file;
+    uint32_t pos;
+
+    // candump log
+    const char* text;
+    size_t size;
+    size_t offset;
+};
+
+static struct replay_source src;
+static struct can_iface* ifaces;
+static int num_ifaces;
+static struct event_loop* replay_loop;
+static struct event_source timer_ev = { -1, NULL, NULL };
+
+static double replay_speed;
+static struct replay_frame next;    // Next frame to replay
+static struct canfd_frame parsed;   // Frame of the last candump line, or a
+                                    // capture record too short to view
+static bool have_next = false;
+static uint64_t first_ts;
+static uint64_t start_mono;
+static struct replay_stats stats;
+
+static int find_iface(const char* name) {
+    for (int i = 0; i < num_ifaces; i++) {
+        if (strcmp(ifaces[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void map_capture_ifaces(int index) {
+    const struct capture_header* hdr = src.files[index].hdr;
+
+    for (int i = 0; i < MAX_CAN_IFACES; i++) {
+        src.iface_map[index][i] = -1;
+        if (i < (int)hdr->num_ifaces) {
+            char name[IFNAMSIZ];
+            memcpy(name, hdr->ifaces[i], IFNAMSIZ);
+            name[IFNAMSIZ - 1] = '\0';
+            src.iface_map[index][i] = find_iface(name);
+        }
+    }
+}
+
+static int add_capture_file(const char* path) {
+    if (src.num_files >= CAPTURE_MAX_FILES) {
+        fprintf(stderr, "Too many capture files\n");
+        return -1;
+    }
+    struct capture_file* file = &src.files[src.num_files];
+    if (capture_file_open(path, file) < 0) {
+        return -1;
+    }
+    if (file->hdr->sequence == 0 || capture_file_count(file) == 0) {
+        capture_file_close(file);
+        return 0;
+    }
+    arena_charge("replay input", file->size);
+    src.num_files++;
+    return 0;
+}
+
+static int compare_sequence(const void* a, const void* b) {
+    uint64_t sa = ((const struct capture_file*)a)->hdr->sequence;
+    uint64_t sb = ((const struct capture_file*)b)->hdr->sequence;
+    return sa < sb ? -1 : sa > sb;
+}
+
+// All capture.NN.bin files of a ring, oldest first
+static int open_capture_dir(const char* path) {
+    char file_path[PATH_MAX];
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (strncmp(de->d_name, "capture.", 8) != 0 || len < 12 ||
+            strcmp(de->d_name + len - 4, ".bin") != 0) {
+            continue;
+        }
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, de->d_name);
+        if (add_capture_file(file_path) < 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+
+    qsort(src.files, src.num_files, sizeof(src.files[0]), compare_sequence);
+    return 0;
+}
+
+static int open_candump(const char* path) {
+    struct stat st;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    src.kind = REPLAY_CANDUMP;
+    src.size = st.st_size;
+    src.offset = 0;
+    src.text = NULL;
+    if (src.size > 0) {
+        void* map = mmap(NULL, src.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("Error mapping replay log");
+            close(fd);
+            return -1;
+        }
+        madvise(map, src.size, MADV_SEQUENTIAL);
+        arena_charge("replay input", src.size);
+        src.text = (const char*)map;
+    }
+    close(fd);
+    return 0;
+}
+
+static int open_source(const char* path) {
+    struct stat st;
+    char magic[sizeof(CAPTURE_MAGIC)];
+
+    memset(&src, 0, sizeof(src));
+    if (stat(path, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        src.kind = REPLAY_CAPTURE;
+        if (open_capture_dir(path) < 0) {
+            return -1;
+        }
+    }
+    else {
+        // Capture files are recognised by their magic, anything else is
+        // read as a candump log
+        FILE* f = fopen(path, "rb");
+        if (f == NULL) {
+            perror(path);
+            return -1;
+        }
+        size_t n = fread(magic, 1, sizeof(magic), f);
+        fclose(f);
+        if (n != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0) {
+            return open_candump(path);
+        }
+        src.kind = REPLAY_CAPTURE;
+        if (add_capture_file(path) < 0) {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < src.num_files; i++) {
+        map_capture_ifaces(i);
+    }
+    return 0;
+}
+
+static bool next_capture_frame(struct replay_frame* out) {
+    while (src.file < src.num_files) {
+        const struct capture_file* file = &src.files[src.file];
+        if (src.pos < capture_file_count(file)) {
+            const struct capture_record* rec = capture_file_record(file, src.pos++);
+            out->ts_ns = rec->ts_ns;
+            out->iface = rec->iface < MAX_CAN_IFACES ? src.iface_map[src.file][rec->iface] : -1;
+            out->frame = capture_record_frame(rec);
+
+            // Frames are used in place; only an FD frame truncated into a
+            // classic record is copied out, so it can be read to its MTU
+            size_t avail = file->hdr->record_size - CAPTURE_FRAME_OFFSET;
+            if (can_frame_mtu(out->frame) > avail) {
+                memset(&parsed, 0, sizeof(parsed));
+                memcpy(&parsed, out->frame, avail);
+                out->frame = &parsed;
+            }
+            return true;
+        }
+        src.file++;
+        src.pos = 0;
+    }
+    return false;
+}
+
+static bool next_candump_frame(struct replay_frame* out) {
+    char line[REPLAY_MAX_LINE];
+    struct candump_entry entry;
+
+    while (src.offset < src.size) {
+        // The mapping is not NUL-terminated: copy one line for the parser
+        const char* start = src.text + src.offset;
+        size_t remaining = src.size - src.offset;
+        const char* end = (const char*)memchr(start, '\n', remaining);
+        size_t len = end != NULL ? (size_t)(end - start) : remaining;
+        src.offset += len + 1;
+
+        if (len >= sizeof(line)) {
+            continue;
+        }
+        memcpy(line, start, len);
+        line[len] = '\0';
+        if (candump_parse_line(line, &entry) < 0) {
+            continue;
+        }
+        out->ts_ns = entry.ts_ns;
+        out->iface = find_iface(entry.ifname);
+        parsed = entry.frame;
+        out->frame = &parsed;
+        return true;
+    }
+    return false;
+}
+
+static bool next_frame(struct replay_frame* out) {
+    return src.kind == REPLAY_CAPTURE ? next_capture_frame(out) : next_candump_frame(out);
+}
+
+// Monotonic time at which a frame is due
+static uint64_t due_time(uint64_t ts_ns) {
+    uint64_t offset = ts_ns > first_ts ? ts_ns - first_ts : 0;
+    return start_mono + (uint64_t)(offset / replay_speed);
+}
+
+static void arm_timer(uint64_t mono_ns) {
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (mono_ns == 0) {
+        // Yield to the other event sources, then continue immediately
+        its.it_value.tv_nsec = 1;
+        timerfd_settime(timer_ev.fd, 0, &its, NULL);
+        return;
+    }
+    its.it_value.tv_sec = mono_ns / 1000000000ull;
+    its.it_value.tv_nsec = mono_ns % 1000000000ull;
+    timerfd_settime(timer_ev.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void finish(void) {
+    stats.elapsed_ns = monotonic_ns() - start_mono;
+    event_loop_stop(replay_loop);
+}
+
+static void on_replay_timer(struct event_source* ev, uint32_t events) {
+    uint64_t expirations;
+    (void)events;
+
+    while (read(ev->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t user_ts = realtime_ns();
+    int processed = 0;
+
+    // Every frame that is due (or a chunk of them when not paced)
+    while (have_next && processed < REPLAY_CHUNK) {
+        if (replay_speed > 0 && due_time(next.ts_ns) > now) {
+            break;
+        }
+
+        if (next.iface >= 0) {
+            struct can_iface* iface = &ifaces[next.iface];
+            if (pipeline_rx_frame(iface, next.frame, 0, user_ts)) {
+                pipeline_downstream(iface->index, next.frame, 0, user_ts);
+            }
+            stats.frames++;
+        }
+        else {
+            stats.skipped++;
+        }
+        stats.log_span_ns = next.ts_ns > first_ts ? next.ts_ns - first_ts : 0;
+        processed++;
+
+        have_next = next_frame(&next);
+        if (processed % RX_BATCH_SIZE == 0) {
+            forward_flush();
+        }
+    }
+    forward_flush();
+
+    if (!have_next) {
+        finish();
+    }
+    else {
+        arm_timer(replay_speed > 0 ? due_time(next.ts_ns) : 0);
+    }
+}
+
+int replay_open(const char* path, double speed, struct can_iface* iface_list, int count,
+                struct event_loop* loop) {
+    ifaces = iface_list;
+    num_ifaces = count;
+    replay_loop = loop;
+    replay_speed = speed;
+    memset(&stats, 0, sizeof(stats));
+
+    if (speed < 0) {
+        fprintf(stderr, "Invalid replay speed\n");
+        return -1;
+    }
+    if (open_source(path) < 0) {
+        return -1;
+    }
+
+    timer_ev.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_ev.fd < 0) {
+        perror("Error creating replay timer");
+        return -1;
+    }
+    timer_ev.handler = on_replay_timer;
+    timer_ev.ctx = NULL;
+    if (event_loop_add(loop, &timer_ev, EPOLLIN) < 0) {
+        return -1;
+    }
+
+    start_mono = monotonic_ns();
+    have_next = next_frame(&next);
+    first_ts = have_next ? next.ts_ns : 0;
+    if (!have_next) {
+        fprintf(stderr, "%s: no frames to replay\n", path);
+    }
+
+    // First pass runs from the loop like every later one
+    arm_timer(0);
+    return 0;
+}
+
+void replay_close(void) {
+    if (timer_ev.fd >= 0) {
+        close(timer_ev.fd);
+        timer_ev.fd = -1;
+    }
+    if (src.kind == REPLAY_CANDUMP && src.text != NULL) {
+        munmap((void*)src.text, src.size);
+        src.text = NULL;
+    }
+    for (int i = 0; i < src.num_files; i++) {
+        capture_file_close(&src.files[i]);
+    }
+    src.num_files = 0;
+}
+
+const struct replay_stats* replay_stats(void) {
+    return &stats;
+}
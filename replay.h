@@ -0,0 +1,42 @@
+/*
+ * Offline replay
+ *
+ * Feeds frames from a capture ring (directory), a single capture file or a
+ * candump text log through the normal RX and downstream pipeline stages,
+ * without any CAN sockets. Input files are memory-mapped, and the frames of
+ * capture files are passed to the pipeline in place, as views of their
+ * records (capture_record_frame()); candump lines are parsed one at a time
+ * into a single frame. Frames are paced by a timerfd on the event loop, so
+ * signals and the forwarding timers keep working during a replay; the loop
+ * is stopped when the input ends.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+#include "can_iface.h"
+#include "event_loop.h"
+
+// Frames processed per event loop wakeup when replaying as fast as possible
+#define REPLAY_CHUNK 4096
+
+struct replay_stats {
+    uint64_t frames;        // Frames fed into the pipeline
+    uint64_t skipped;       // Frames from interfaces that are not configured
+    uint64_t log_span_ns;   // Time covered by the replayed frames
+    uint64_t elapsed_ns;    // Wall-clock duration of the replay
+};
+
+// Start replaying path. speed 1.0 keeps the recorded timing, larger values
+// replay faster, 0 replays as fast as possible. Frames are matched to
+// interfaces by name.
+int replay_open(const char* path, double speed, struct can_iface* ifaces, int count,
+                struct event_loop* loop);
+
+void replay_close(void);
+
+const struct replay_stats* replay_stats(void);
+
+#endif // REPLAY_H
@@ -0,0 +1,351 @@
+/*
+ * Frame rewrite rules for the forwarding path
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rewrite.h"
+#include "config.h"
+#include "dbc_signal.h"
+#include "signals_gen.h"
+
+// Longest rule text and most operations per rule
+#define RW_RULE_MAX 256
+#define RW_MAX_OPS 16
+
+enum rw_op {
+    RW_MATCH_ID,        // Rule start: (can_id & mask) == a, else jump to next
+    RW_SET_ID,          // can_id = (can_id & ~mask) | a
+    RW_IF,              // (payload & mask) == a, else jump to next
+    RW_SET_BITS,        // payload = (payload & ~mask) | a
+    RW_CLAMP,           // Field at shift/mask limited to [a, b]
+    RW_DROP
+};
+
+#define RW_F_SWAP 0x01      // Motorola signal: the field is in the byte-swapped word
+#define RW_F_SIGNED 0x02
+
+struct rw_insn {
+    uint8_t op;
+    uint8_t shift;
+    uint8_t need;           // Payload bytes the instruction reads or writes
+    uint8_t flags;
+    uint16_t next;          // RW_MATCH_ID/RW_IF: first instruction of the next rule
+    uint64_t mask;
+    int64_t a;
+    int64_t b;
+};
+
+struct rw_program {
+    struct rw_insn code[FWD_MAX_DESTS][RW_MAX_INSNS];
+    int len[FWD_MAX_DESTS];
+    uint32_t dests;
+};
+
+// The active program and the one being built. Rules run in forward_frame()
+// on the event loop thread, where programs are also replaced.
+static struct rw_program programs[2];
+static struct rw_program* active = &programs[0];
+static struct rw_program* building = &programs[1];
+
+uint32_t rewrite_dests = 0;
+
+// A DBC signal resolved to payload word coordinates
+struct rw_field {
+    unsigned shift;
+    uint64_t mask;          // Unshifted
+    unsigned need;
+    bool swap;
+    bool is_signed;
+    double factor;
+    double offset;
+};
+
+static int find_signal(const char* text, struct rw_field* field) {
+    const char* dot = strchr(text, '.');
+
+    if (dot == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < DBC_NUM_SIGNALS; i++) {
+        const struct dbc_signal_desc* d = &dbc_signal_descs[i];
+        if (strlen(d->message) != (size_t)(dot - text) || strncmp(d->message, text, dot - text) != 0 ||
+            strcmp(d->name, dot + 1) != 0) {
+            continue;
+        }
+        // Same layout math as dbc_signal
+        unsigned msb = (d->start / 8) * 8 + (7 - d->start % 8);
+        field->shift = d->big_endian ? 63 - (msb + d->length - 1) : d->start;
+        field->mask = d->length == 64 ? ~(uint64_t)0 : ((uint64_t)1 << d->length) - 1;
+        field->need = (d->big_endian ? msb + d->length - 1 : d->start + d->length - 1) / 8 + 1;
+        field->swap = d->big_endian;
+        field->is_signed = d->is_signed;
+        field->factor = d->factor;
+        field->offset = d->offset;
+        return 0;
+    }
+    return -1;
+}
+
+// Raw value of a physical value, -1 if the signal cannot hold it
+static int to_raw(const struct rw_field* field, double phys, int64_t* raw) {
+    int64_t min = 0;
+    int64_t max = (int64_t)(field->mask >> 1);
+
+    if (!field->is_signed) {
+        max = field->mask > (uint64_t)INT64_MAX ? INT64_MAX : (int64_t)field->mask;
+    }
+    else {
+        min = -max - 1;
+    }
+    double value = round((phys - field->offset) / field->factor);
+    if (value < (double)min || value > (double)max) {
+        return -1;
+    }
+    *raw = (int64_t)value;
+    return 0;
+}
+
+// Mask and value constant of a field, on the little-endian payload word
+static void field_const(const struct rw_field* field, int64_t raw, uint64_t* mask, uint64_t* value) {
+    *mask = field->mask << field->shift;
+    *value = ((uint64_t)raw & field->mask) << field->shift;
+    if (field->swap) {
+        *mask = __builtin_bswap64(*mask);
+        *value = __builtin_bswap64(*value);
+    }
+}
+
+// Compile one operation into in. Returns -1 if it is not valid.
+static int compile_op(char* op, struct rw_insn* in) {
+    char* eq = strchr(op, '=');
+    char* end;
+    struct rw_field field;
+    uint64_t mask;
+    uint64_t value;
+
+    memset(in, 0, sizeof(*in));
+    if (strcmp(op, "drop") == 0) {
+        in->op = RW_DROP;
+        return 0;
+    }
+    if (eq == NULL) {
+        return -1;
+    }
+    *eq++ = '\0';
+
+    if (strcmp(op, "id") == 0 || strcmp(op, "sa") == 0 || strcmp(op, "da") == 0 ||
+        strcmp(op, "prio") == 0) {
+        value = strtoul(eq, &end, op[0] == 'p' ? 10 : 16);
+        if (end == eq || *end != '\0') {
+            return -1;
+        }
+        unsigned shift = op[0] == 'd' ? 8 : op[0] == 'p' ? 26 : 0;
+        mask = op[0] == 'i' ? CAN_EFF_MASK : op[0] == 'p' ? 0x07 : 0xFF;
+        if (value > mask) {
+            return -1;
+        }
+        in->op = RW_SET_ID;
+        in->mask = mask << shift;
+        in->a = value << shift;
+        return 0;
+    }
+    if (strncmp(op, "byte:", 5) == 0) {
+        unsigned index = strtoul(op + 5, &end, 10);
+        if (end == op + 5 || *end != '\0' || index > 7) {
+            return -1;
+        }
+        value = strtoul(eq, &end, 16);
+        mask = 0xFF;
+        if (*end == '/') {
+            mask = strtoul(end + 1, &end, 16);
+        }
+        if (*end != '\0' || value > 0xFF || mask > 0xFF) {
+            return -1;
+        }
+        in->op = RW_SET_BITS;
+        in->need = index + 1;
+        in->mask = mask << (8 * index);
+        in->a = (value & mask) << (8 * index);
+        return 0;
+    }
+
+    bool is_set = strncmp(op, "set:", 4) == 0;
+    bool is_if = strncmp(op, "if:", 3) == 0;
+    bool is_clamp = strncmp(op, "clamp:", 6) == 0;
+    if (!is_set && !is_if && !is_clamp) {
+        return -1;
+    }
+    if (find_signal(strchr(op, ':') + 1, &field) < 0) {
+        fprintf(stderr, "Unknown signal '%s' (expected MESSAGE.Signal)\n", strchr(op, ':') + 1);
+        return -1;
+    }
+    in->need = field.need;
+
+    if (is_clamp) {
+        char* dots = strstr(eq, "..");
+        if (dots == NULL) {
+            return -1;
+        }
+        *dots = '\0';
+        int64_t lo;
+        int64_t hi;
+        double min = strtod(eq, &end);
+        bool bad = end == eq || *end != '\0';
+        double max = strtod(dots + 2, &end);
+        bad = bad || end == dots + 2 || *end != '\0';
+        if (bad || to_raw(&field, min, &lo) < 0 || to_raw(&field, max, &hi) < 0 || lo > hi) {
+            return -1;
+        }
+        in->op = RW_CLAMP;
+        in->shift = field.shift;
+        in->mask = field.mask;
+        in->flags = (field.swap ? RW_F_SWAP : 0) | (field.is_signed ? RW_F_SIGNED : 0);
+        in->a = lo;
+        in->b = hi;
+        return 0;
+    }
+
+    int64_t raw;
+    double phys = strtod(eq, &end);
+    if (end == eq || *end != '\0' || to_raw(&field, phys, &raw) < 0) {
+        return -1;
+    }
+    field_const(&field, raw, &mask, &value);
+    in->op = is_set ? RW_SET_BITS : RW_IF;
+    in->mask = mask;
+    in->a = value;
+    return 0;
+}
+
+void rewrite_begin(void) {
+    // The program that is not active is free
+    building = active == &programs[0] ? &programs[1] : &programs[0];
+    memset(building->len, 0, sizeof(building->len));
+    building->dests = 0;
+}
+
+int rewrite_add(int dst, const char* rule) {
+    char buf[RW_RULE_MAX];
+    char* words[RW_MAX_OPS + 1];
+    int count = 0;
+
+    if (dst < 0 || dst >= FWD_MAX_DESTS) {
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%s", rule);
+    for (char* tok = strtok(buf, " \t"); tok != NULL; tok = strtok(NULL, " \t")) {
+        if (count > RW_MAX_OPS) {
+            fprintf(stderr, "Too many operations in rewrite rule '%s'\n", rule);
+            return -1;
+        }
+        words[count++] = tok;
+    }
+    if (count < 2) {
+        fprintf(stderr, "Invalid rewrite rule '%s' (expected id[/mask] op...)\n", rule);
+        return -1;
+    }
+    int start = building->len[dst];
+    if (start + count > RW_MAX_INSNS) {
+        fprintf(stderr, "Too many rewrite rules for interface %d\n", dst);
+        return -1;
+    }
+
+    struct rw_insn* code = building->code[dst];
+    canid_t id;
+    canid_t mask;
+    if (config_parse_id(words[0], &id, &mask) < 0) {
+        fprintf(stderr, "Invalid CAN ID/mask in rewrite rule '%s'\n", rule);
+        return -1;
+    }
+    memset(&code[start], 0, sizeof(code[start]));
+    code[start].op = RW_MATCH_ID;
+    code[start].mask = mask;
+    code[start].a = id & mask;
+    for (int i = 1; i < count; i++) {
+        if (compile_op(words[i], &code[start + i]) < 0) {
+            fprintf(stderr, "Invalid operation %d in rewrite rule '%s'\n", i, rule);
+            return -1;
+        }
+    }
+    // Failed conditions continue with the next rule
+    for (int i = 0; i < count; i++) {
+        code[start + i].next = start + count;
+    }
+    building->len[dst] = start + count;
+    building->dests |= 1u << dst;
+    return 0;
+}
+
+void rewrite_commit(void) {
+    __atomic_store_n(&active, building, __ATOMIC_RELEASE);
+    rewrite_dests = building->dests;
+}
+
+bool rewrite_run(int dst, struct canfd_frame* frame) {
+    const struct rw_program* prog = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    const struct rw_insn* code = prog->code[dst];
+    int len = prog->len[dst];
+    unsigned int data_len = can_frame_len(frame);
+    uint64_t word = dbc_load(frame->data);
+    bool dirty = false;
+
+    for (int pc = 0; pc < len; pc++) {
+        const struct rw_insn* in = &code[pc];
+
+        switch (in->op) {
+        case RW_MATCH_ID:
+            if ((frame->can_id & in->mask) != (canid_t)in->a) {
+                pc = in->next - 1;
+            }
+            break;
+        case RW_SET_ID:
+            frame->can_id = (frame->can_id & ~(canid_t)in->mask) | (canid_t)in->a;
+            break;
+        case RW_IF:
+            if (data_len < in->need || (word & in->mask) != (uint64_t)in->a) {
+                pc = in->next - 1;
+            }
+            break;
+        case RW_SET_BITS:
+            if (data_len >= in->need) {
+                word = (word & ~in->mask) | (uint64_t)in->a;
+                dirty = true;
+            }
+            break;
+        case RW_CLAMP: {
+            if (data_len < in->need) {
+                break;
+            }
+            uint64_t w = (in->flags & RW_F_SWAP) ? __builtin_bswap64(word) : word;
+            uint64_t bits = (w >> in->shift) & in->mask;
+            int64_t raw = (int64_t)bits;
+            if (in->flags & RW_F_SIGNED) {
+                unsigned int top = 63 - __builtin_clzll(in->mask);
+                raw = (int64_t)(bits << (63 - top)) >> (63 - top);
+            }
+            if (raw >= in->a && raw <= in->b) {
+                break;
+            }
+            raw = raw < in->a ? in->a : in->b;
+            w = (w & ~(in->mask << in->shift)) | (((uint64_t)raw & in->mask) << in->shift);
+            word = (in->flags & RW_F_SWAP) ? __builtin_bswap64(w) : w;
+            dirty = true;
+            break;
+        }
+        case RW_DROP:
+            return false;
+        }
+    }
+
+    if (dirty) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        memcpy(frame->data, &word, 8);
+    }
+    return true;
+}
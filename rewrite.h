@@ -0,0 +1,71 @@
+/*
+ * Frame rewrite rules for the forwarding path
+ *
+ * Rules are attached to a destination interface and run on every frame
+ * queued to it, in the order they were added. Each rule is
+ *
+ *   id[/mask] op [op...]
+ *
+ * and applies to frames with (can_id & mask) == id (mask defaults to all
+ * 29 ID bits). Operations:
+ *
+ *   id=18FF0290                  replace the 29-bit identifier
+ *   sa=90, da=00, prio=3         replace one J1939 identifier field
+ *   byte:2=F0[/F0]               set the bits of a data byte (under mask)
+ *   set:TSC1.RequestedTorque=0   set a DBC signal to a physical value
+ *   clamp:TSC1.RequestedSpeed=0..2000
+ *                                limit a DBC signal to a physical range
+ *   if:KEYPAD.BTN3=1             skip the rest of the rule unless the
+ *                                signal has this value
+ *   drop                         do not forward the frame
+ *
+ * Rules are compiled when they are added: identifier fields become one
+ * masked store, signals become shift/mask constants on the 64-bit payload
+ * word (resolved from the DBC signal table), physical values become raw
+ * values. A rule runs as a few instructions of a flat bytecode, and a rule
+ * whose ID does not match costs one compare. Data operations do not apply
+ * to frames too short to hold the signal, and only see the first 8 bytes
+ * of FD frames.
+ *
+ * Like the routing table, the compiled program is built aside by
+ * rewrite_begin()/rewrite_add() and made active with one pointer store by
+ * rewrite_commit(), so rules can be replaced while traffic flows.
+ */
+
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+#include "forward.h"
+
+// Instructions per destination interface (a rule takes 1 + one per op)
+#define RW_MAX_INSNS 128
+
+// Destinations with at least one rule in the active program (bit per
+// interface index)
+extern uint32_t rewrite_dests;
+
+// Start building a new program (replaces any uncommitted one)
+void rewrite_begin(void);
+
+// Compile a rule for frames sent on interface dst into the new program.
+// Returns 0, or -1 with a message on stderr.
+int rewrite_add(int dst, const char* rule);
+
+// Make the new program the active one
+void rewrite_commit(void);
+
+// Run the rules of dst on a frame. Returns false if a rule dropped it.
+bool rewrite_run(int dst, struct canfd_frame* frame);
+
+static inline bool rewrite_frame(int dst, struct canfd_frame* frame) {
+    if (rewrite_dests & (1u << dst)) {
+        return rewrite_run(dst, frame);
+    }
+    return true;
+}
+
+#endif // REWRITE_H
@@ -0,0 +1,251 @@
+/*
+ * Optional per-interface RX threads
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "rx_threads.h"
+#include "can_rx.h"
+#include "clock_util.h"
+#include "forward.h"
+#include "health.h"
+#include "pipeline.h"
+#include "spsc_ring.h"
+#include "stats.h"
+#include "tx_sched.h"
+#include "usdt.h"
+
+// Frame handed from an RX thread to the downstream stage
+struct rx_item {
+    struct canfd_frame frame;
+    uint64_t wire_ts;
+    uint64_t user_ts;
+};
+
+struct rx_thread {
+    pthread_t tid;
+    bool started;
+    struct can_iface* iface;
+    struct rx_thread_cfg cfg;
+    struct rx_batch batch;
+    struct spsc_ring<struct rx_item> queue;
+    uint64_t queue_drops;
+    uint64_t heartbeat_ns;
+};
+
+static struct rx_thread* threads[MAX_CAN_IFACES];
+static int num_threads = 0;
+static volatile bool threads_running = false;
+
+// Wakeup for the event loop thread; wake_pending avoids one eventfd write
+// per batch while the loop thread has not caught up yet
+static struct event_source wake_ev;
+static bool wake_pending = false;
+
+static void wake_loop(void) {
+    if (!__atomic_exchange_n(&wake_pending, true, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(wake_ev.fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("Error waking event loop");
+        }
+    }
+}
+
+// Event loop side: drain every queue into logging/forwarding
+static void on_wake(struct event_source* src, uint32_t events) {
+    struct rx_item items[RX_BATCH_SIZE];
+    uint64_t count;
+    (void)events;
+
+    if (read(src->fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("Error reading wakeup eventfd");
+    }
+    __atomic_store_n(&wake_pending, false, __ATOMIC_SEQ_CST);
+
+    bool any = false;
+    for (int t = 0; t < num_threads; t++) {
+        struct rx_thread* th = threads[t];
+        uint32_t n;
+
+        while ((n = spsc_pop_batch(&th->queue, items, RX_BATCH_SIZE)) > 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                pipeline_downstream(th->iface->index, &items[i].frame, items[i].wire_ts, items[i].user_ts);
+            }
+            any = true;
+        }
+    }
+
+    if (any) {
+        forward_flush();
+    }
+}
+
+static void apply_scheduling(struct rx_thread* th) {
+    if (th->cfg.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(th->cfg.cpu, &set);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0) {
+            fprintf(stderr, "Warning: %s RX thread: cannot pin to CPU %d: %s\n",
+                    th->iface->name, th->cfg.cpu, strerror(ret));
+        }
+    }
+
+    if (th->cfg.priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = th->cfg.priority;
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0) {
+            fprintf(stderr, "Warning: %s RX thread: cannot set SCHED_FIFO %d: %s\n",
+                    th->iface->name, th->cfg.priority, strerror(ret));
+        }
+    }
+}
+
+static void* rx_thread_main(void* arg) {
+    struct rx_thread* th = (struct rx_thread*)arg;
+    struct can_iface* iface = th->iface;
+
+    apply_scheduling(th);
+
+    while (__atomic_load_n(&threads_running, __ATOMIC_ACQUIRE)) {
+        int n = rx_batch_wait(iface->sock, &th->batch);
+        __atomic_store_n(&th->heartbeat_ns, monotonic_ns(), __ATOMIC_RELAXED);
+        if (n <= 0) {
+            continue;   // Timeout (shutdown check), EINTR or read error
+        }
+
+        uint64_t ts = th->batch.user_ts;
+        bool queued = false;
+        PROBE2(rx_batch_start, iface->index, th->batch.count);
+        health_rx(iface->index);
+        stats_kernel_drops(iface->index, th->batch.drops);
+        for (int i = 0; i < th->batch.count; i++) {
+            const struct canfd_frame* frame = &th->batch.frames[i];
+            uint64_t wire_ts = th->batch.rx_ts[i];
+
+            if (th->batch.local[i] && tx_sched_echo(iface->index, frame, wire_ts != 0 ? wire_ts : ts)) {
+                continue;
+            }
+            if (!pipeline_rx_frame(iface, frame, wire_ts, ts)) {
+                continue;
+            }
+
+            struct rx_item item;
+            item.frame = *frame;
+            item.wire_ts = wire_ts;
+            item.user_ts = ts;
+            if (spsc_push(&th->queue, item)) {
+                queued = true;
+            }
+            else {
+                __atomic_fetch_add(&th->queue_drops, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        if (queued) {
+            wake_loop();
+        }
+        PROBE2(rx_batch_end, iface->index, th->batch.count);
+    }
+
+    return NULL;
+}
+
+int rx_threads_start(struct can_iface* ifaces, int count, const struct rx_thread_cfg* cfg,
+                     struct event_loop* loop) {
+    wake_ev.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_ev.fd < 0) {
+        perror("Error creating eventfd");
+        return -1;
+    }
+    wake_ev.handler = on_wake;
+    wake_ev.ctx = NULL;
+    if (event_loop_add(loop, &wake_ev, EPOLLIN) < 0) {
+        return -1;
+    }
+
+    threads_running = true;
+    for (int i = 0; i < count && i < MAX_CAN_IFACES; i++) {
+        // Cache-line aligned so the queue indices do not share lines
+        struct rx_thread* th = (struct rx_thread*)arena_alloc(sizeof(struct rx_thread), SPSC_CACHE_LINE,
+                                                              "rx threads");
+        if (th == NULL || spsc_init(&th->queue, RX_THREAD_QUEUE_SIZE, "rx queues") < 0) {
+            fprintf(stderr, "Failed to allocate RX thread for %s\n", ifaces[i].name);
+            arena_free(th);
+            return -1;
+        }
+        th->iface = &ifaces[i];
+        th->cfg = cfg[i];
+        th->heartbeat_ns = monotonic_ns();
+        rx_batch_init(&th->batch);
+        threads[num_threads++] = th;
+
+        // Blocking reads wake up periodically to notice shutdown
+        struct timeval tv = { 0, RX_THREAD_POLL_MS * 1000 };
+        setsockopt(ifaces[i].sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        pthread_attr_t attr;
+        arena_thread_attr(&attr);
+        int ret = pthread_create(&th->tid, &attr, rx_thread_main, th);
+        pthread_attr_destroy(&attr);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to start RX thread for %s: %s\n", ifaces[i].name, strerror(ret));
+            return -1;
+        }
+        th->started = true;
+
+        printf("  %s: RX thread (cpu %d, %s %d)\n", ifaces[i].name, cfg[i].cpu,
+               cfg[i].priority > 0 ? "SCHED_FIFO" : "SCHED_OTHER", cfg[i].priority);
+    }
+    return 0;
+}
+
+void rx_threads_stop(void) {
+    __atomic_store_n(&threads_running, false, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (threads[i]->started) {
+            pthread_join(threads[i]->tid, NULL);
+        }
+        spsc_free(&threads[i]->queue);
+        arena_free(threads[i]);
+        threads[i] = NULL;
+    }
+    num_threads = 0;
+
+    if (wake_ev.fd >= 0) {
+        close(wake_ev.fd);
+        wake_ev.fd = -1;
+    }
+}
+
+uint64_t rx_thread_heartbeat(int index) {
+    for (int i = 0; i < num_threads; i++) {
+        if (threads[i]->iface->index == index) {
+            return __atomic_load_n(&threads[i]->heartbeat_ns, __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+uint64_t rx_thread_queue_drops(int index) {
+    for (int i = 0; i < num_threads; i++) {
+        if (threads[i]->iface->index == index) {
+            return __atomic_load_n(&threads[i]->queue_drops, __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
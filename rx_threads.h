@@ -0,0 +1,48 @@
+/*
+ * Optional per-interface RX threads
+ *
+ * Each interface socket gets its own thread that receives, timestamps and
+ * decodes frames (the pipeline RX stage), optionally pinned to a CPU and
+ * running with SCHED_FIFO. Frames for logging and forwarding are passed to
+ * the event loop thread through one lock-free SPSC queue per interface, so
+ * a slow decode on one bus no longer delays the others.
+ */
+
+#ifndef RX_THREADS_H
+#define RX_THREADS_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "can_iface.h"
+#include "event_loop.h"
+
+// Frames queued between an RX thread and the event loop thread
+#define RX_THREAD_QUEUE_SIZE 1024
+
+// How often a blocked RX thread checks for shutdown
+#define RX_THREAD_POLL_MS 100
+
+// Scheduling for one RX thread
+struct rx_thread_cfg {
+    int cpu;                // CPU to pin to, -1 for no affinity
+    int priority;           // SCHED_FIFO priority, 0 for SCHED_OTHER
+};
+
+// Start one RX thread per interface and register the wakeup eventfd with
+// the event loop. cfg has one entry per interface. Returns 0 or -1.
+int rx_threads_start(struct can_iface* ifaces, int count, const struct rx_thread_cfg* cfg,
+                     struct event_loop* loop);
+
+// Stop and join all RX threads
+void rx_threads_stop(void);
+
+// Frames dropped because an interface's queue was full
+uint64_t rx_thread_queue_drops(int index);
+
+// CLOCK_MONOTONIC ns at which an interface's RX thread last returned from
+// its socket (at least every RX_THREAD_POLL_MS while it is not stuck in
+// the RX stage), 0 if the interface has no RX thread
+uint64_t rx_thread_heartbeat(int index);
+
+#endif // RX_THREADS_H
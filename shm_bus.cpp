@@ -0,0 +1,132 @@
+/*
+ * Shared-memory frame bus for local consumer processes
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "shm_bus.h"
+#include "arena.h"
+#include "clock_util.h"
+#include "decoders.h"
+
+// The word-wise copies need whole words, and the slots must fit the state
+static_assert(sizeof(struct shm_bus_record) % 8 == 0, "record is not a multiple of 8 bytes");
+static_assert(sizeof(struct shm_bus_signal) % 8 == 0, "signal slot is not a multiple of 8 bytes");
+static_assert(sizeof(struct keypad_state) <= SHM_BUS_SIGNAL_SIZE, "keypad state too large");
+static_assert(sizeof(struct tsc1_request) <= SHM_BUS_SIGNAL_SIZE, "TSC1 request too large");
+static_assert(sizeof(struct dm1_state) <= SHM_BUS_SIGNAL_SIZE, "DM1 state too large");
+
+struct shm_bus* shm_bus = NULL;
+
+static const char* shm_path = NULL;
+
+int shm_bus_open(const char* name, uint32_t frames, const char* const* iface_names, int count) {
+    if (name[0] != '/' || strchr(name + 1, '/') != NULL) {
+        fprintf(stderr, "Invalid frame bus name '%s' (expected /name)\n", name);
+        return -1;
+    }
+    if (frames == 0 || (frames & (frames - 1)) != 0) {
+        fprintf(stderr, "Frame bus size %u is not a power of two\n", frames);
+        return -1;
+    }
+
+    size_t size = sizeof(struct shm_bus) + (size_t)frames * sizeof(struct shm_bus_record);
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error creating frame bus");
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0) {
+        perror("Error sizing frame bus");
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping frame bus");
+        shm_unlink(name);
+        return -1;
+    }
+    arena_charge("frame bus", size);
+
+    // A freshly truncated object is zero: no records, no decoded state
+    struct shm_bus* bus = (struct shm_bus*)map;
+    bus->version = SHM_BUS_VERSION;
+    bus->capacity = frames;
+    bus->record_size = sizeof(struct shm_bus_record);
+    bus->num_ifaces = count;
+    bus->size = size;
+    for (int i = 0; i < count; i++) {
+        snprintf(bus->iface_names[i], sizeof(bus->iface_names[i]), "%s", iface_names[i]);
+    }
+
+    // The magic goes last: a reader that finds it finds a complete header
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(bus->magic, SHM_BUS_MAGIC, sizeof(SHM_BUS_MAGIC));
+
+    shm_path = name;
+    shm_bus = bus;
+    return 0;
+}
+
+void shm_bus_publish_frame(uint64_t ts_ns, int iface, const struct canfd_frame* frame) {
+    if (shm_bus == NULL) {
+        return;
+    }
+
+    uint64_t pos = shm_bus->head;
+    struct shm_bus_record* rec = &shm_bus->records[pos & (shm_bus->capacity - 1)];
+    struct shm_bus_record tmp;
+
+    tmp.seq = 2 * pos + 2;
+    tmp.ts_ns = ts_ns;
+    tmp.iface = iface;
+    tmp.reserved = 0;
+    // Only the frame's MTU is read (a replayed frame may be a view of a
+    // classic capture record)
+    size_t mtu = can_frame_mtu(frame);
+    memcpy(&tmp.frame, frame, mtu);
+    memset((char*)&tmp.frame + mtu, 0, sizeof(tmp.frame) - mtu);
+
+    // Odd while the words change, then the final number and the new head
+    __atomic_store_n(&rec->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shm_bus_copy((uint64_t*)rec + 1, (const uint64_t*)&tmp + 1, sizeof(tmp) / 8 - 1);
+    __atomic_store_n(&rec->seq, tmp.seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm_bus->head, pos + 1, __ATOMIC_RELEASE);
+}
+
+void shm_bus_publish_signal(uint64_t ts_ns, int iface, int kind, const void* data, size_t size) {
+    if (shm_bus == NULL) {
+        return;
+    }
+
+    struct shm_bus_signal* sig = &shm_bus->signals[iface][kind];
+    struct shm_bus_signal tmp;
+    uint64_t seq = sig->seq;
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.ts_ns = ts_ns != 0 ? ts_ns : realtime_ns();
+    tmp.len = size;
+    memcpy(tmp.data, data, size);
+
+    __atomic_store_n(&sig->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shm_bus_copy((uint64_t*)sig + 1, (const uint64_t*)&tmp + 1, sizeof(tmp) / 8 - 1);
+    __atomic_store_n(&sig->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void shm_bus_close(void) {
+    // Readers that have it mapped keep the last state; new ones cannot open it
+    if (shm_path != NULL) {
+        shm_unlink(shm_path);
+        shm_path = NULL;
+    }
+}
@@ -0,0 +1,176 @@
+/*
+ * Shared-memory frame bus for local consumer processes
+ *
+ * With -b the bridge publishes every frame that reaches the downstream
+ * stage into a ring in a POSIX shared memory object, and the latest
+ * decoded keypad, TSC1 and DM1 state of each interface into fixed slots
+ * next to it. Any number of processes map the object read-only and
+ * consume it with the inline reader functions below: no syscalls, no
+ * locks and no copy through the kernel.
+ *
+ * The ring has a single writer (the downstream stage) and never waits for
+ * readers. Every record carries a sequence number that is odd while the
+ * record is being written; a reader that checks it before and after
+ * copying a record knows whether the copy is intact. Readers that fall
+ * more than the ring size behind lose the oldest records and are told how
+ * many. Signal slots work the same way with one writer per interface (its
+ * RX path).
+ */
+
+#ifndef SHM_BUS_H
+#define SHM_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <net/if.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+#include "can_iface.h"
+
+#define SHM_BUS_MAGIC "CANBUS"
+#define SHM_BUS_VERSION 1
+
+// Ring size used by -b without a size (records, power of two)
+#define SHM_BUS_DEFAULT_FRAMES 4096
+
+// Decoded state published per interface
+enum shm_bus_signal_kind {
+    SHM_BUS_KEYPAD,             // struct keypad_state (decoders.h)
+    SHM_BUS_TSC1,               // struct tsc1_request
+    SHM_BUS_DM1,                // struct dm1_state
+    SHM_BUS_SIGNAL_KINDS
+};
+
+// Largest decoded state a signal slot holds
+#define SHM_BUS_SIGNAL_SIZE 160
+
+// One received frame. All fields are 8-byte words for the word-wise copy.
+struct shm_bus_record {
+    uint64_t seq;               // 2 * position + 2 once written, odd while writing
+    uint64_t ts_ns;             // RX time (CLOCK_REALTIME)
+    uint32_t iface;
+    uint32_t reserved;
+    struct canfd_frame frame;   // CANFD_FDF set for FD frames
+};
+
+struct shm_bus_signal {
+    uint64_t seq;               // Even when stable, incremented around each update
+    uint64_t ts_ns;             // RX time of the message decoded last
+    uint32_t len;               // Bytes of data in use, 0 while never decoded
+    uint32_t reserved;
+    uint64_t data[SHM_BUS_SIGNAL_SIZE / 8];
+};
+
+struct shm_bus {
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;          // Records in the ring (power of two)
+    uint32_t record_size;       // sizeof(struct shm_bus_record)
+    uint32_t num_ifaces;
+    uint64_t size;              // Bytes of the whole object
+    char iface_names[MAX_CAN_IFACES][IFNAMSIZ];
+    struct shm_bus_signal signals[MAX_CAN_IFACES][SHM_BUS_SIGNAL_KINDS];
+
+    // Records written so far; written by the bridge only
+    alignas(64) uint64_t head;
+    alignas(64) struct shm_bus_record records[];
+};
+
+// Copy n 8-byte words with relaxed atomics, so the writer and a racing
+// reader never tear a word (a torn record is caught by its sequence number)
+static inline void shm_bus_copy(uint64_t* dst, const uint64_t* src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        __atomic_store_n(&dst[i], __atomic_load_n(&src[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}
+
+// Reader: copy the record at *pos into out. Returns 1 and advances *pos,
+// or 0 if no new record was written yet. Records overwritten before they
+// were read are skipped and added to *lost. Start with *pos = head to
+// only see new frames, or 0 for everything still in the ring.
+static inline int shm_bus_read(const struct shm_bus* bus, uint64_t* pos, struct shm_bus_record* out,
+                               uint64_t* lost) {
+    for (;;) {
+        uint64_t head = __atomic_load_n(&bus->head, __ATOMIC_ACQUIRE);
+        if (*pos >= head) {
+            return 0;
+        }
+        if (head - *pos > bus->capacity) {
+            *lost += head - bus->capacity - *pos;
+            *pos = head - bus->capacity;
+        }
+
+        // Below head the record is complete unless the writer has lapped us
+        // and is reusing it
+        const struct shm_bus_record* rec = &bus->records[*pos & (bus->capacity - 1)];
+        uint64_t expect = 2 * *pos + 2;
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == expect) {
+            shm_bus_copy((uint64_t*)out, (const uint64_t*)rec, sizeof(*out) / 8);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == expect) {
+                (*pos)++;
+                return 1;
+            }
+        }
+        (*lost)++;
+        (*pos)++;
+    }
+}
+
+// Attempts to get a stable copy of a signal slot before giving up (the
+// writer stopped in the middle of an update)
+#define SHM_BUS_READ_RETRIES 1000
+
+// Reader: copy the latest decoded state of one kind on an interface into
+// out (size bytes). Returns the number of bytes copied, 0 if it was never
+// decoded.
+static inline size_t shm_bus_read_signal(const struct shm_bus* bus, int iface, int kind, void* out,
+                                         size_t size, uint64_t* ts_ns) {
+    const struct shm_bus_signal* sig = &bus->signals[iface][kind];
+    struct shm_bus_signal copy;
+    int tries = 0;
+
+    for (;;) {
+        if (++tries > SHM_BUS_READ_RETRIES) {
+            return 0;
+        }
+        // Odd while an update is in progress (it takes nanoseconds)
+        uint64_t seq = __atomic_load_n(&sig->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        shm_bus_copy((uint64_t*)&copy, (const uint64_t*)sig, sizeof(copy) / 8);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sig->seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
+
+    size_t len = copy.len < size ? copy.len : size;
+    memcpy(out, copy.data, len);
+    if (ts_ns != NULL) {
+        *ts_ns = copy.ts_ns;
+    }
+    return len;
+}
+
+// The published bus, NULL when -b is not used
+extern struct shm_bus* shm_bus;
+
+// Create the shared memory object name ("/name") with a ring of frames
+// records (power of two). Returns 0 or -1.
+int shm_bus_open(const char* name, uint32_t frames, const char* const* iface_names, int count);
+
+// Publish a frame (downstream stage)
+void shm_bus_publish_frame(uint64_t ts_ns, int iface, const struct canfd_frame* frame);
+
+// Publish decoded state (the interface's RX path), decoded from a message
+// received at ts_ns (CLOCK_REALTIME, the time of publishing if 0)
+void shm_bus_publish_signal(uint64_t ts_ns, int iface, int kind, const void* data, size_t size);
+
+// Remove the object; mapped readers keep what they have
+void shm_bus_close(void);
+
+#endif // SHM_BUS_H
@@ -0,0 +1,118 @@
+/*
+ * J1939 signal state store
+ */
+
+#include <string.h>
+
+#include "signal_store.h"
+#include "dispatch.h"
+
+#define SIGNAL_STORE_MASK (SIGNAL_STORE_SIZE - 1)
+
+struct signal_table {
+    struct signal_entry entries[SIGNAL_STORE_SIZE];
+    int count;
+    bool ready;
+};
+
+static struct signal_table tables[MAX_CAN_IFACES];
+
+static inline uint32_t make_key(uint32_t pgn, uint8_t sa, uint8_t da) {
+    // PDU1 PGNs have a zero PS byte, which takes the destination
+    if (((pgn >> 8) & 0xFF) < 240) {
+        pgn |= da;
+    }
+    return ((pgn & 0x3FFFF) << 8) | sa;
+}
+
+static inline unsigned int hash_key(uint32_t key) {
+    return (key * 2654435769u) >> (32 - SIGNAL_STORE_BITS);
+}
+
+static struct signal_table* get_table(int iface) {
+    if (iface < 0 || iface >= MAX_CAN_IFACES) {
+        return NULL;
+    }
+
+    struct signal_table* t = &tables[iface];
+    if (!t->ready) {
+        for (int i = 0; i < SIGNAL_STORE_SIZE; i++) {
+            t->entries[i].key = SIGNAL_KEY_EMPTY;
+        }
+        t->ready = true;
+    }
+    return t;
+}
+
+// Find the slot for key: either the matching entry or the empty slot where
+// it would be inserted (table is never more than half full)
+static struct signal_entry* find_slot(struct signal_table* t, uint32_t key) {
+    unsigned int slot = hash_key(key);
+
+    for (;;) {
+        struct signal_entry* e = &t->entries[slot];
+        if (e->key == key || e->key == SIGNAL_KEY_EMPTY) {
+            return e;
+        }
+        slot = (slot + 1) & SIGNAL_STORE_MASK;
+    }
+}
+
+// Load up to 8 payload bytes into a zero-padded word
+static inline uint64_t load_payload(const uint8_t* data, unsigned int len) {
+    uint64_t word = 0;
+    memcpy(&word, data, len < 8 ? len : 8);
+    return word;
+}
+
+const struct signal_entry* signal_store_update(const struct j1939_msg* msg, bool* changed) {
+    struct signal_table* t = get_table(msg->iface);
+    uint32_t key = make_key(msg->pgn, msg->sa, msg->da);
+
+    *changed = true;
+    if (t == NULL) {
+        return NULL;
+    }
+
+    struct signal_entry* e = find_slot(t, key);
+    unsigned int len = msg->len < 8 ? msg->len : 8;
+    uint64_t word = load_payload(msg->data, len);
+
+    if (e->key == SIGNAL_KEY_EMPTY) {
+        if (t->count >= SIGNAL_STORE_MAX_ENTRIES) {
+            return NULL;
+        }
+        e->key = key;
+        e->len = len;
+        memcpy(e->data, &word, 8);
+        memset(e->prev, 0, 8);
+        e->changes = 1;
+        e->repeats = 0;
+        t->count++;
+        return e;
+    }
+
+    uint64_t cached;
+    memcpy(&cached, e->data, 8);
+    if (cached == word && e->len == len && msg->len <= 8) {
+        e->repeats++;
+        *changed = false;
+        return e;
+    }
+
+    memcpy(e->prev, e->data, 8);
+    memcpy(e->data, &word, 8);
+    e->len = len;
+    e->changes++;
+    return e;
+}
+
+const struct signal_entry* signal_store_find(int iface, uint32_t pgn, uint8_t sa, uint8_t da) {
+    struct signal_table* t = get_table(iface);
+    if (t == NULL) {
+        return NULL;
+    }
+
+    struct signal_entry* e = find_slot(t, make_key(pgn, sa, da));
+    return e->key == SIGNAL_KEY_EMPTY ? NULL : e;
+}
@@ -0,0 +1,51 @@
+/*
+ * J1939 signal state store
+ *
+ * Caches the last payload per (interface, source address, PGN) so repeated
+ * messages can be recognised with one 8-byte compare. Decoders, and with
+ * them the shm bus signals they publish, only run when the payload actually
+ * changed. Each interface
+ * has its own table, so RX threads never write to a shared table. PDU1
+ * PGNs are cached per destination address as well, so a message to one
+ * node never makes the same payload to another look repeated.
+ */
+
+#ifndef SIGNAL_STORE_H
+#define SIGNAL_STORE_H
+
+#include <stdint.h>
+
+#include "can_iface.h"
+
+// Slots per interface table (power of two, at most half used)
+#define SIGNAL_STORE_BITS 9
+#define SIGNAL_STORE_SIZE (1 << SIGNAL_STORE_BITS)
+#define SIGNAL_STORE_MAX_ENTRIES (SIGNAL_STORE_SIZE / 2)
+
+struct j1939_msg;
+
+// Cached state of one (interface, SA, PGN) stream. Only the first 8 bytes
+// are compared, so messages longer than that (CAN-FD) always count as
+// changed.
+struct signal_entry {
+    uint32_t key;           // (PGN << 8) | SA, PDU1 PGNs with the DA in the
+                            // PS byte; SIGNAL_KEY_EMPTY if unused
+    uint8_t len;            // Payload length (bytes beyond 8 are not cached)
+    uint8_t data[8];        // Current payload
+    uint8_t prev[8];        // Payload before the last change (zeros when new)
+    uint32_t changes;       // Number of payload changes (first message included)
+    uint32_t repeats;       // Messages with an unchanged payload
+};
+
+#define SIGNAL_KEY_EMPTY 0xFFFFFFFFu
+
+// Record a message. Returns the stream's entry and sets *changed when the
+// payload differs from the cached one (or the stream is new). Returns NULL
+// with *changed set if the interface table is full.
+const struct signal_entry* signal_store_update(const struct j1939_msg* msg, bool* changed);
+
+// Look up the cached state of a stream, NULL if it was never seen (da is
+// ignored for PDU2 PGNs)
+const struct signal_entry* signal_store_find(int iface, uint32_t pgn, uint8_t sa, uint8_t da);
+
+#endif // SIGNAL_STORE_H
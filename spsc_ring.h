@@ -0,0 +1,106 @@
+/*
+ * Lock-free single-producer/single-consumer ring
+ *
+ * One thread pushes, one other thread pops. Head and tail live on separate
+ * cache lines and each side keeps a cached copy of the other side's index,
+ * so the common case touches no shared cache line except the slot itself.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define SPSC_CACHE_LINE 64
+
+template <typename T>
+struct spsc_ring {
+    T* slots;
+    uint32_t mask;
+
+    // Producer side
+    alignas(SPSC_CACHE_LINE) uint32_t head;
+    uint32_t cached_tail;
+
+    // Consumer side
+    alignas(SPSC_CACHE_LINE) uint32_t tail;
+    uint32_t cached_head;
+};
+
+// Allocate a ring with capacity rounded up to a power of two from the
+// startup arena (charged to owner). Returns 0 on success, -1 on allocation
+// failure.
+template <typename T>
+int spsc_init(struct spsc_ring<T>* ring, uint32_t capacity, const char* owner) {
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring->slots = (T*)arena_alloc((size_t)size * sizeof(T), SPSC_CACHE_LINE, owner);
+    if (ring->slots == NULL) {
+        return -1;
+    }
+    ring->mask = size - 1;
+    ring->head = ring->cached_tail = 0;
+    ring->tail = ring->cached_head = 0;
+    return 0;
+}
+
+template <typename T>
+void spsc_free(struct spsc_ring<T>* ring) {
+    arena_free(ring->slots);
+    ring->slots = NULL;
+}
+
+// Producer: push one item. Returns false if the ring is full.
+template <typename T>
+inline bool spsc_push(struct spsc_ring<T>* ring, const T& item) {
+    uint32_t head = ring->head;
+
+    if (head - ring->cached_tail > ring->mask) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->cached_tail > ring->mask) {
+            return false;
+        }
+    }
+
+    ring->slots[head & ring->mask] = item;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Consumer: pop up to max items into out. Returns the number popped.
+template <typename T>
+inline uint32_t spsc_pop_batch(struct spsc_ring<T>* ring, T* out, uint32_t max) {
+    uint32_t tail = ring->tail;
+
+    if (ring->cached_head == tail) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (ring->cached_head == tail) {
+            return 0;
+        }
+    }
+
+    uint32_t count = ring->cached_head - tail;
+    if (count > max) {
+        count = max;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = ring->slots[(tail + i) & ring->mask];
+    }
+
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+// Consumer: pop one item. Returns false if the ring is empty.
+template <typename T>
+inline bool spsc_pop(struct spsc_ring<T>* ring, T* out) {
+    return spsc_pop_batch(ring, out, 1) == 1;
+}
+
+#endif // SPSC_RING_H
@@ -0,0 +1,348 @@
+/*
+ * Live statistics segment
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <linux/can/netlink.h>
+
+#include "stats.h"
+#include "arena.h"
+#include "clock_util.h"
+#include "forward.h"
+#include "health.h"
+#include "latency.h"
+#include "log_ring.h"
+#include "rx_threads.h"
+
+// Controller counters, as the netdev statistics in sysfs name them
+enum { NETDEV_RX_PACKETS, NETDEV_RX_BYTES, NETDEV_TX_PACKETS, NETDEV_TX_BYTES, NETDEV_COUNTERS };
+
+static const char* const netdev_files[NETDEV_COUNTERS] = {
+    "rx_packets", "rx_bytes", "tx_packets", "tx_bytes"
+};
+
+// Bus load source of one interface
+struct load_state {
+    int fds[NETDEV_COUNTERS];           // -1 when sysfs has no statistics
+    uint64_t last[NETDEV_COUNTERS];
+};
+
+static struct stats_segment local_segment;
+struct stats_segment* stats = &local_segment;
+
+static struct load_state loads[MAX_CAN_IFACES];
+static uint64_t last_publish_ns = 0;
+static const char* shm_path = NULL;
+static struct event_source timer_ev = { -1, NULL, NULL };
+
+static bool read_counter(int fd, uint64_t* value) {
+    char buf[32];
+
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    *value = strtoull(buf, NULL, 10);
+    return true;
+}
+
+// Frames and data bytes put on the bus by anyone (controller statistics,
+// which kernel filters do not affect), or if the interface has none, by
+// the bridge itself (vcan, replay)
+static void bus_counters(int i, uint64_t* counters) {
+    struct load_state* ls = &loads[i];
+    const struct stats_iface* st = &stats->ifaces[i];
+
+    if (ls->fds[0] >= 0) {
+        for (int c = 0; c < NETDEV_COUNTERS; c++) {
+            if (!read_counter(ls->fds[c], &counters[c])) {
+                counters[c] = ls->last[c];
+            }
+        }
+        return;
+    }
+    counters[NETDEV_RX_PACKETS] = __atomic_load_n(&st->rx_frames, __ATOMIC_RELAXED);
+    counters[NETDEV_RX_BYTES] = __atomic_load_n(&st->rx_bytes, __ATOMIC_RELAXED);
+    counters[NETDEV_TX_PACKETS] = st->tx_frames;
+    counters[NETDEV_TX_BYTES] = st->tx_bytes;
+}
+
+// Time the frames since the last interval occupied the bus, as a share of
+// the interval. The data phase of CAN-FD frames runs at the data bitrate.
+static uint32_t bus_load(int i, uint64_t interval_ns) {
+    struct load_state* ls = &loads[i];
+    const struct stats_iface* st = &stats->ifaces[i];
+    uint64_t counters[NETDEV_COUNTERS];
+
+    bus_counters(i, counters);
+    uint64_t frames = (counters[NETDEV_RX_PACKETS] - ls->last[NETDEV_RX_PACKETS]) +
+                      (counters[NETDEV_TX_PACKETS] - ls->last[NETDEV_TX_PACKETS]);
+    uint64_t bytes = (counters[NETDEV_RX_BYTES] - ls->last[NETDEV_RX_BYTES]) +
+                     (counters[NETDEV_TX_BYTES] - ls->last[NETDEV_TX_BYTES]);
+    memcpy(ls->last, counters, sizeof(ls->last));
+
+    if (st->bitrate == 0 || interval_ns == 0) {
+        return 0;
+    }
+    double data_rate = st->dbitrate > 0 ? st->dbitrate : st->bitrate;
+    double busy_s = (double)frames * STATS_FRAME_OVERHEAD_BITS / st->bitrate + bytes * 8.0 / data_rate;
+    double load = busy_s * 1e9 / interval_ns;
+    return load > 1.0 ? 10000 : (uint32_t)(load * 10000 + 0.5);
+}
+
+static void publish_cyclic(void) {
+    int count = tx_sched_count();
+
+    for (int n = 0; n < count; n++) {
+        const struct tx_sched_msg* msg = tx_sched_msg(n);
+        const struct tx_sched_stats* ts = tx_sched_stats(n);
+        struct stats_cyclic* c = &stats->cyclic[n];
+
+        uint64_t seen = __atomic_load_n(&ts->seen, __ATOMIC_RELAXED);
+        uint64_t sum = __atomic_load_n(&ts->jitter_sum_ns, __ATOMIC_RELAXED);
+        c->iface = msg->iface;
+        c->can_id = msg->frame.can_id;
+        c->period_ms = msg->period_ms;
+        c->bcm = msg->bcm;
+        stats_set(&c->seen, seen);
+        stats_set(&c->errors, ts->errors + ts->missed);
+        stats_set(&c->jitter_mean_ns, seen > 1 ? sum / (seen - 1) : 0);
+        stats_set(&c->jitter_max_ns, __atomic_load_n(&ts->jitter_max_ns, __ATOMIC_RELAXED));
+    }
+    __atomic_store_n(&stats->num_cyclic, count, __ATOMIC_RELAXED);
+}
+
+void stats_publish(void) {
+    uint64_t now = realtime_ns();
+    uint64_t interval = last_publish_ns != 0 && now > last_publish_ns ? now - last_publish_ns : 0;
+
+    for (uint32_t i = 0; i < stats->num_ifaces; i++) {
+        struct stats_iface* st = &stats->ifaces[i];
+        const struct fwd_dest_stats* fwd = forward_dest_stats(i);
+
+        if (fwd != NULL) {
+            stats_set(&st->tx_frames, fwd->tx_frames);
+            stats_set(&st->tx_bytes, fwd->tx_bytes);
+            stats_set(&st->tx_dropped, fwd->dropped + fwd->stale);
+            stats_set(&st->tx_errors, fwd->tx_errors);
+            for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+                __atomic_store_n(&st->tx_depth[level], forward_queue_depth(i, level), __ATOMIC_RELAXED);
+                __atomic_store_n(&st->tx_depth_max[level], fwd->depth_max[level], __ATOMIC_RELAXED);
+            }
+        }
+        stats_set(&st->queue_drops, rx_thread_queue_drops(i));
+        __atomic_store_n(&st->bus_load, bus_load(i, interval), __ATOMIC_RELAXED);
+
+        const struct latency_hist* jitter = &iface_latency[i].tx_jitter;
+        stats_set(&st->tx_jitter_p50_ns, latency_quantile(jitter, 0.50));
+        stats_set(&st->tx_jitter_p99_ns, latency_quantile(jitter, 0.99));
+        stats_set(&st->tx_jitter_max_ns, __atomic_load_n(&jitter->max, __ATOMIC_RELAXED));
+    }
+    publish_cyclic();
+    stats_set(&stats->log_drops, __atomic_load_n(&log_drops, __ATOMIC_RELAXED));
+    stats_set(&stats->updated_ns, now);
+    last_publish_ns = now;
+
+    // Readers that see the new seq see everything published before it
+    __atomic_fetch_add(&stats->seq, 1, __ATOMIC_RELEASE);
+}
+
+static void on_publish_timer(struct event_source* src, uint32_t events) {
+    uint64_t expirations;
+    (void)events;
+
+    while (read(src->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {
+    }
+    stats_publish();
+}
+
+static int start_timer(struct event_loop* loop) {
+    struct itimerspec its;
+
+    timer_ev.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_ev.fd < 0) {
+        perror("Error creating statistics timer");
+        return -1;
+    }
+    timer_ev.handler = on_publish_timer;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = STATS_INTERVAL_MS / 1000;
+    its.it_value.tv_nsec = (STATS_INTERVAL_MS % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    if (timerfd_settime(timer_ev.fd, 0, &its, NULL) < 0) {
+        perror("Error arming statistics timer");
+        return -1;
+    }
+    return event_loop_add(loop, &timer_ev, EPOLLIN);
+}
+
+static struct stats_segment* map_segment(const char* name) {
+    if (name[0] != '/' || strchr(name + 1, '/') != NULL) {
+        fprintf(stderr, "Invalid statistics segment name '%s' (expected /name)\n", name);
+        return NULL;
+    }
+
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error creating statistics segment");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(struct stats_segment)) < 0) {
+        perror("Error sizing statistics segment");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, sizeof(struct stats_segment), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping statistics segment");
+        shm_unlink(name);
+        return NULL;
+    }
+    arena_charge("stats segment", sizeof(struct stats_segment));
+    return (struct stats_segment*)map;
+}
+
+int stats_open(const char* shm_name, const struct can_iface* ifaces, int count,
+               struct event_loop* loop) {
+    struct stats_segment* seg = &local_segment;
+
+    if (shm_name != NULL) {
+        seg = map_segment(shm_name);
+        if (seg == NULL) {
+            return -1;
+        }
+        shm_path = shm_name;
+    }
+
+    // A freshly truncated object is zero, like the static segment
+    seg->version = STATS_VERSION;
+    seg->size = sizeof(struct stats_segment);
+    seg->num_ifaces = count;
+    seg->interval_ms = STATS_INTERVAL_MS;
+    seg->start_ns = realtime_ns();
+    for (int i = 0; i < count; i++) {
+        struct stats_iface* st = &seg->ifaces[i];
+        snprintf(st->name, sizeof(st->name), "%s", ifaces[i].name);
+        st->bitrate = ifaces[i].bitrate > 0 ? ifaces[i].bitrate : 0;
+        st->dbitrate = ifaces[i].dbitrate > 0 ? ifaces[i].dbitrate : 0;
+        st->can_state = CAN_STATE_MAX;
+
+        // Interfaces without a socket (replay) have no bus to look at
+        char path[96];
+        struct load_state* ls = &loads[i];
+        for (int c = 0; c < NETDEV_COUNTERS; c++) {
+            snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s", ifaces[i].name,
+                     netdev_files[c]);
+            ls->fds[c] = ifaces[i].sock >= 0 ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+        }
+        // All counters or none
+        if (ls->fds[0] < 0 || ls->fds[1] < 0 || ls->fds[2] < 0 || ls->fds[3] < 0) {
+            for (int c = 0; c < NETDEV_COUNTERS; c++) {
+                if (ls->fds[c] >= 0) {
+                    close(ls->fds[c]);
+                }
+                ls->fds[c] = -1;
+            }
+        }
+    }
+    stats = seg;
+
+    // The magic goes last: a monitor that finds it finds a complete header
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(seg->magic, STATS_MAGIC, sizeof(seg->magic));
+
+    // Baseline for the first interval
+    stats_publish();
+    if (shm_name != NULL && start_timer(loop) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Busiest PGNs of a table first (selection over the few that are in use)
+static void dump_pgns(FILE* out, const struct stats_pgn* table, const char* what) {
+    bool shown[STATS_PGN_SLOTS];
+
+    memset(shown, 0, sizeof(shown));
+    for (int n = 0; n < 5; n++) {
+        int best = -1;
+        for (int s = 0; s < STATS_PGN_SLOTS; s++) {
+            if (table[s].key != 0 && !shown[s] && (best < 0 || table[s].frames > table[best].frames)) {
+                best = s;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        shown[best] = true;
+        fprintf(out, "      PGN %05X%s: %llu frames, %llu bytes\n", table[best].key & ~STATS_PGN_USED,
+                what, (unsigned long long)table[best].frames, (unsigned long long)table[best].bytes);
+    }
+}
+
+void stats_dump(FILE* out) {
+    for (uint32_t i = 0; i < stats->num_ifaces; i++) {
+        const struct stats_iface* st = &stats->ifaces[i];
+
+        fprintf(out, "  %s: rx %llu frames / %llu bytes, tx %llu / %llu, errors %llu, "
+                "kernel drops %llu, bus load %u.%02u%%\n", st->name,
+                (unsigned long long)st->rx_frames, (unsigned long long)st->rx_bytes,
+                (unsigned long long)st->tx_frames, (unsigned long long)st->tx_bytes,
+                (unsigned long long)st->error_frames, (unsigned long long)st->kernel_drops,
+                st->bus_load / 100, st->bus_load % 100);
+
+        dump_pgns(out, st->pgns, "");
+        dump_pgns(out, st->tx_pgns, " sent");
+    }
+
+    fprintf(out, "  event loop: %llu iterations, slowest %.2f ms, %llu over %d ms",
+            (unsigned long long)stats->loop_iterations, stats->loop_max_ns / 1e6,
+            (unsigned long long)stats->loop_stalls, HEALTH_STALL_MS);
+    if (stats->watchdog_usec > 0) {
+        fprintf(out, "; watchdog notified %llu times, skipped %llu",
+                (unsigned long long)stats->watchdog_pings, (unsigned long long)stats->watchdog_skipped);
+    }
+    fprintf(out, "\n");
+
+    for (uint32_t n = 0; n < stats->num_cyclic; n++) {
+        const struct stats_cyclic* c = &stats->cyclic[n];
+        fprintf(out, "  %s: cyclic %X every %u ms (%s): seen %llu, errors %llu, "
+                "jitter mean %.1fus max %.1fus\n", stats->ifaces[c->iface].name,
+                c->can_id & CAN_EFF_MASK, c->period_ms, c->bcm ? "BCM" : "wheel",
+                (unsigned long long)c->seen, (unsigned long long)c->errors,
+                c->jitter_mean_ns / 1000.0, c->jitter_max_ns / 1000.0);
+    }
+}
+
+void stats_close(void) {
+    if (timer_ev.fd >= 0) {
+        close(timer_ev.fd);
+        timer_ev.fd = -1;
+    }
+    for (uint32_t i = 0; i < stats->num_ifaces; i++) {
+        for (int c = 0; c < NETDEV_COUNTERS; c++) {
+            if (loads[i].fds[c] >= 0) {
+                close(loads[i].fds[c]);
+            }
+            loads[i].fds[c] = -1;
+        }
+    }
+    // The mapping stays valid for the shutdown summary
+    if (shm_path != NULL) {
+        shm_unlink(shm_path);
+        shm_path = NULL;
+    }
+}
@@ -0,0 +1,236 @@
+/*
+ * Live statistics segment
+ *
+ * Per-interface and per-PGN counters live in one fixed-layout structure.
+ * With -s it is a POSIX shared memory object (/dev/shm/<name>) that a
+ * monitor maps read-only and reads at any time, without a request to the
+ * bridge or a pause in the event loop; otherwise the same structure is
+ * static memory and only the shutdown summary looks at it.
+ *
+ * Every counter has one writer and is updated with relaxed atomics, so a
+ * reader never sees a torn value but may see counters of one interface
+ * from slightly different moments. RX counters are updated per frame by
+ * the interface's RX path, and the per-PGN TX counters per sent frame by
+ * the event loop, each in a table of its own. TX totals, queue drops, bus
+ * load and the TX jitter of cyclic messages are published from the event
+ * loop once per interval, after which seq is incremented.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <net/if.h>
+
+#include "can_fd.h"
+#include "can_iface.h"
+#include "dispatch.h"
+#include "forward.h"
+#include "tx_sched.h"
+
+#define STATS_MAGIC "CANSTAT"
+#define STATS_VERSION 6
+
+// Publish interval of the event loop counters and the bus load
+#define STATS_INTERVAL_MS 1000
+
+// Per-PGN table of one interface and direction: open addressing, at most
+// half full
+#define STATS_PGN_BITS 7
+#define STATS_PGN_SLOTS (1 << STATS_PGN_BITS)
+#define STATS_PGN_MAX (STATS_PGN_SLOTS / 2)
+
+// Set in the key of a used PGN slot (zeroed memory is an empty table)
+#define STATS_PGN_USED 0x80000000u
+
+// Bits on the wire per frame besides the data bytes: 29-bit identifier,
+// control, CRC, ACK, EOF and interframe space, without stuff bits
+#define STATS_FRAME_OVERHEAD_BITS 67
+
+struct stats_pgn {
+    uint32_t key;               // PGN | STATS_PGN_USED, 0 while unused
+    uint32_t reserved;
+    uint64_t frames;
+    uint64_t bytes;
+};
+
+struct stats_iface {
+    char name[IFNAMSIZ];
+    uint32_t bitrate;           // 0 if unknown (vcan): no bus load
+    uint32_t dbitrate;          // CAN-FD data phase, 0 for classic CAN
+
+    // Updated per frame by the RX path
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+    uint64_t error_frames;
+    uint64_t bus_off;           // Bus-off and restart error frames (can_recovery.h)
+    uint64_t restarts;
+    uint64_t kernel_drops;      // Socket receive queue overflows (SO_RXQ_OVFL)
+    uint64_t other_frames;      // 11-bit frames, and PGNs beyond the table
+    uint32_t pgn_count;         // PGN slots in use
+    uint32_t reserved;
+
+    // Published every interval
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;        // Forwarding queue full
+    uint64_t tx_errors;
+    uint64_t queue_drops;       // RX thread queue full
+    uint32_t bus_load;          // Over the last interval, in 0.01 % of the bitrate
+    uint32_t can_state;         // Controller state (enum can_state), CAN_STATE_MAX
+                                // if unknown (vcan)
+    uint64_t outage_ms;         // Time spent bus-off or down, as seen by rtnetlink
+    uint64_t last_rx_ns;        // CLOCK_MONOTONIC of the last received batch (health.h)
+    uint64_t tx_jitter_p50_ns;  // Cyclic messages since startup (tx_sched.h)
+    uint64_t tx_jitter_p99_ns;
+    uint64_t tx_jitter_max_ns;
+    uint32_t tx_depth[FWD_PRIO_LEVELS];     // Forwarding queues by priority level
+    uint32_t tx_depth_max[FWD_PRIO_LEVELS];
+
+    // Updated per sent frame by the event loop
+    uint64_t tx_other_frames;   // 11-bit frames, and PGNs beyond the TX table
+    uint32_t tx_pgn_count;
+    uint32_t reserved2;
+
+    struct stats_pgn pgns[STATS_PGN_SLOTS];     // Received
+    struct stats_pgn tx_pgns[STATS_PGN_SLOTS];  // Sent
+};
+
+// One cyclic message, published every interval
+struct stats_cyclic {
+    uint32_t iface;
+    uint32_t can_id;            // With CAN_EFF_FLAG for 29-bit identifiers
+    uint32_t period_ms;
+    uint32_t bcm;               // 1 if sent by CAN_BCM, 0 by the timer wheel
+    uint64_t seen;              // Transmissions seen on the bus
+    uint64_t errors;            // Failed sends and skipped cycles (timer wheel)
+    uint64_t jitter_mean_ns;
+    uint64_t jitter_max_ns;
+};
+
+struct stats_segment {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;              // sizeof(struct stats_segment)
+    uint32_t num_ifaces;
+    uint32_t interval_ms;
+    uint64_t seq;               // Incremented after each publish
+    uint64_t start_ns;          // CLOCK_REALTIME at startup
+    uint64_t updated_ns;        // CLOCK_REALTIME of the last publish
+    uint64_t log_drops;         // Verbose log ring full
+
+    // Event loop health (health.h), CLOCK_MONOTONIC ns, updated live
+    uint64_t loop_iterations;
+    uint64_t loop_busy_since;   // Start of the running iteration, 0 while waiting
+    uint64_t loop_last_ns;      // End of the last iteration
+    uint64_t loop_max_ns;       // Slowest iteration
+    uint64_t loop_stalls;       // Iterations longer than HEALTH_STALL_MS
+    uint64_t watchdog_usec;     // systemd watchdog interval, 0 without
+    uint64_t watchdog_pings;    // WATCHDOG=1 sent
+    uint64_t watchdog_skipped;  // Checks that found a stalled RX thread
+    uint32_t num_cyclic;
+    uint32_t reserved;
+    struct stats_iface ifaces[MAX_CAN_IFACES];
+    struct stats_cyclic cyclic[TX_SCHED_MAX_MSGS];
+};
+
+// The live segment (static storage until stats_open() maps the shared one)
+extern struct stats_segment* stats;
+
+static inline void stats_add(uint64_t* counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_set(uint64_t* counter, uint64_t value) {
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t stats_pgn_slot(uint32_t pgn) {
+    return (pgn * 2654435769u) >> (32 - STATS_PGN_BITS);
+}
+
+// Count a frame in a per-PGN table, or in *other for 11-bit frames and
+// once the table is full
+static inline void stats_pgn_add(struct stats_pgn* table, uint32_t* count, uint64_t* other,
+                                 const struct canfd_frame* frame, uint32_t len) {
+    if (!(frame->can_id & CAN_EFF_FLAG)) {
+        stats_add(other, 1);
+        return;
+    }
+
+    uint32_t pgn = j1939_pgn(frame->can_id & CAN_EFF_MASK);
+    uint32_t want = pgn | STATS_PGN_USED;
+
+    // Each table has a single writer, so claiming a slot needs no CAS; the
+    // key is released after the counters are zeroed
+    for (uint32_t slot = stats_pgn_slot(pgn);; slot = (slot + 1) & (STATS_PGN_SLOTS - 1)) {
+        struct stats_pgn* p = &table[slot];
+        uint32_t key = __atomic_load_n(&p->key, __ATOMIC_RELAXED);
+        if (key == want) {
+            stats_add(&p->frames, 1);
+            stats_add(&p->bytes, len);
+            return;
+        }
+        if (key == 0) {
+            if (*count >= STATS_PGN_MAX) {
+                stats_add(other, 1);
+                return;
+            }
+            stats_set(&p->frames, 1);
+            stats_set(&p->bytes, len);
+            __atomic_store_n(&p->key, want, __ATOMIC_RELEASE);
+            __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+// Count one received data frame (RX path of the interface)
+static inline void stats_rx_frame(int iface, const struct canfd_frame* frame) {
+    struct stats_iface* st = &stats->ifaces[iface];
+    uint32_t len = can_frame_len(frame);
+
+    stats_add(&st->rx_frames, 1);
+    stats_add(&st->rx_bytes, len);
+    stats_pgn_add(st->pgns, &st->pgn_count, &st->other_frames, frame, len);
+}
+
+// Count one frame sent to an interface by PGN (event loop; the totals are
+// published from the forwarder's counters)
+static inline void stats_tx_frame(int iface, const struct canfd_frame* frame) {
+    struct stats_iface* st = &stats->ifaces[iface];
+
+    stats_pgn_add(st->tx_pgns, &st->tx_pgn_count, &st->tx_other_frames, frame, can_frame_len(frame));
+}
+
+static inline void stats_error_frame(int iface) {
+    stats_add(&stats->ifaces[iface].error_frames, 1);
+}
+
+// drops is the socket's cumulative SO_RXQ_OVFL count, 0 (ignored) when the
+// batch did not carry it
+static inline void stats_kernel_drops(int iface, uint32_t drops) {
+    struct stats_iface* st = &stats->ifaces[iface];
+    if (drops > st->kernel_drops) {
+        stats_set(&st->kernel_drops, drops);
+    }
+}
+
+// Set up the segment for the interface table. A non-NULL shm_name creates
+// the shared memory object (e.g. "/can_bridge") and a timer on loop that
+// publishes every STATS_INTERVAL_MS. Call before any frame is received.
+// Returns 0 or -1.
+int stats_open(const char* shm_name, const struct can_iface* ifaces, int count,
+               struct event_loop* loop);
+
+// Publish the event loop counters and the bus load now
+void stats_publish(void);
+
+// Print the RX counters and the busiest PGNs of each interface
+void stats_dump(FILE* out);
+
+// Stop publishing and remove the shared memory object
+void stats_close(void);
+
+#endif // STATS_H
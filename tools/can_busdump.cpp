@@ -0,0 +1,127 @@
+/*
+ * Print the frames and decoded state a running can_bridge publishes
+ * (started with -b name)
+ *
+ * Maps the ring read-only and polls it; the bridge never waits for this
+ * reader, which reports the frames it was too slow to see.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_bus.h"
+#include "decoders.h"
+
+// Idle poll interval
+#define POLL_US 1000
+
+static void print_frame(const struct shm_bus* bus, const struct shm_bus_record* rec) {
+    const struct canfd_frame* frame = &rec->frame;
+    unsigned int len = can_frame_len(frame);
+
+    printf("(%llu.%06llu) %s %08X%s", (unsigned long long)(rec->ts_ns / 1000000000ULL),
+           (unsigned long long)(rec->ts_ns % 1000000000ULL) / 1000,
+           bus->iface_names[rec->iface % MAX_CAN_IFACES], frame->can_id & CAN_EFF_MASK,
+           (frame->flags & CANFD_FDF) ? "##" : "#");
+    for (unsigned int i = 0; i < len; i++) {
+        printf("%02X", frame->data[i]);
+    }
+    printf("\n");
+}
+
+static void print_signals(const struct shm_bus* bus) {
+    for (uint32_t i = 0; i < bus->num_ifaces && i < MAX_CAN_IFACES; i++) {
+        struct keypad_state keypad;
+        struct tsc1_request tsc1;
+        struct dm1_state dm1;
+
+        if (shm_bus_read_signal(bus, i, SHM_BUS_KEYPAD, &keypad, sizeof(keypad), NULL) == sizeof(keypad)) {
+            printf("%s: keypad pressed %02X\n", bus->iface_names[i], keypad.pressed);
+        }
+        if (shm_bus_read_signal(bus, i, SHM_BUS_TSC1, &tsc1, sizeof(tsc1), NULL) == sizeof(tsc1)) {
+            printf("%s: TSC1 %.1f rpm, %d%% torque, mode %u\n", bus->iface_names[i],
+                   tsc1.speed_rpm, tsc1.torque_pct, tsc1.ctrl_mode);
+        }
+        if (shm_bus_read_signal(bus, i, SHM_BUS_DM1, &dm1, sizeof(dm1), NULL) == sizeof(dm1)) {
+            printf("%s: DM1 from %02X, lamps %02X, %d active DTC(s)\n", bus->iface_names[i],
+                   dm1.sa, dm1.lamps, dm1.num_dtcs);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bool from_start = false;
+    bool signals_only = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ash")) != -1) {
+        switch (opt) {
+        case 'a':
+            from_start = true;
+            break;
+        case 's':
+            signals_only = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-a] [-s] /name\n"
+                    "  -a    Start with the oldest frame still in the ring\n"
+                    "  -s    Print the decoded state once and exit\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Missing ring name (as given to can_bridge -b)\n");
+        return 1;
+    }
+
+    int fd = shm_open(argv[optind], O_RDONLY, 0);
+    if (fd < 0) {
+        perror("Error opening frame bus");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct shm_bus)) {
+        fprintf(stderr, "%s is not a frame bus\n", argv[optind]);
+        return 1;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping frame bus");
+        return 1;
+    }
+    const struct shm_bus* bus = (const struct shm_bus*)map;
+    if (memcmp(bus->magic, SHM_BUS_MAGIC, sizeof(SHM_BUS_MAGIC)) != 0 ||
+        bus->version != SHM_BUS_VERSION || bus->record_size != sizeof(struct shm_bus_record) ||
+        bus->size != (uint64_t)st.st_size) {
+        fprintf(stderr, "%s is not a compatible frame bus\n", argv[optind]);
+        return 1;
+    }
+
+    if (signals_only) {
+        print_signals(bus);
+        return 0;
+    }
+
+    uint64_t pos = from_start ? 0 : __atomic_load_n(&bus->head, __ATOMIC_ACQUIRE);
+    uint64_t lost = 0;
+    struct shm_bus_record rec;
+    for (;;) {
+        uint64_t lost_before = lost;
+        if (!shm_bus_read(bus, &pos, &rec, &lost)) {
+            fflush(stdout);
+            usleep(POLL_US);
+            continue;
+        }
+        if (lost != lost_before) {
+            printf("# %llu frame(s) lost\n", (unsigned long long)(lost - lost_before));
+        }
+        print_frame(bus, &rec);
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Print the live statistics of a running can_bridge (started with -s name)
+ *
+ * Maps the shared memory segment read-only; the bridge is not involved and
+ * does not notice the reader.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+#include "can_recovery.h"
+#include "clock_util.h"
+
+struct stats_segment* stats = NULL;
+
+static uint64_t load(const uint64_t* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void print_iface(const struct stats_iface* st, const struct stats_iface* prev, double secs,
+                        uint64_t now) {
+    uint64_t last_rx = load(&st->last_rx_ns);
+    uint32_t bus_load = __atomic_load_n(&st->bus_load, __ATOMIC_RELAXED);
+
+    printf("%s (%u bps%s): bus load %u.%02u%%, %s\n", st->name, st->bitrate,
+           st->dbitrate > 0 ? ", CAN-FD" : "", bus_load / 100, bus_load % 100,
+           can_state_name(__atomic_load_n(&st->can_state, __ATOMIC_RELAXED)));
+    printf("  rx %llu frames, %llu bytes", (unsigned long long)load(&st->rx_frames),
+           (unsigned long long)load(&st->rx_bytes));
+    if (prev != NULL && secs > 0) {
+        printf(" (%.0f frames/s)", (load(&st->rx_frames) - prev->rx_frames) / secs);
+    }
+    printf("\n  tx %llu frames, %llu bytes", (unsigned long long)load(&st->tx_frames),
+           (unsigned long long)load(&st->tx_bytes));
+    if (prev != NULL && secs > 0) {
+        printf(" (%.0f frames/s)", (load(&st->tx_frames) - prev->tx_frames) / secs);
+    }
+    printf("\n  dropped: kernel %llu, RX queue %llu, TX queue %llu; tx errors %llu, error frames %llu\n",
+           (unsigned long long)load(&st->kernel_drops), (unsigned long long)load(&st->queue_drops),
+           (unsigned long long)load(&st->tx_dropped), (unsigned long long)load(&st->tx_errors),
+           (unsigned long long)load(&st->error_frames));
+
+    for (int s = 0; s < STATS_PGN_SLOTS; s++) {
+        const struct stats_pgn* p = &st->pgns[s];
+        uint32_t key = __atomic_load_n(&p->key, __ATOMIC_ACQUIRE);
+        if (key != 0) {
+            printf("  PGN %05X: %llu frames, %llu bytes\n", key & ~STATS_PGN_USED,
+                   (unsigned long long)load(&p->frames), (unsigned long long)load(&p->bytes));
+        }
+    }
+    for (int s = 0; s < STATS_PGN_SLOTS; s++) {
+        const struct stats_pgn* p = &st->tx_pgns[s];
+        uint32_t key = __atomic_load_n(&p->key, __ATOMIC_ACQUIRE);
+        if (key != 0) {
+            printf("  PGN %05X sent: %llu frames, %llu bytes\n", key & ~STATS_PGN_USED,
+                   (unsigned long long)load(&p->frames), (unsigned long long)load(&p->bytes));
+        }
+    }
+    uint32_t depth_max = 0;
+    for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+        depth_max |= __atomic_load_n(&st->tx_depth_max[level], __ATOMIC_RELAXED);
+    }
+    if (depth_max > 0) {
+        printf("  TX queue by priority level: depth");
+        for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+            printf("%s%u", level > 0 ? "/" : " ", __atomic_load_n(&st->tx_depth[level], __ATOMIC_RELAXED));
+        }
+        printf(", max");
+        for (int level = 0; level < FWD_PRIO_LEVELS; level++) {
+            printf("%s%u", level > 0 ? "/" : " ", __atomic_load_n(&st->tx_depth_max[level], __ATOMIC_RELAXED));
+        }
+        printf("\n");
+    }
+    if (load(&st->bus_off) + load(&st->outage_ms) > 0) {
+        printf("  bus-off %llu, restarts %llu, down for %llu ms\n", (unsigned long long)load(&st->bus_off),
+               (unsigned long long)load(&st->restarts), (unsigned long long)load(&st->outage_ms));
+    }
+    if (last_rx != 0 && now > last_rx) {
+        printf("  last rx %.0f ms ago\n", (now - last_rx) / 1e6);
+    }
+    if (load(&st->other_frames) > 0) {
+        printf("  other: %llu frames\n", (unsigned long long)load(&st->other_frames));
+    }
+    if (load(&st->tx_jitter_max_ns) > 0) {
+        printf("  cyclic TX jitter p50 %.1fus p99 %.1fus max %.1fus\n",
+               load(&st->tx_jitter_p50_ns) / 1000.0, load(&st->tx_jitter_p99_ns) / 1000.0,
+               load(&st->tx_jitter_max_ns) / 1000.0);
+    }
+}
+
+// A loop iteration still running (loop_busy_since set) is reported as it
+// goes, before it has ended and been counted
+static void print_health(uint64_t now) {
+    uint64_t busy_since = load(&stats->loop_busy_since);
+
+    printf("Event loop: %llu iterations, slowest %.2f ms, %llu stalls",
+           (unsigned long long)load(&stats->loop_iterations), load(&stats->loop_max_ns) / 1e6,
+           (unsigned long long)load(&stats->loop_stalls));
+    if (busy_since != 0 && now > busy_since) {
+        printf(", current iteration running for %.2f ms", (now - busy_since) / 1e6);
+    }
+    if (load(&stats->watchdog_usec) > 0) {
+        printf("\n  systemd watchdog %.1f s: notified %llu times, skipped %llu",
+               load(&stats->watchdog_usec) / 1e6, (unsigned long long)load(&stats->watchdog_pings),
+               (unsigned long long)load(&stats->watchdog_skipped));
+    }
+    printf("\n");
+}
+
+static void print_cyclic(const struct stats_cyclic* c) {
+    printf("  %-8s %08X every %u ms (%s): seen %llu, errors %llu, jitter mean %.1fus max %.1fus\n",
+           stats->ifaces[c->iface % MAX_CAN_IFACES].name, c->can_id & CAN_EFF_MASK, c->period_ms,
+           c->bcm ? "BCM" : "wheel", (unsigned long long)load(&c->seen),
+           (unsigned long long)load(&c->errors), load(&c->jitter_mean_ns) / 1000.0,
+           load(&c->jitter_max_ns) / 1000.0);
+}
+
+int main(int argc, char* argv[]) {
+    int interval = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:h")) != -1) {
+        switch (opt) {
+        case 'w':
+            interval = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-w seconds] /name\n"
+                    "  -w    Print again every interval, with rates\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Missing segment name (as given to can_bridge -s)\n");
+        return 1;
+    }
+
+    int fd = shm_open(argv[optind], O_RDONLY, 0);
+    if (fd < 0) {
+        perror("Error opening statistics segment");
+        return 1;
+    }
+    void* map = mmap(NULL, sizeof(struct stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping statistics segment");
+        return 1;
+    }
+    stats = (struct stats_segment*)map;
+    if (memcmp(stats->magic, STATS_MAGIC, sizeof(stats->magic)) != 0 ||
+        stats->version != STATS_VERSION || stats->size != sizeof(struct stats_segment)) {
+        fprintf(stderr, "%s is not a compatible statistics segment\n", argv[optind]);
+        return 1;
+    }
+
+    static struct stats_iface prev[MAX_CAN_IFACES];
+    uint64_t prev_ns = 0;
+    for (;;) {
+        uint64_t seq = __atomic_load_n(&stats->seq, __ATOMIC_ACQUIRE);
+        uint64_t now = monotonic_ns();
+        double secs = prev_ns != 0 ? (now - prev_ns) / 1e9 : 0;
+
+        printf("Update %llu, up %.0f s, log drops %llu\n", (unsigned long long)seq,
+               (load(&stats->updated_ns) - stats->start_ns) / 1e9,
+               (unsigned long long)load(&stats->log_drops));
+        print_health(now);
+        for (uint32_t i = 0; i < stats->num_ifaces && i < MAX_CAN_IFACES; i++) {
+            print_iface(&stats->ifaces[i], prev_ns != 0 ? &prev[i] : NULL, secs, now);
+            prev[i].rx_frames = load(&stats->ifaces[i].rx_frames);
+            prev[i].tx_frames = load(&stats->ifaces[i].tx_frames);
+        }
+        uint32_t num_cyclic = __atomic_load_n(&stats->num_cyclic, __ATOMIC_RELAXED);
+        if (num_cyclic > 0) {
+            printf("Cyclic messages:\n");
+        }
+        for (uint32_t n = 0; n < num_cyclic && n < TX_SCHED_MAX_MSGS; n++) {
+            print_cyclic(&stats->cyclic[n]);
+        }
+        if (interval <= 0) {
+            break;
+        }
+        prev_ns = now;
+        printf("\n");
+        fflush(stdout);
+        sleep(interval);
+    }
+    return 0;
+}
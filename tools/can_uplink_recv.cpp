@@ -0,0 +1,163 @@
+/*
+ * Minimal uplink collector: receive the packets a can_bridge sends with
+ * -U and print the frames as a candump log
+ *
+ * Reference for a backend decoder (see uplink.h for the format) and a way
+ * to check the link; it reports lost packets from the sequence numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "uplink.h"
+
+static const char* names[UPLINK_T_IFACE_MASK + 1];
+
+static struct uplink_decoder dec;
+
+static void print_frame(void* ctx, uint64_t ts_us, int iface, const struct canfd_frame* frame) {
+    (void)ctx;
+    printf("(%llu.%06llu) ", (unsigned long long)(ts_us / 1000000), (unsigned long long)(ts_us % 1000000));
+    if (names[iface] != NULL) {
+        printf("%s ", names[iface]);
+    }
+    else {
+        printf("if%d ", iface);
+    }
+    if (frame->can_id & CAN_EFF_FLAG) {
+        printf("%08X", frame->can_id & CAN_EFF_MASK);
+    }
+    else {
+        printf("%03X", frame->can_id & CAN_SFF_MASK);
+    }
+    if (frame->flags & CANFD_FDF) {
+        printf("##%X", frame->flags & ~CANFD_FDF & 0x0F);
+    }
+    else {
+        printf("#");
+    }
+    for (int i = 0; i < frame->len; i++) {
+        printf("%02X", frame->data[i]);
+    }
+    printf("\n");
+}
+
+static void handle_packet(const uint8_t* pkt, size_t size, uint64_t* packets, uint64_t* lost) {
+    uint32_t prev = dec.seq;
+    if (uplink_decode(&dec, pkt, size, print_frame, NULL) < 0) {
+        fprintf(stderr, "Malformed packet of %zu bytes\n", size);
+        return;
+    }
+    if (*packets > 0 && dec.seq != prev + 1) {
+        *lost += dec.seq - prev - 1;
+        fprintf(stderr, "%u packet(s) lost\n", dec.seq - prev - 1);
+    }
+    (*packets)++;
+}
+
+// Split a TCP stream back into packets
+static void serve_tcp(int conn) {
+    static uint8_t buf[2 * UPLINK_MAX_PACKET];
+    size_t fill = 0;
+    uint64_t packets = 0;
+    uint64_t lost = 0;
+    ssize_t n;
+
+    while ((n = read(conn, buf + fill, sizeof(buf) - fill)) > 0) {
+        fill += n;
+        size_t pos = 0;
+        while (fill - pos >= UPLINK_HEADER_SIZE) {
+            size_t size = UPLINK_HEADER_SIZE + uplink_get_le(buf + pos + 16, 2);
+            if (fill - pos < size) {
+                break;
+            }
+            handle_packet(buf + pos, size, &packets, &lost);
+            pos += size;
+        }
+        memmove(buf, buf + pos, fill - pos);
+        fill -= pos;
+        fflush(stdout);
+    }
+    fprintf(stderr, "Connection closed after %llu packets (%llu lost)\n",
+            (unsigned long long)packets, (unsigned long long)lost);
+}
+
+int main(int argc, char* argv[]) {
+    bool tcp = false;
+    int num_names = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ti:h")) != -1) {
+        switch (opt) {
+        case 't':
+            tcp = true;
+            break;
+        case 'i':
+            for (char* name = strtok(optarg, ","); name != NULL && num_names <= UPLINK_T_IFACE_MASK;
+                 name = strtok(NULL, ",")) {
+                names[num_names++] = name;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t] [-i if,...] port\n"
+                    "  -t    Accept TCP connections instead of UDP datagrams\n"
+                    "  -i    Interface names in the bridge's -i order\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Missing port\n");
+        return 1;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo* res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = tcp ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    int ret = getaddrinfo(NULL, argv[optind], &hints, &res);
+    if (ret != 0) {
+        fprintf(stderr, "Invalid port %s: %s\n", argv[optind], gai_strerror(ret));
+        return 1;
+    }
+    // IPv6 socket, which also accepts IPv4 senders
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+    int one = 1;
+    if (sock < 0 || setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        bind(sock, res->ai_addr, res->ai_addrlen) < 0 || (tcp && listen(sock, 1) < 0)) {
+        perror("Error opening collector socket");
+        return 1;
+    }
+    freeaddrinfo(res);
+
+    if (tcp) {
+        for (;;) {
+            int conn = accept(sock, NULL, NULL);
+            if (conn < 0) {
+                perror("Error accepting connection");
+                return 1;
+            }
+            serve_tcp(conn);
+            close(conn);
+        }
+    }
+
+    static uint8_t pkt[UPLINK_MAX_PACKET];
+    uint64_t packets = 0;
+    uint64_t lost = 0;
+    for (;;) {
+        ssize_t n = recv(sock, pkt, sizeof(pkt), 0);
+        if (n < 0) {
+            perror("Error receiving packet");
+            return 1;
+        }
+        handle_packet(pkt, n, &packets, &lost);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+# Convert the BO_/SG_ entries of a DBC file into dbc_signal types
+#
+#   awk -f tools/dbc2h.awk j1939.dbc > signals_gen.h
+#
+# For every message <MSG> this emits <MSG>_CAN_ID, <MSG>_DLC, <MSG>_MIN_LEN
+# (bytes needed to hold all its signals) and one struct <MSG>_<Signal> per
+# signal, and a table of all signals (dbc_signal_descs) for rules that name
+# signals at runtime. Multiplexed signals are not supported.
+
+function fail(msg) {
+    print FILENAME ":" FNR ": " msg > "/dev/stderr"
+    failed = 1
+    exit 1
+}
+
+function abs(x) {
+    return x < 0 ? -x : x
+}
+
+function is_int(x) {
+    return abs(x - int(x)) < 1e-9
+}
+
+# Bytes spanned by a signal, counted from the start of the payload
+function end_byte(start, len, big_endian,   msb) {
+    if (!big_endian) {
+        return int((start + len - 1) / 8) + 1
+    }
+    msb = int(start / 8) * 8 + (7 - start % 8)
+    return int((msb + len - 1) / 8) + 1
+}
+
+function finish_message() {
+    if (msg != "") {
+        printf "#define %s_MIN_LEN %d\n\n", msg, min_len
+    }
+}
+
+BEGIN {
+    print "// Generated from the DBC signal description by tools/dbc2h.awk - do not edit"
+    print ""
+    print "#ifndef SIGNALS_GEN_H"
+    print "#define SIGNALS_GEN_H"
+    print ""
+    print "#include \"dbc_signal.h\""
+    print ""
+    msg = ""
+}
+
+$1 == "BO_" {
+    finish_message()
+    id = $2
+    msg = $3
+    sub(/:$/, "", msg)
+    dlc = $4
+    if (msg == "" || dlc == "") {
+        fail("malformed BO_ line")
+    }
+    ext = id >= 2147483648
+    if (ext) {
+        id -= 2147483648
+    }
+    printf "// %s\n", msg
+    printf "#define %s_CAN_ID 0x%0" (ext ? 8 : 3) "X\n", msg, id
+    printf "#define %s_DLC %d\n", msg, dlc
+    min_len = 0
+    next
+}
+
+$1 == "SG_" {
+    if (msg == "") {
+        fail("SG_ outside of a message")
+    }
+    if ($3 != ":") {
+        fail("multiplexed signal " $2 " not supported")
+    }
+    name = $2
+
+    # start|len@order sign
+    layout = $4
+    n = split(layout, a, /[|@]/)
+    if (n != 3) {
+        fail("bad signal layout " layout)
+    }
+    start = a[1] + 0
+    len = a[2] + 0
+    big_endian = substr(a[3], 1, 1) == "0"
+    signed = substr(a[3], 2, 1) == "-"
+
+    # (factor,offset)
+    scale = $5
+    gsub(/[()]/, "", scale)
+    split(scale, s, ",")
+    factor = s[1] + 0
+    offset = s[2] + 0
+    if (factor <= 0) {
+        fail("signal " name " has a non-positive factor")
+    }
+
+    # Fixed point if factor = mul * 2^-frac and offset * 2^frac is integral
+    fixed = 0
+    for (frac = 0; frac <= 16; frac++) {
+        if (is_int(factor * 2 ^ frac) && is_int(offset * 2 ^ frac)) {
+            fixed = 1
+            break
+        }
+    }
+    if (!fixed) {
+        frac = 0
+    }
+
+    e = end_byte(start, len, big_endian)
+    if (e > 8) {
+        fail("signal " name " exceeds 8 bytes")
+    }
+    if (e > min_len) {
+        min_len = e
+    }
+
+    printf "struct %s_%s : dbc_signal<%d, %d, %s, %s> {\n", msg, name, start, len,
+           big_endian ? "DBC_MOTOROLA" : "DBC_INTEL", signed ? "DBC_SIGNED" : "DBC_UNSIGNED"
+    printf "    static constexpr double factor = %.10g;\n", factor
+    printf "    static constexpr double offset = %.10g;\n", offset
+    printf "    static constexpr bool fixed = %s;\n", fixed ? "true" : "false"
+    printf "    static constexpr int frac_bits = %d;\n", frac
+    printf "    static constexpr int64_t mul = %d;\n", fixed ? factor * 2 ^ frac : 0
+    printf "    static constexpr int64_t add = %d;\n", fixed ? offset * 2 ^ frac : 0
+    print "};"
+
+    descs[num_descs++] = sprintf("    { \"%s\", \"%s\", %d, %d, %s, %s, %.10g, %.10g },", msg, name,
+                                 start, len, big_endian ? "DBC_MOTOROLA" : "DBC_INTEL",
+                                 signed ? "DBC_SIGNED" : "DBC_UNSIGNED", factor, offset)
+    next
+}
+
+END {
+    if (failed) {
+        exit 1
+    }
+    finish_message()
+    print "// All signals, for lookups by name"
+    printf "#define DBC_NUM_SIGNALS %d\n", num_descs
+    print "static const struct dbc_signal_desc dbc_signal_descs[] = {"
+    for (i = 0; i < num_descs; i++) {
+        print descs[i]
+    }
+    print "};"
+    print ""
+    print "#endif // SIGNALS_GEN_H"
+}
@@ -0,0 +1,87 @@
+/*
+ * Fixed topology build
+ *
+ * A deployment whose interfaces, routes and decoders never change can
+ * compile them in: make TOPOLOGY=name builds with topology/name.h, which
+ * defines
+ *
+ *   topology_ifaces[]      interfaces (name, bitrate, data bitrate) in
+ *                          index order
+ *   topology_routes[]      routes, with id already masked
+ *   topology_decoders[]    decoders (enum decoder_id)
+ *
+ * as constexpr arrays (see topology/rcu4.h). forward_frame() then matches
+ * the routes unrolled at compile time, with constant identifiers, masks
+ * and destinations and no routing table walk, and dispatch_message()
+ * selects the decoder with a switch on the PGN and calls it directly
+ * instead of through the dispatch table. The topology is checked when it
+ * is compiled. -i, -r and the interface, route and decoder directives of
+ * the configuration file are rejected; filters, rewrite rules and
+ * everything else stay configurable.
+ *
+ * Without TOPOLOGY the bridge is configured at runtime (the default).
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdint.h>
+
+#include "decoders.h"
+#include "forward.h"
+#include "signals_gen.h"
+
+struct topology_iface {
+    const char* name;
+    int bitrate;
+    int dbitrate;
+};
+
+// Sizes of the arrays of a topology header
+#define TOPOLOGY_NUM_IFACES ((int)(sizeof(topology_ifaces) / sizeof(topology_ifaces[0])))
+#define TOPOLOGY_NUM_ROUTES ((int)(sizeof(topology_routes) / sizeof(topology_routes[0])))
+#define TOPOLOGY_NUM_DECODERS ((int)(sizeof(topology_decoders) / sizeof(topology_decoders[0])))
+
+#ifdef CAN_BRIDGE_TOPOLOGY
+
+#include CAN_BRIDGE_TOPOLOGY
+
+// Compile-time checks (C++11 constexpr functions are single expressions)
+constexpr bool topology_route_ok(int i) {
+    return i == TOPOLOGY_NUM_ROUTES ||
+           (topology_routes[i].src >= 0 && topology_routes[i].src < TOPOLOGY_NUM_IFACES &&
+            topology_routes[i].dst >= 0 && topology_routes[i].dst < TOPOLOGY_NUM_IFACES &&
+            topology_routes[i].src != topology_routes[i].dst &&
+            (topology_routes[i].id & ~topology_routes[i].mask) == 0 && topology_route_ok(i + 1));
+}
+
+constexpr bool topology_decodes(int id, int i = 0) {
+    return i < TOPOLOGY_NUM_DECODERS && (topology_decoders[i] == id || topology_decodes(id, i + 1));
+}
+
+static_assert(TOPOLOGY_NUM_IFACES <= MAX_CAN_IFACES && TOPOLOGY_NUM_IFACES <= FWD_MAX_DESTS,
+              "too many interfaces in the topology");
+static_assert(TOPOLOGY_NUM_ROUTES <= FWD_MAX_ROUTES, "too many routes in the topology");
+static_assert(topology_route_ok(0), "topology route with an unknown interface or an unmasked id");
+
+// Decoder of a message, -1 if none. The same PGN, address and length checks
+// as the registrations of register_decoder(); decoders that are not part of
+// the topology fold away.
+static inline int topology_decoder(uint32_t pgn, uint8_t sa, uint8_t da, unsigned int len) {
+    switch (pgn) {
+    case PGN_KEYPAD:
+        return topology_decodes(DECODER_KEYPAD) && sa == SA_KEYPAD && len >= KEYPAD_MIN_LEN ?
+               DECODER_KEYPAD : -1;
+    case PGN_TSC1:
+        return topology_decodes(DECODER_TSC1) && sa == SA_TSC1 && da == DA_TSC1 &&
+               len >= TSC1_MIN_LEN ? DECODER_TSC1 : -1;
+    case PGN_DM1:
+        return topology_decodes(DECODER_DM1) && len >= DM1_MIN_LEN ? DECODER_DM1 : -1;
+    default:
+        return -1;
+    }
+}
+
+#endif // CAN_BRIDGE_TOPOLOGY
+
+#endif // TOPOLOGY_H
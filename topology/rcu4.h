@@ -0,0 +1,31 @@
+/*
+ * RCU4 vehicle topology (make TOPOLOGY=rcu4, see topology.h)
+ *
+ * canfd1 is the 250 kbit/s body bus with the keypad, canfd2 the engine bus
+ * and canfd3 the diagnostic bus. Keypad messages go to the engine bus,
+ * TSC1 from any source on the engine bus to the body bus, DM1 from the
+ * engine and diagnostic buses to the body bus, and the engine bus is
+ * mirrored to the diagnostic bus.
+ */
+
+#ifndef TOPOLOGY_RCU4_H
+#define TOPOLOGY_RCU4_H
+
+static constexpr struct topology_iface topology_ifaces[] = {
+    { "canfd1", 250000, 0 },
+    { "canfd2", 500000, 0 },
+    { "canfd3", 500000, 0 },
+};
+
+// src, id, mask, dst, limit
+static constexpr struct fwd_route topology_routes[] = {
+    { 0, 0x18FF0280, 0x1FFFFFFF, 1, {} },
+    { 1, 0x00000000, 0x03FF0000, 0, {} },
+    { 1, 0x00FECA00, 0x03FFFF00, 0, {} },
+    { 2, 0x00FECA00, 0x03FFFF00, 0, {} },
+    { 1, 0x00000000, 0x00000000, 2, {} },
+};
+
+static constexpr int topology_decoders[] = { DECODER_KEYPAD, DECODER_TSC1, DECODER_DM1 };
+
+#endif // TOPOLOGY_RCU4_H
@@ -0,0 +1,445 @@
+/*
+ * Periodic TX scheduler for cyclic messages
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <net/if.h>
+#include <linux/can/bcm.h>
+#include <linux/can/raw.h>
+
+#include "tx_sched.h"
+#include "clock_util.h"
+#include "latency.h"
+
+#define WHEEL_SLOTS (1 << TX_SCHED_WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+// Echo lookup by interface and CAN ID: open addressing, at most half full
+#define TABLE_BITS 9
+#define TABLE_SIZE (1 << TABLE_BITS)
+
+struct tx_entry {
+    struct tx_sched_msg msg;
+    struct tx_sched_stats stats;
+    uint64_t last_seen_ns;      // RX path only
+
+    // Timer wheel (messages not sent by CAN_BCM)
+    uint64_t due;               // Tick of the next transmission
+    struct tx_entry* next;
+};
+
+struct tx_socket {
+    int bcm;                    // CAN_BCM socket, -1 if not used
+    int raw;                    // Raw socket for wheel sends, -1 if not used
+};
+
+static struct tx_entry entries[TX_SCHED_MAX_MSGS];
+static int num_entries = 0;
+static int16_t table[TABLE_SIZE];   // Entry index + 1, 0 = empty
+
+static struct tx_socket sockets[MAX_CAN_IFACES];
+
+static struct tx_entry* wheel[TX_SCHED_WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t occupied[TX_SCHED_WHEEL_LEVELS];   // Bit per non-empty slot
+static uint64_t wheel_tick = 0;     // Last tick processed
+static uint64_t wheel_base_ns = 0;  // CLOCK_MONOTONIC of tick 0
+static struct event_source timer_ev = { -1, NULL, NULL };
+
+static inline unsigned int table_slot(int iface, canid_t id) {
+    return ((id ^ ((uint32_t)iface << 29)) * 2654435769u) >> (32 - TABLE_BITS);
+}
+
+int tx_sched_add(int iface, const struct canfd_frame* frame, unsigned int period_ms) {
+    if (iface < 0 || iface >= MAX_CAN_IFACES || period_ms == 0 || period_ms > TX_SCHED_MAX_PERIOD_MS) {
+        fprintf(stderr, "Invalid cyclic message (period 1..%d ms)\n", TX_SCHED_MAX_PERIOD_MS);
+        return -1;
+    }
+    if (num_entries >= TX_SCHED_MAX_MSGS) {
+        fprintf(stderr, "Too many cyclic messages (max %d)\n", TX_SCHED_MAX_MSGS);
+        return -1;
+    }
+
+    unsigned int slot = table_slot(iface, frame->can_id);
+    while (table[slot] != 0) {
+        const struct tx_sched_msg* m = &entries[table[slot] - 1].msg;
+        if (m->iface == iface && m->frame.can_id == frame->can_id) {
+            fprintf(stderr, "CAN ID %X is already cyclic on this interface\n",
+                    frame->can_id & CAN_EFF_MASK);
+            return -1;
+        }
+        slot = (slot + 1) & (TABLE_SIZE - 1);
+    }
+
+    struct tx_entry* e = &entries[num_entries];
+    memset(e, 0, sizeof(*e));
+    e->msg.iface = iface;
+    e->msg.frame = *frame;
+    e->msg.period_ms = period_ms;
+    table[slot] = ++num_entries;
+    return 0;
+}
+
+int tx_sched_count(void) {
+    return num_entries;
+}
+
+const struct tx_sched_msg* tx_sched_msg(int i) {
+    return i >= 0 && i < num_entries ? &entries[i].msg : NULL;
+}
+
+const struct tx_sched_stats* tx_sched_stats(int i) {
+    return i >= 0 && i < num_entries ? &entries[i].stats : NULL;
+}
+
+// Wheel slot for an entry due in delta ticks: the lowest level whose range
+// covers the delta, indexed by the due tick's bits of that level
+static void wheel_insert(struct tx_entry* e) {
+    uint64_t delta = e->due - wheel_tick;
+    int level = 0;
+
+    while (level < TX_SCHED_WHEEL_LEVELS - 1 && delta >= (1ull << (TX_SCHED_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    unsigned int slot = (e->due >> (TX_SCHED_WHEEL_BITS * level)) & WHEEL_MASK;
+    e->next = wheel[level][slot];
+    wheel[level][slot] = e;
+    occupied[level] |= 1ull << slot;
+}
+
+// Move a higher level slot's entries down once the wheel reaches its range
+static void wheel_cascade(int level, unsigned int slot) {
+    struct tx_entry* e = wheel[level][slot];
+
+    wheel[level][slot] = NULL;
+    occupied[level] &= ~(1ull << slot);
+    while (e != NULL) {
+        struct tx_entry* next = e->next;
+        wheel_insert(e);
+        e = next;
+    }
+}
+
+// Send every frame due in the current tick, one sendmmsg() per interface
+static void send_due(struct tx_entry* due) {
+    static struct mmsghdr msgs[TX_SCHED_MAX_MSGS];
+    static struct iovec iov[TX_SCHED_MAX_MSGS];
+    static struct tx_entry* batch[TX_SCHED_MAX_MSGS];
+
+    for (int i = 0; i < MAX_CAN_IFACES; i++) {
+        int count = 0;
+        for (struct tx_entry* e = due; e != NULL; e = e->next) {
+            if (e->msg.iface != i) {
+                continue;
+            }
+            iov[count].iov_base = &e->msg.frame;
+            iov[count].iov_len = can_frame_mtu(&e->msg.frame);
+            memset(&msgs[count], 0, sizeof(msgs[count]));
+            msgs[count].msg_hdr.msg_iov = &iov[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            batch[count++] = e;
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        int done = sendmmsg(sockets[i].raw, msgs, count, MSG_DONTWAIT);
+        if (done < 0) {
+            done = 0;
+        }
+        // A full TX queue costs the cycle; the next one is sent on time
+        for (int n = 0; n < count; n++) {
+            struct tx_sched_stats* st = &batch[n]->stats;
+            if (n < done) {
+                __atomic_store_n(&st->sent, st->sent + 1, __ATOMIC_RELAXED);
+            }
+            else {
+                __atomic_store_n(&st->errors, st->errors + 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+// Process every tick up to now: cascade, send and reschedule
+static void wheel_advance(uint64_t now) {
+    while (wheel_tick < now) {
+        wheel_tick++;
+
+        // Highest level first, so its entries can fall through to level 0
+        for (int level = TX_SCHED_WHEEL_LEVELS - 1; level > 0; level--) {
+            uint64_t low_bits = (1ull << (TX_SCHED_WHEEL_BITS * level)) - 1;
+            if ((wheel_tick & low_bits) == 0) {
+                wheel_cascade(level, (wheel_tick >> (TX_SCHED_WHEEL_BITS * level)) & WHEEL_MASK);
+            }
+        }
+
+        unsigned int slot = wheel_tick & WHEEL_MASK;
+        struct tx_entry* due = wheel[0][slot];
+        if (due == NULL) {
+            continue;
+        }
+        wheel[0][slot] = NULL;
+        occupied[0] &= ~(1ull << slot);
+
+        send_due(due);
+
+        // Keep the phase; cycles the loop slept through are skipped
+        for (struct tx_entry* e = due; e != NULL;) {
+            struct tx_entry* next = e->next;
+            e->due += e->msg.period_ms;
+            if (e->due <= now) {
+                uint64_t behind = (now - e->due) / e->msg.period_ms + 1;
+                e->due += behind * e->msg.period_ms;
+                __atomic_store_n(&e->stats.missed, e->stats.missed + behind, __ATOMIC_RELAXED);
+            }
+            wheel_insert(e);
+            e = next;
+        }
+    }
+}
+
+// Tick of the next wakeup: the next occupied level 0 slot, or the next
+// level 0 wrap if higher levels have entries to cascade there, whichever
+// comes first. 0 if the wheel is empty.
+static uint64_t wheel_next(void) {
+    uint64_t next = 0;
+
+    for (int level = 1; level < TX_SCHED_WHEEL_LEVELS; level++) {
+        if (occupied[level] != 0) {
+            next = (wheel_tick | WHEEL_MASK) + 1;
+            break;
+        }
+    }
+
+    uint64_t bits = occupied[0];
+    if (bits != 0) {
+        unsigned int pos = (wheel_tick + 1) & WHEEL_MASK;
+        uint64_t rotated = pos != 0 ? (bits >> pos) | (bits << (WHEEL_SLOTS - pos)) : bits;
+        uint64_t slot_tick = wheel_tick + 1 + __builtin_ctzll(rotated);
+        if (next == 0 || slot_tick < next) {
+            next = slot_tick;
+        }
+    }
+    return next;
+}
+
+static void arm_timer(void) {
+    struct itimerspec its;
+    uint64_t next = wheel_next();
+
+    memset(&its, 0, sizeof(its));
+    if (next != 0) {
+        uint64_t ns = wheel_base_ns + next * TX_SCHED_TICK_NS;
+        its.it_value.tv_sec = ns / 1000000000ull;
+        its.it_value.tv_nsec = ns % 1000000000ull;
+    }
+    if (timerfd_settime(timer_ev.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("Error arming TX scheduler timer");
+    }
+}
+
+static void on_wheel_timer(struct event_source* src, uint32_t events) {
+    uint64_t expirations;
+    (void)events;
+
+    while (read(src->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {
+    }
+    wheel_advance((monotonic_ns() - wheel_base_ns) / TX_SCHED_TICK_NS);
+    arm_timer();
+}
+
+static int open_socket(int type, int protocol, const char* name) {
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+
+    int sock = socket(PF_CAN, type, protocol);
+    if (sock < 0) {
+        return -1;
+    }
+
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
+        close(sock);
+        return -1;
+    }
+    addr.can_ifindex = ifr.ifr_ifindex;
+
+    // CAN_BCM sockets are connected, raw sockets bound
+    int ret = protocol == CAN_BCM ? connect(sock, (struct sockaddr*)&addr, sizeof(addr))
+                                  : bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+    if (ret < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Send-only raw socket for the wheel: receives nothing, so its frames only
+// come back on the RX socket
+static int open_raw_socket(const struct can_iface* iface) {
+    int sock = open_socket(SOCK_RAW, CAN_RAW, iface->name);
+    if (sock < 0) {
+        perror("Error opening TX scheduler socket");
+        return -1;
+    }
+    setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+    if (iface->fd) {
+        int enable = 1;
+        setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable));
+    }
+    return sock;
+}
+
+// Hand one message to the broadcast manager: sent every period from now on
+static int bcm_setup(int sock, struct tx_entry* e) {
+    // TX_SETUP carries the frame (can_frame or canfd_frame) after the header
+    alignas(8) char req[sizeof(struct bcm_msg_head) + sizeof(struct canfd_frame)];
+    struct bcm_msg_head* head = (struct bcm_msg_head*)req;
+
+    memset(req, 0, sizeof(req));
+    head->opcode = TX_SETUP;
+    head->flags = SETTIMER | STARTTIMER | (can_frame_is_fd(&e->msg.frame) ? CAN_FD_FRAME : 0);
+    head->count = 0;
+    head->ival2.tv_sec = e->msg.period_ms / 1000;
+    head->ival2.tv_usec = (e->msg.period_ms % 1000) * 1000;
+    head->can_id = e->msg.frame.can_id;
+    head->nframes = 1;
+
+    size_t mtu = can_frame_mtu(&e->msg.frame);
+    memcpy(head->frames, &e->msg.frame, mtu);
+
+    size_t size = sizeof(struct bcm_msg_head) + mtu;
+    if (write(sock, req, size) != (ssize_t)size) {
+        return -1;
+    }
+    return 0;
+}
+
+int tx_sched_start(const struct can_iface* ifaces, int count, bool use_bcm,
+                   struct event_loop* loop) {
+    bool wheel_used = false;
+
+    for (int i = 0; i < MAX_CAN_IFACES; i++) {
+        sockets[i].bcm = -1;
+        sockets[i].raw = -1;
+    }
+    if (num_entries == 0) {
+        return 0;
+    }
+
+    uint64_t start = monotonic_ns();
+    wheel_base_ns = start;
+    wheel_tick = 0;
+
+    for (int n = 0; n < num_entries; n++) {
+        struct tx_entry* e = &entries[n];
+        int i = e->msg.iface;
+        if (i >= count || ifaces[i].sock < 0) {
+            continue;
+        }
+        if (can_frame_is_fd(&e->msg.frame) && !ifaces[i].fd) {
+            fprintf(stderr, "Cyclic CAN-FD message on classic CAN interface %s\n", ifaces[i].name);
+            return -1;
+        }
+
+        if (use_bcm && sockets[i].bcm < 0) {
+            sockets[i].bcm = open_socket(SOCK_DGRAM, CAN_BCM, ifaces[i].name);
+            if (sockets[i].bcm < 0) {
+                perror("Warning: CAN_BCM not available, cyclic messages use the timer wheel");
+                use_bcm = false;
+            }
+        }
+        if (use_bcm && bcm_setup(sockets[i].bcm, e) == 0) {
+            e->msg.bcm = true;
+            e->stats.sent = 1;
+            continue;
+        }
+
+        if (sockets[i].raw < 0) {
+            sockets[i].raw = open_raw_socket(&ifaces[i]);
+            if (sockets[i].raw < 0) {
+                return -1;
+            }
+        }
+        // Spread the first transmissions so equal periods do not collide
+        e->due = 1 + n % e->msg.period_ms;
+        wheel_insert(e);
+        wheel_used = true;
+    }
+
+    if (wheel_used) {
+        timer_ev.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_ev.fd < 0) {
+            perror("Error creating TX scheduler timer");
+            return -1;
+        }
+        timer_ev.handler = on_wheel_timer;
+        timer_ev.ctx = NULL;
+        if (event_loop_add(loop, &timer_ev, EPOLLIN) < 0) {
+            return -1;
+        }
+        arm_timer();
+    }
+    return 0;
+}
+
+bool tx_sched_echo(int iface, const struct canfd_frame* frame, uint64_t ts) {
+    if (num_entries == 0) {
+        return false;
+    }
+
+    struct tx_entry* e = NULL;
+    for (unsigned int slot = table_slot(iface, frame->can_id); table[slot] != 0;
+         slot = (slot + 1) & (TABLE_SIZE - 1)) {
+        struct tx_entry* c = &entries[table[slot] - 1];
+        if (c->msg.iface == iface && c->msg.frame.can_id == frame->can_id) {
+            e = c;
+            break;
+        }
+    }
+    if (e == NULL) {
+        return false;
+    }
+
+    struct tx_sched_stats* st = &e->stats;
+    if (e->last_seen_ns != 0 && ts > e->last_seen_ns) {
+        uint64_t interval = ts - e->last_seen_ns;
+        uint64_t period = (uint64_t)e->msg.period_ms * 1000000ull;
+        uint64_t jitter = interval > period ? interval - period : period - interval;
+
+        latency_record(&iface_latency[iface].tx_jitter, jitter);
+        __atomic_store_n(&st->jitter_sum_ns, st->jitter_sum_ns + jitter, __ATOMIC_RELAXED);
+        if (jitter > st->jitter_max_ns) {
+            __atomic_store_n(&st->jitter_max_ns, jitter, __ATOMIC_RELAXED);
+        }
+    }
+    e->last_seen_ns = ts;
+    __atomic_store_n(&st->seen, st->seen + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void tx_sched_stop(void) {
+    if (timer_ev.fd >= 0) {
+        close(timer_ev.fd);
+        timer_ev.fd = -1;
+    }
+    // Closing a CAN_BCM socket deletes its TX operations
+    for (int i = 0; i < MAX_CAN_IFACES; i++) {
+        if (sockets[i].bcm >= 0) {
+            close(sockets[i].bcm);
+            sockets[i].bcm = -1;
+        }
+        if (sockets[i].raw >= 0) {
+            close(sockets[i].raw);
+            sockets[i].raw = -1;
+        }
+    }
+}
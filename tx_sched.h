@@ -0,0 +1,81 @@
+/*
+ * Periodic TX scheduler for cyclic messages
+ *
+ * Cyclic messages (e.g. TSC1 every 10 ms) are handed to the kernel
+ * broadcast manager (CAN_BCM) where it is available: the kernel's
+ * high-resolution timers then send them and the bridge is not involved
+ * per cycle. Without CAN_BCM (or with -u) the bridge sends them from a
+ * hierarchical timer wheel with 1 ms ticks driven by one absolute
+ * CLOCK_MONOTONIC timerfd, which is armed for the next occupied tick only.
+ *
+ * Either way every transmission is looped back by the kernel to the
+ * bridge's RX socket. Its RX timestamp is the measurement point: the
+ * deviation of the interval between two transmissions of a message from
+ * its period is the TX jitter, recorded per interface (latency.h) and per
+ * message, and published through the statistics segment. Looped-back
+ * cyclic frames are neither decoded nor forwarded.
+ */
+
+#ifndef TX_SCHED_H
+#define TX_SCHED_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+#include "can_iface.h"
+#include "event_loop.h"
+
+// Cyclic messages across all interfaces
+#define TX_SCHED_MAX_MSGS 256
+
+// Wheel resolution (the shortest period) and range: 4 levels of 64 slots
+// cover 2^24 ticks (4.6 hours)
+#define TX_SCHED_TICK_NS 1000000
+#define TX_SCHED_WHEEL_BITS 6
+#define TX_SCHED_WHEEL_LEVELS 4
+
+// Longest period accepted
+#define TX_SCHED_MAX_PERIOD_MS 3600000
+
+// Per-message counters
+struct tx_sched_stats {
+    uint64_t sent;              // Handed to the socket (wheel), or set up once (BCM)
+    uint64_t errors;            // Sends that failed; each misses one cycle
+    uint64_t missed;            // Cycles skipped because the loop woke up too late
+    uint64_t seen;              // Transmissions looped back by the kernel
+    uint64_t jitter_max_ns;
+    uint64_t jitter_sum_ns;     // Over seen - 1 intervals
+};
+
+// Describes one cyclic message
+struct tx_sched_msg {
+    int iface;
+    struct canfd_frame frame;
+    uint32_t period_ms;
+    bool bcm;                   // Sent by CAN_BCM (valid after tx_sched_start())
+};
+
+// Add a cyclic message. Messages are keyed by interface and CAN ID (like
+// CAN_BCM): an ID can only be scheduled once per interface. Returns 0 or -1.
+int tx_sched_add(int iface, const struct canfd_frame* frame, unsigned int period_ms);
+
+// Number of cyclic messages, and message i with its counters
+int tx_sched_count(void);
+const struct tx_sched_msg* tx_sched_msg(int i);
+const struct tx_sched_stats* tx_sched_stats(int i);
+
+// Start sending on the open interfaces. With use_bcm false (or when
+// CAN_BCM is unavailable) the timer wheel on loop sends the messages.
+// Returns 0 or -1.
+int tx_sched_start(const struct can_iface* ifaces, int count, bool use_bcm,
+                   struct event_loop* loop);
+
+// RX path: a frame sent from this host was received on iface at ts
+// (CLOCK_REALTIME ns). Returns true if it was one of the cyclic messages.
+bool tx_sched_echo(int iface, const struct canfd_frame* frame, uint64_t ts);
+
+// Stop all cyclic messages and close the scheduler's sockets
+void tx_sched_stop(void);
+
+#endif // TX_SCHED_H
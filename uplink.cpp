@@ -0,0 +1,435 @@
+/*
+ * Batched, compact CAN uplink to a remote collector
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "uplink.h"
+#include "arena.h"
+#include "clock_util.h"
+
+#define UPLINK_QUEUE_MASK (UPLINK_QUEUE_PACKETS - 1)
+
+// Longest record: 10-byte varint, tag, ID, length, flags, FD payload
+#define UPLINK_MAX_RECORD (10 + 1 + 4 + 1 + 1 + CANFD_MAX_DLEN)
+
+// ID hash slots (power of two, at most half used)
+#define UPLINK_ID_HASH 512
+
+// A closed packet waiting for the socket
+struct uplink_packet {
+    uint32_t len;               // Header included
+    uint32_t raw_len;           // Before compression
+    uint32_t sent;              // Bytes already written (TCP)
+    uint32_t frames;
+    uint8_t data[UPLINK_MAX_PACKET];
+};
+
+// Dictionary entry of the open packet with the frame last sent with it
+struct uplink_id {
+    canid_t id;
+    uint8_t len;
+    uint8_t flags;
+    uint8_t data[CANFD_MAX_DLEN];
+};
+
+struct uplink_id_slot {
+    uint32_t gen;               // Valid if equal to the open packet's generation
+    canid_t id;
+    uint8_t index;
+};
+
+bool uplink_enabled = false;
+
+static bool use_tcp = false;
+static struct sockaddr_storage peer;
+static socklen_t peer_len = 0;
+static struct event_loop* uplink_loop = NULL;
+static struct event_source sock_ev = { -1, NULL, NULL };
+static struct event_source timer_ev = { -1, NULL, NULL };
+static bool connected = false;
+static uint64_t next_connect_ns = 0;
+
+static struct uplink_packet* queue = NULL;
+static unsigned int q_head = 0;     // Next slot to fill
+static unsigned int q_tail = 0;     // Next slot to send
+
+// The open packet
+static uint8_t body[UPLINK_MAX_PACKET];
+static size_t body_len = 0;
+static size_t body_limit = 0;
+static uint32_t body_frames = 0;
+static uint64_t base_us = 0;
+static uint64_t last_us = 0;
+static struct uplink_id ids[UPLINK_MAX_IDS];
+static int num_ids = 0;
+static struct uplink_id_slot id_hash[UPLINK_ID_HASH];
+static uint32_t gen = 1;
+static uint32_t seq = 0;
+static unsigned int sample_count = 0;
+
+static struct uplink_stats st;
+
+static void disconnect(void) {
+    if (connected) {
+        fprintf(stderr, "Uplink connection lost, reconnecting\n");
+    }
+    close(sock_ev.fd);
+    sock_ev.fd = -1;
+    connected = false;
+    next_connect_ns = monotonic_ns() + UPLINK_RECONNECT_MS * 1000000ULL;
+
+    // A partly written packet is sent again on the next connection
+    if (q_tail != q_head) {
+        queue[q_tail & UPLINK_QUEUE_MASK].sent = 0;
+    }
+}
+
+// Write queued packets until the socket would block
+static void send_queued(void) {
+    while (connected && q_tail != q_head) {
+        struct uplink_packet* pkt = &queue[q_tail & UPLINK_QUEUE_MASK];
+        ssize_t n = send(sock_ev.fd, pkt->data + pkt->sent, pkt->len - pkt->sent,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Full: EPOLLOUT (TCP) or the next tick resumes
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                return;
+            }
+            if (use_tcp) {
+                disconnect();
+                return;
+            }
+            // UDP: e.g. ECONNREFUSED while the collector is down
+            st.send_errors++;
+            q_tail++;
+            continue;
+        }
+        pkt->sent += n;
+        if (pkt->sent == pkt->len) {
+            st.packets++;
+            st.bytes += pkt->len;
+            st.raw_bytes += pkt->raw_len;
+            q_tail++;
+        }
+    }
+}
+
+static void reset_packet(void) {
+    body_len = 0;
+    body_frames = 0;
+    num_ids = 0;
+    gen++;
+}
+
+// Move the open packet to the queue and start sending it
+static void close_packet(void) {
+    if (body_frames == 0) {
+        return;
+    }
+    if (q_head - q_tail >= UPLINK_QUEUE_PACKETS) {
+        st.dropped += body_frames;
+        seq++;      // The gap tells the collector
+        reset_packet();
+        return;
+    }
+
+    struct uplink_packet* pkt = &queue[q_head & UPLINK_QUEUE_MASK];
+    uint8_t* hdr = pkt->data;
+    size_t len = body_len;
+    uint8_t flags = 0;
+#ifdef CAN_BRIDGE_LZ4
+    int n = LZ4_compress_default((const char*)body, (char*)hdr + UPLINK_HEADER_SIZE, body_len,
+                                 UPLINK_MAX_PACKET - UPLINK_HEADER_SIZE);
+    if (n > 0 && (size_t)n < body_len) {
+        len = n;
+        flags |= UPLINK_F_LZ4;
+    }
+#endif
+    if (!(flags & UPLINK_F_LZ4)) {
+        memcpy(hdr + UPLINK_HEADER_SIZE, body, body_len);
+    }
+
+    hdr[0] = 'C';
+    hdr[1] = 'U';
+    hdr[2] = UPLINK_VERSION;
+    hdr[3] = flags;
+    uplink_put_le(hdr + 4, seq++, 4);
+    uplink_put_le(hdr + 8, base_us, 8);
+    uplink_put_le(hdr + 16, len, 2);
+    uplink_put_le(hdr + 18, body_frames, 2);
+    pkt->len = UPLINK_HEADER_SIZE + len;
+    pkt->raw_len = UPLINK_HEADER_SIZE + body_len;
+    pkt->sent = 0;
+    pkt->frames = body_frames;
+    q_head++;
+
+    reset_packet();
+    send_queued();
+}
+
+// Dictionary index of id in the open packet, -1 if it is not in it yet
+static int find_id(canid_t id, struct uplink_id_slot** free_slot) {
+    unsigned int h = (id * 2654435761u) >> 23;
+
+    for (;; h++) {
+        struct uplink_id_slot* slot = &id_hash[h & (UPLINK_ID_HASH - 1)];
+        if (slot->gen != gen) {
+            *free_slot = slot;
+            return -1;
+        }
+        if (slot->id == id) {
+            return slot->index;
+        }
+    }
+}
+
+void uplink_write(uint64_t ts_ns, int iface, const struct canfd_frame* frame) {
+    // Backpressure: thin out the traffic before the queue fills up
+    if (q_head - q_tail >= UPLINK_QUEUE_PACKETS / 2 && ++sample_count % UPLINK_SAMPLE_RATE != 0) {
+        st.sampled++;
+        return;
+    }
+    if (body_len + UPLINK_MAX_RECORD > body_limit || num_ids >= UPLINK_MAX_IDS) {
+        close_packet();
+    }
+
+    uint64_t ts_us = ts_ns / 1000;
+    if (body_frames == 0) {
+        base_us = ts_us;
+        last_us = ts_us;
+    }
+    // Frames are in order per interface only (the RX threads are drained
+    // one after the other), so the delta is signed
+    int64_t diff = (int64_t)(ts_us - last_us);
+    uint64_t delta = ((uint64_t)diff << 1) ^ (uint64_t)(diff >> 63);
+    last_us = ts_us;
+
+    uint8_t* p = body + body_len;
+    do {
+        *p++ = (delta & 0x7F) | (delta > 0x7F ? 0x80 : 0);
+        delta >>= 7;
+    } while (delta != 0);
+
+    bool fd = can_frame_is_fd(frame);
+    uint8_t len = can_frame_len(frame);
+    uint8_t flags = fd ? frame->flags | CANFD_FDF : 0;
+    uint8_t tag = (iface & UPLINK_T_IFACE_MASK) | (fd ? UPLINK_T_FD : 0);
+    uint8_t* tag_p = p++;
+
+    struct uplink_id_slot* slot = NULL;
+    int index = find_id(frame->can_id, &slot);
+    struct uplink_id* entry;
+    if (index < 0) {
+        index = num_ids++;
+        slot->gen = gen;
+        slot->id = frame->can_id;
+        slot->index = index;
+        entry = &ids[index];
+        entry->id = frame->can_id;
+        entry->len = 0xFF;      // Matches no frame
+        tag |= UPLINK_T_NEW_ID;
+        uplink_put_le(p, frame->can_id, 4);
+        p += 4;
+    }
+    else {
+        entry = &ids[index];
+        *p++ = index;
+    }
+
+    if (entry->len == len && entry->flags == flags && memcmp(entry->data, frame->data, len) == 0) {
+        tag |= UPLINK_T_REPEAT;
+    }
+    else {
+        entry->len = len;
+        entry->flags = flags;
+        memcpy(entry->data, frame->data, len);
+        *p++ = len;
+        if (fd) {
+            *p++ = flags & ~CANFD_FDF;
+        }
+        memcpy(p, frame->data, len);
+        p += len;
+    }
+    *tag_p = tag;
+
+    body_len = p - body;
+    body_frames++;
+    st.frames++;
+}
+
+static int start_connect(void) {
+    int sock = socket(peer.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("Error creating uplink socket");
+        return -1;
+    }
+    // Packets are already batched
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(sock, (const struct sockaddr*)&peer, peer_len) < 0 && errno != EINPROGRESS) {
+        close(sock);
+        next_connect_ns = monotonic_ns() + UPLINK_RECONNECT_MS * 1000000ULL;
+        return 0;
+    }
+    // Writable once the connection is established (or has failed)
+    sock_ev.fd = sock;
+    return event_loop_add(uplink_loop, &sock_ev, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+}
+
+static void on_socket(struct event_source* src, uint32_t events) {
+    if (!connected) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(src->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            disconnect();
+            return;
+        }
+        connected = true;
+        st.connects++;
+    }
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+        disconnect();
+        return;
+    }
+    if (events & EPOLLIN) {
+        // The collector has nothing to say; EOF means it went away
+        char buf[256];
+        ssize_t n;
+        while ((n = read(src->fd, buf, sizeof(buf))) > 0) {
+        }
+        if (n == 0) {
+            disconnect();
+            return;
+        }
+    }
+    send_queued();
+}
+
+static void on_tick(struct event_source* src, uint32_t events) {
+    uint64_t expirations;
+    (void)events;
+
+    while (read(src->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {
+    }
+    close_packet();
+    if (use_tcp && sock_ev.fd < 0 && monotonic_ns() >= next_connect_ns) {
+        start_connect();
+    }
+    send_queued();
+}
+
+static int resolve(const char* host, const char* port) {
+    struct addrinfo hints;
+    struct addrinfo* res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = use_tcp ? SOCK_STREAM : SOCK_DGRAM;
+    int ret = getaddrinfo(host, port, &hints, &res);
+    if (ret != 0) {
+        fprintf(stderr, "Error resolving uplink %s:%s: %s\n", host, port, gai_strerror(ret));
+        return -1;
+    }
+    memcpy(&peer, res->ai_addr, res->ai_addrlen);
+    peer_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+int uplink_open(bool tcp, const char* host, const char* port, int flush_ms,
+                struct event_loop* loop) {
+    use_tcp = tcp;
+    uplink_loop = loop;
+    body_limit = (tcp ? UPLINK_TCP_PACKET : UPLINK_UDP_PACKET) - UPLINK_HEADER_SIZE;
+    if (flush_ms <= 0) {
+        fprintf(stderr, "Invalid uplink flush interval %d ms\n", flush_ms);
+        return -1;
+    }
+    if (resolve(host, port) < 0) {
+        return -1;
+    }
+
+    queue = (struct uplink_packet*)arena_alloc(sizeof(struct uplink_packet) * UPLINK_QUEUE_PACKETS,
+                                               64, "uplink queue");
+    if (queue == NULL) {
+        fprintf(stderr, "Error allocating uplink queue\n");
+        return -1;
+    }
+
+    sock_ev.handler = on_socket;
+    if (tcp) {
+        if (start_connect() < 0) {
+            return -1;
+        }
+    }
+    else {
+        sock_ev.fd = socket(peer.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock_ev.fd < 0) {
+            perror("Error creating uplink socket");
+            return -1;
+        }
+        if (connect(sock_ev.fd, (const struct sockaddr*)&peer, peer_len) < 0) {
+            perror("Error connecting uplink socket");
+            return -1;
+        }
+        connected = true;
+    }
+
+    // Closes packets, resumes UDP sends after ENOBUFS and reconnects TCP
+    struct itimerspec its;
+    timer_ev.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_ev.fd < 0) {
+        perror("Error creating uplink timer");
+        return -1;
+    }
+    timer_ev.handler = on_tick;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = flush_ms / 1000;
+    its.it_value.tv_nsec = (flush_ms % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    if (timerfd_settime(timer_ev.fd, 0, &its, NULL) < 0) {
+        perror("Error arming uplink timer");
+        return -1;
+    }
+    if (event_loop_add(loop, &timer_ev, EPOLLIN) < 0) {
+        return -1;
+    }
+
+    uplink_enabled = true;
+    return 0;
+}
+
+const struct uplink_stats* uplink_stats(void) {
+    return &st;
+}
+
+void uplink_close(void) {
+    if (!uplink_enabled) {
+        return;
+    }
+    uplink_enabled = false;
+    close_packet();
+    send_queued();
+    if (sock_ev.fd >= 0) {
+        close(sock_ev.fd);
+        sock_ev.fd = -1;
+    }
+    close(timer_ev.fd);
+    timer_ev.fd = -1;
+    connected = false;
+}
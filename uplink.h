@@ -0,0 +1,224 @@
+/*
+ * Batched, compact CAN uplink to a remote collector
+ *
+ * With -U the downstream stage also encodes every frame into an uplink
+ * packet. A packet is closed when it is full, and at the latest flush_ms
+ * after its first frame, and sent over a connected UDP socket (one
+ * datagram per packet) or a TCP connection (packets back to back). Sends
+ * never block: closed packets wait in a bounded queue while the socket is
+ * busy. Once the queue is half full only every UPLINK_SAMPLE_RATE-th frame
+ * is encoded, and when it is full new packets are dropped, so a slow or
+ * missing link costs the bridge loop nothing but the counters. A lost TCP connection
+ * is reopened every UPLINK_RECONNECT_MS.
+ *
+ * Packets are self-contained, so losing a datagram loses only its frames:
+ *
+ *   header (20 bytes, little endian)
+ *     "CU", version, flags (UPLINK_F_LZ4: body is LZ4 compressed),
+ *     u32 sequence (per packet, for loss detection), u64 timestamp of the
+ *     first frame (CLOCK_REALTIME us), u16 body bytes, u16 frames
+ *   body, one record per frame
+ *     varint  time since the previous frame of the packet (us), signed,
+ *             zigzag encoded (2n for n >= 0, -2n - 1 for n < 0): frames are
+ *             in order per interface only, so the time may go back
+ *     u8      tag: interface index (bits 0-2), UPLINK_T_* flags
+ *     u32     CAN ID with flags, if UPLINK_T_NEW_ID: the ID becomes the
+ *             next entry of the packet's ID dictionary
+ *     u8      dictionary index otherwise
+ *     u8 len, [u8 canfd flags if UPLINK_T_FD], len data bytes, unless
+ *             UPLINK_T_REPEAT: same length and data as the previous
+ *             frame with this dictionary entry
+ *
+ * A cyclic 8-byte frame takes 5 to 13 bytes instead of ~50 as a candump
+ * line; building with LZ4=1 compresses each packet body on top.
+ */
+
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <linux/can.h>
+
+#include "can_fd.h"
+#include "event_loop.h"
+
+#ifdef CAN_BRIDGE_LZ4
+#include <lz4.h>
+#endif
+
+#define UPLINK_VERSION 2
+#define UPLINK_HEADER_SIZE 20
+
+// Packet sizes: UDP packets fit a cellular MTU unfragmented
+#define UPLINK_UDP_PACKET 1200
+#define UPLINK_TCP_PACKET 4096
+#define UPLINK_MAX_PACKET UPLINK_TCP_PACKET
+
+// Default time bound of a packet
+#define UPLINK_DEFAULT_FLUSH_MS 100
+
+// Closed packets waiting for the socket (power of two)
+#define UPLINK_QUEUE_PACKETS 32
+
+// With the queue half full only one frame in this many is sent
+#define UPLINK_SAMPLE_RATE 4
+
+#define UPLINK_RECONNECT_MS 1000
+
+// ID dictionary entries per packet
+#define UPLINK_MAX_IDS 255
+
+// Header flags
+#define UPLINK_F_LZ4 0x01
+
+// Record tag flags
+#define UPLINK_T_IFACE_MASK 0x07
+#define UPLINK_T_FD 0x08
+#define UPLINK_T_NEW_ID 0x10
+#define UPLINK_T_REPEAT 0x20
+
+struct uplink_stats {
+    uint64_t frames;            // Encoded into packets
+    uint64_t sampled;           // Skipped while the queue was half full
+    uint64_t dropped;           // In packets dropped because the queue was full
+    uint64_t packets;           // Sent
+    uint64_t bytes;             // Sent, headers included
+    uint64_t raw_bytes;         // The same packets before compression
+    uint64_t send_errors;       // Packets lost to socket errors
+    uint64_t connects;          // TCP connections established
+};
+
+extern bool uplink_enabled;
+
+// Connect to host:port (resolved once, TCP connects in the background)
+// with packets closed after flush_ms. Returns 0 or -1.
+int uplink_open(bool tcp, const char* host, const char* port, int flush_ms,
+                struct event_loop* loop);
+
+// Encode a frame (downstream stage only)
+void uplink_write(uint64_t ts_ns, int iface, const struct canfd_frame* frame);
+
+static inline void uplink_frame(uint64_t ts_ns, int iface, const struct canfd_frame* frame) {
+    if (uplink_enabled) {
+        uplink_write(ts_ns, iface, frame);
+    }
+}
+
+const struct uplink_stats* uplink_stats(void);
+
+// Send what is buffered without blocking, then close the socket
+void uplink_close(void);
+
+static inline void uplink_put_le(uint8_t* p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+static inline uint64_t uplink_get_le(const uint8_t* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+// Collector side: per-packet state of the decoder
+struct uplink_decoder {
+    uint32_t seq;               // Of the last packet
+    struct canfd_frame ids[UPLINK_MAX_IDS];     // Last frame per dictionary entry
+    uint8_t body[UPLINK_MAX_PACKET];            // Decompressed body
+};
+
+typedef void (*uplink_frame_fn)(void* ctx, uint64_t ts_us, int iface, const struct canfd_frame* frame);
+
+// Decode one packet, calling fn for every frame. Returns the number of
+// frames, or -1 if the packet is malformed (or compressed while LZ4 is not
+// built in).
+static inline int uplink_decode(struct uplink_decoder* dec, const uint8_t* pkt, size_t size,
+                                uplink_frame_fn fn, void* ctx) {
+    if (size < UPLINK_HEADER_SIZE || pkt[0] != 'C' || pkt[1] != 'U' || pkt[2] != UPLINK_VERSION) {
+        return -1;
+    }
+    dec->seq = uplink_get_le(pkt + 4, 4);
+    uint64_t ts = uplink_get_le(pkt + 8, 8);
+    size_t len = uplink_get_le(pkt + 16, 2);
+    int count = uplink_get_le(pkt + 18, 2);
+    const uint8_t* p = pkt + UPLINK_HEADER_SIZE;
+    if (len > size - UPLINK_HEADER_SIZE) {
+        return -1;
+    }
+    if (pkt[3] & UPLINK_F_LZ4) {
+#ifdef CAN_BRIDGE_LZ4
+        int n = LZ4_decompress_safe((const char*)p, (char*)dec->body, len, sizeof(dec->body));
+        if (n < 0) {
+            return -1;
+        }
+        p = dec->body;
+        len = n;
+#else
+        return -1;
+#endif
+    }
+
+    const uint8_t* end = p + len;
+    int num_ids = 0;
+    for (int n = 0; n < count; n++) {
+        uint64_t zigzag = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (p >= end || shift > 63) {
+                return -1;
+            }
+            zigzag |= (uint64_t)(*p & 0x7F) << shift;
+            if (!(*p++ & 0x80)) {
+                break;
+            }
+        }
+        ts += (zigzag >> 1) ^ (0 - (zigzag & 1));
+
+        if (p >= end) {
+            return -1;
+        }
+        uint8_t tag = *p++;
+        struct canfd_frame* frame;
+        if (tag & UPLINK_T_NEW_ID) {
+            if (end - p < 4 || num_ids >= UPLINK_MAX_IDS) {
+                return -1;
+            }
+            frame = &dec->ids[num_ids++];
+            memset(frame, 0, sizeof(*frame));
+            frame->can_id = uplink_get_le(p, 4);
+            p += 4;
+        }
+        else {
+            if (p >= end || *p >= num_ids) {
+                return -1;
+            }
+            frame = &dec->ids[*p++];
+        }
+        if (!(tag & UPLINK_T_REPEAT)) {
+            if (p >= end || *p > CANFD_MAX_DLEN) {
+                return -1;
+            }
+            frame->len = *p++;
+            frame->flags = 0;
+            if (tag & UPLINK_T_FD) {
+                if (p >= end) {
+                    return -1;
+                }
+                frame->flags = *p++ | CANFD_FDF;
+            }
+            if (end - p < frame->len) {
+                return -1;
+            }
+            memcpy(frame->data, p, frame->len);
+            p += frame->len;
+        }
+        fn(ctx, ts, tag & UPLINK_T_IFACE_MASK, frame);
+    }
+    return count;
+}
+
+#endif // UPLINK_H
@@ -0,0 +1,120 @@
+/*
+ * Static tracepoints (USDT)
+ *
+ * Each probe is a single nop in the code plus an ELF note
+ * (.note.stapsdt, the SystemTap SDT format) naming it and saying where its
+ * arguments are, so perf, bpftrace and other SDT-aware tracers can attach
+ * to the running binary without a rebuild:
+ *
+ *   bpftrace -l 'usdt:./can_bridge:*'
+ *   bpftrace -e 'usdt:./can_bridge:can_bridge:tx { @sent[arg0] = sum(arg2); }'
+ *   perf buildid-cache --add ./can_bridge && perf probe sdt_can_bridge:dispatch
+ *   perf record -e sdt_can_bridge:dispatch -p $(pidof can_bridge)
+ *
+ * A tracer replaces the nop with a breakpoint while it is attached; the
+ * arguments are only read then. Until then a probe costs the nop and
+ * keeping its arguments (all converted to long) in registers. The note is
+ * written here rather than with <sys/sdt.h>, which the RCU4 toolchain does
+ * not ship; make USDT=0 compiles the probes out.
+ *
+ * Probes of provider can_bridge, in pipeline order:
+ *
+ *   loop_wakeup(events)                    epoll_wait() returned
+ *   rx_batch_start(iface, frames)          a received batch enters the pipeline
+ *   rx_batch_end(iface, frames)            ...and has gone through it
+ *   dispatch(iface, can_id)                PGN dispatch of a frame
+ *   decode(iface, pgn, sa)                 a decoder starts on a changed payload
+ *   decode_end(iface, pgn)                 ...and returns
+ *   enqueue(src, dst, can_id, level)       a frame is queued for a destination
+ *   enqueue_drop(src, dst, can_id, level)  ...or dropped, its queue being full
+ *   tx(dst, frames, sent)                  sendmmsg() of a batch returned
+ *                                          (sent -1 on error)
+ */
+
+#ifndef USDT_H
+#define USDT_H
+
+#ifndef CAN_BRIDGE_NO_USDT
+
+#define USDT_STR_(x) #x
+#define USDT_STR(x) USDT_STR_(x)
+
+#if __SIZEOF_POINTER__ == 8
+#define USDT_ADDR ".8byte "
+#else
+#define USDT_ADDR ".4byte "
+#endif
+
+// Argument n: a signed long in a register
+#define USDT_ARG(n) "-" USDT_STR(__SIZEOF_LONG__) "@%[usdt_a" #n "]"
+
+// Probe site and its note. _.stapsdt.base (one per binary) lets tracers
+// correct the probe addresses for prelinking.
+#define USDT_ASM(provider, name, args)                                              \
+    "990: nop\n"                                                                    \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                   \
+    ".balign 4\n"                                                                   \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                              \
+    "991: .asciz \"stapsdt\"\n"                                                     \
+    "992: .balign 4\n"                                                              \
+    "993: " USDT_ADDR "990b\n"                                                      \
+    USDT_ADDR "_.stapsdt.base\n"                                                    \
+    USDT_ADDR "0\n"                                                                 \
+    ".asciz \"" #provider "\"\n"                                                    \
+    ".asciz \"" #name "\"\n"                                                        \
+    ".asciz \"" args "\"\n"                                                         \
+    "994: .balign 4\n"                                                              \
+    ".popsection\n"                                                                 \
+    ".ifndef _.stapsdt.base\n"                                                      \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"         \
+    ".weak _.stapsdt.base\n"                                                        \
+    ".hidden _.stapsdt.base\n"                                                      \
+    "_.stapsdt.base: .space 1\n"                                                    \
+    ".size _.stapsdt.base, 1\n"                                                     \
+    ".popsection\n"                                                                 \
+    ".endif\n"
+
+#define USDT_PROBE0(provider, name)                                                 \
+    __asm__ __volatile__(USDT_ASM(provider, name, "") : :)
+
+#define USDT_PROBE1(provider, name, a0)                                             \
+    __asm__ __volatile__(USDT_ASM(provider, name, USDT_ARG(0))                      \
+                         : : [usdt_a0] "r" ((long)(a0)))
+
+#define USDT_PROBE2(provider, name, a0, a1)                                         \
+    __asm__ __volatile__(USDT_ASM(provider, name, USDT_ARG(0) " " USDT_ARG(1))      \
+                         : : [usdt_a0] "r" ((long)(a0)),                                 \
+                             [usdt_a1] "r" ((long)(a1)))
+
+#define USDT_PROBE3(provider, name, a0, a1, a2)                                     \
+    __asm__ __volatile__(USDT_ASM(provider, name,                                   \
+                                  USDT_ARG(0) " " USDT_ARG(1) " " USDT_ARG(2))      \
+                         : : [usdt_a0] "r" ((long)(a0)), [usdt_a1] "r" ((long)(a1)),     \
+                             [usdt_a2] "r" ((long)(a2)))
+
+#define USDT_PROBE4(provider, name, a0, a1, a2, a3)                                 \
+    __asm__ __volatile__(USDT_ASM(provider, name,                                   \
+                                  USDT_ARG(0) " " USDT_ARG(1) " " USDT_ARG(2) " "   \
+                                  USDT_ARG(3))                                      \
+                         : : [usdt_a0] "r" ((long)(a0)), [usdt_a1] "r" ((long)(a1)),     \
+                             [usdt_a2] "r" ((long)(a2)), [usdt_a3] "r" ((long)(a3)))
+
+#else
+
+#define USDT_PROBE0(provider, name) do { } while (0)
+#define USDT_PROBE1(provider, name, a0) do { (void)(a0); } while (0)
+#define USDT_PROBE2(provider, name, a0, a1) do { (void)(a0); (void)(a1); } while (0)
+#define USDT_PROBE3(provider, name, a0, a1, a2) do { (void)(a0); (void)(a1); (void)(a2); } while (0)
+#define USDT_PROBE4(provider, name, a0, a1, a2, a3) \
+    do { (void)(a0); (void)(a1); (void)(a2); (void)(a3); } while (0)
+
+#endif // CAN_BRIDGE_NO_USDT
+
+// Probes of the bridge
+#define PROBE0(name) USDT_PROBE0(can_bridge, name)
+#define PROBE1(name, a0) USDT_PROBE1(can_bridge, name, a0)
+#define PROBE2(name, a0, a1) USDT_PROBE2(can_bridge, name, a0, a1)
+#define PROBE3(name, a0, a1, a2) USDT_PROBE3(can_bridge, name, a0, a1, a2)
+#define PROBE4(name, a0, a1, a2, a3) USDT_PROBE4(can_bridge, name, a0, a1, a2, a3)
+
+#endif // USDT_H